@@ -23,7 +23,17 @@ extern "C" {
 
 #include "cctalk/enum.h"
 #include "cctalk/host.h"
+#include "cctalk/transport.h"
+#include "cctalk/capture.h"
+#include "cctalk/board.h"
 #include "cctalk/device.h"
+#include "cctalk/events.h"
+#include "cctalk/bus.h"
+#include "cctalk/queue.h"
+#include "cctalk/bill.h"
+#include "cctalk/hopper.h"
+#include "cctalk/manager.h"
+#include "cctalk/daemon.h"
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_BILL_H
+#define _CCTALK_BILL_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "enum.h"
+#include "host.h"
+#include "device.h"
+#include "events.h"
+#include "bus.h"
+
+/* Information about last 5 bill validator events. */
+struct cctalk_bill_info {
+	/* Event counter, same rules as for the coin credits. */
+	uint8_t seq;
+
+	struct {
+		/* Bill type or 0 for status events. */
+		uint8_t type;
+
+		/* For bills 0 when stacked and 1 when held in escrow,
+		 * enum cctalk_bill_status for status events. */
+		uint8_t code;
+	} bills[5];
+};
+
+/* Read buffered bill events. */
+int cctalk_bill_query_events(const struct cctalk_device *dev,
+                             struct cctalk_bill_info *info);
+
+/* Decode reply to the bill events query made some other way,
+ * such as by the bus scheduler.  Returns -1 for error replies. */
+int cctalk_parse_bill_events(const struct cctalk_message *reply,
+                             struct cctalk_bill_info *info);
+
+/*
+ * Stack or return the bill held in escrow, or ask the validator to
+ * hold it a little longer.  Never retried, so that a single decision
+ * is never carried out twice.  Returns -1 on failure with errno set
+ * to ENOENT when there is no bill in escrow.
+ */
+int cctalk_bill_route(const struct cctalk_device *dev,
+                      enum cctalk_bill_route route);
+
+/*
+ * Queue the routing decision on the bus ahead of all polls and
+ * ordinary requests, so that it only waits for the exchange in
+ * progress.  Use cctalk_bill_route_result() in the callback.
+ */
+int cctalk_bill_submit_route(struct cctalk_bus *bus,
+                             const struct cctalk_device *dev,
+                             enum cctalk_bill_route route,
+                             cctalk_reply_cb callback, void *arg);
+
+/* Interpret reply to the routing request, see cctalk_bill_route(). */
+int cctalk_bill_route_result(const struct cctalk_message *reply);
+
+/* Read identifier of given bill type, such as "EU0020A" for
+ * 20 EUR, into a buffer of given size. */
+int cctalk_bill_query_id(const struct cctalk_device *dev, uint8_t type,
+                         char *id, size_t size);
+
+/*
+ * Turn the bill validator event buffer into events, exactly like
+ * cctalk_device_credit_events() does for coins.  Bills held in escrow
+ * produce CCTALK_EVENT_BILL_ESCROW and bills only get credited with
+ * CCTALK_EVENT_BILL_CREDIT once they are stacked.
+ */
+int cctalk_device_bill_events(struct cctalk_device *dev,
+                              const struct cctalk_bill_info *info,
+                              struct cctalk_event_ring *ring);
+
+/* Query bill events and push the new ones into the ring.
+ * Returns -1 on failure. */
+int cctalk_device_poll_bills(struct cctalk_device *dev,
+                             struct cctalk_event_ring *ring);
+
+
+#endif				/* !_CCTALK_BILL_H */
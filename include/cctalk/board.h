@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_BOARD_H
+#define _CCTALK_BOARD_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <stdint.h>
+
+/* Identifies the board file format. */
+#define CCTALK_BOARD_MAGIC "ccTalkB1"
+
+/* Device state as last seen by the polling engine. */
+struct cctalk_board_state {
+	/* The device answered its last poll. */
+	uint8_t online;
+
+	/* Status of the last reply, 0 for ACK. */
+	uint8_t status;
+
+	/* Coins were last set to be accepted, see struct cctalk_device. */
+	uint8_t accepting;
+
+	/* Last credit or bill event counter and the last error code. */
+	uint8_t credit_seq;
+	uint8_t last_error;
+
+	/* Bitmask of acceptable coins. */
+	uint16_t coin_mask;
+
+	/* Consecutive failed polls. */
+	uint32_t failures;
+
+	/* Polls carried out and failed in total. */
+	uint64_t polls, errors;
+
+	/* Milliseconds since the epoch of the last poll
+	 * and of the last one that got a reply. */
+	int64_t updated, seen;
+};
+
+/* Board of device states in a shared memory-mapped file. */
+struct cctalk_board;
+
+/*
+ * Create the board file for publishing, or start over in a previous
+ * one.  Readers that still have it mapped keep working and see no
+ * devices until they get published again.
+ * Attach it to a bus by setting bus->board, every poll then publishes
+ * the state of the polled device.  There must be only one publisher.
+ */
+struct cctalk_board *cctalk_board_open(const char *path);
+
+/* Map the board file for reading, from any process. */
+struct cctalk_board *cctalk_board_map(const char *path);
+
+/* Unmap and close the board. */
+void cctalk_board_close(struct cctalk_board *board);
+
+/* Publish state of the device at given address. */
+void cctalk_board_publish(struct cctalk_board *board, uint8_t address,
+                          const struct cctalk_board_state *state);
+
+/*
+ * Read consistent state of the device at given address.  Never makes
+ * any system calls, so it can be called as often as needed.
+ *
+ * Returns -1 with errno set to ENOENT when the device was never
+ * published or EAGAIN when the publisher died halfway through.
+ */
+int cctalk_board_read(const struct cctalk_board *board, uint8_t address,
+                      struct cctalk_board_state *state);
+
+
+#endif				/* !_CCTALK_BOARD_H */
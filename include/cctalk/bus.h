@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_BUS_H
+#define _CCTALK_BUS_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <sys/types.h>
+
+#include "enum.h"
+#include "host.h"
+#include "device.h"
+#include "board.h"
+
+/* Poll interval used when the device does not recommend any. */
+#define CCTALK_BUS_DEFAULT_INTERVAL 200
+
+/*
+ * Called with the reply to every poll.
+ * The reply is NULL if the device did not answer properly.
+ */
+typedef void (*cctalk_poll_cb)(struct cctalk_device *dev,
+                               const struct cctalk_message *reply,
+                               void *arg);
+
+/* Single device scheduled for polling. */
+struct cctalk_bus_slot {
+	/* Polled device, owned by the bus. */
+	struct cctalk_device *dev;
+
+	/* Method to poll the device with. */
+	enum cctalk_method method;
+
+	/* Where to deliver replies. */
+	cctalk_poll_cb callback;
+	void *arg;
+
+	/* Poll interval in milliseconds, as recommended by the device. */
+	int interval;
+
+	/* When is the next poll due. */
+	int64_t due;
+
+	/* Smoothed duration of single poll in milliseconds * 8. */
+	int64_t duration;
+
+	/* Consecutive failed polls, used for backing off. */
+	unsigned failures;
+
+	/* Milliseconds since the epoch of the last reply. */
+	int64_t seen;
+
+	/* Statistics since the last cctalk_bus_load() reset. */
+	uint64_t polls, errors, late;
+	int64_t max_lateness;
+
+	/* Polls carried out and failed in total, never reset. */
+	uint64_t total_polls, total_errors;
+};
+
+/* One-shot request waiting for the bus. */
+struct cctalk_bus_request {
+	struct cctalk_bus_request *next;
+
+	uint8_t destination;
+	enum cctalk_method method;
+	uint8_t data[255];
+	size_t length;
+
+	cctalk_reply_cb callback;
+	void *arg;
+
+	/* Queued with cctalk_bus_submit_urgent(). */
+	int urgent;
+};
+
+/* Scheduler of device polls on a single host. */
+struct cctalk_bus {
+	/* Host all the devices are attached to. */
+	struct cctalk_host *host;
+
+	/* Scheduled devices. */
+	struct cctalk_bus_slot *slots;
+	size_t nslots;
+
+	/* Index of the slot being polled or -1. */
+	ssize_t current;
+
+	/* One-shot requests, the first one may be in progress. */
+	struct cctalk_bus_request *requests, **requests_tail;
+
+	/* The last transaction started was a one-shot request. */
+	int after_request;
+
+	/* When did the current poll start. */
+	int64_t started;
+
+	/* Time the bus was busy polling and since when we measure. */
+	int64_t busy, since;
+
+	/* Where to publish the device states after every poll,
+	 * see cctalk_board_open().  Not owned by the bus. */
+	struct cctalk_board *board;
+};
+
+/* Bus load report. */
+struct cctalk_bus_load {
+	/* Fraction of time the bus was busy since the last reset. */
+	double utilization;
+
+	/* Fraction of time the devices need to be polled at their
+	 * recommended rates.  Above 1.0 the bus is oversubscribed. */
+	double demand;
+
+	/* Polls carried out, failed and started at least one full
+	 * interval late. */
+	uint64_t polls, errors, late;
+
+	/* Worst delay of a poll past its due time in milliseconds. */
+	int64_t max_lateness;
+};
+
+/* Create scheduler for devices on given host. */
+struct cctalk_bus *cctalk_bus_new(struct cctalk_host *host);
+
+/* Free the scheduler along with all its devices.  Requests not
+ * carried out yet complete with ECANCELED. */
+void cctalk_bus_free(struct cctalk_bus *bus);
+
+/*
+ * Take over the device and start polling it with given method.
+ *
+ * The polling interval is queried from the device right away using
+ * the REQUEST_POLLING_PRIORITY method, so the host must be idle.
+ * Devices without a recommendation get CCTALK_BUS_DEFAULT_INTERVAL.
+ */
+int cctalk_bus_add(struct cctalk_bus *bus, struct cctalk_device *dev,
+                   enum cctalk_method method, cctalk_poll_cb callback,
+                   void *arg);
+
+/*
+ * Queue one-shot request to the device.  Requests are started as soon
+ * as the host becomes idle and complete through the callback just like
+ * cctalk_host_submit() ones.  A poll that is a whole interval late gets
+ * its turn between two ordinary requests, so that they cannot starve
+ * polling.
+ */
+int cctalk_bus_submit(struct cctalk_bus *bus, uint8_t destination,
+                      enum cctalk_method method, const void *data,
+                      size_t length, cctalk_reply_cb callback, void *arg);
+
+/* Queue one-shot request ahead of all the ordinary ones,
+ * but behind other urgent requests. */
+int cctalk_bus_submit_urgent(struct cctalk_bus *bus, uint8_t destination,
+                             enum cctalk_method method, const void *data,
+                             size_t length, cctalk_reply_cb callback,
+                             void *arg);
+
+/* Return poll(2) events to wait for on the host fd. */
+short cctalk_bus_events(const struct cctalk_bus *bus);
+
+/* Return milliseconds until the bus needs attention or -1. */
+int cctalk_bus_next_timeout(const struct cctalk_bus *bus);
+
+/*
+ * Advance polling.  Pass the events poll(2) reported for the host fd
+ * or 0 when it timed out.  Never blocks.  Starts the poll of the most
+ * overdue device whenever the host becomes idle.
+ */
+void cctalk_bus_dispatch(struct cctalk_bus *bus, short revents);
+
+/* Run the bus for given number of milliseconds, blocking. */
+int cctalk_bus_run(struct cctalk_bus *bus, int duration);
+
+/* Report bus load, optionally resetting the statistics. */
+void cctalk_bus_load(struct cctalk_bus *bus, struct cctalk_bus_load *load,
+                     int reset);
+
+
+#endif				/* !_CCTALK_BUS_H */
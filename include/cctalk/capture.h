@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_CAPTURE_H
+#define _CCTALK_CAPTURE_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Identifies the capture file format. */
+#define CCTALK_CAPTURE_MAGIC "ccTalkC1"
+
+/* Default and the smallest size of the capture ring, in bytes. */
+#define CCTALK_CAPTURE_DEFAULT_SIZE (1 << 20)
+#define CCTALK_CAPTURE_MIN_SIZE     (1 << 12)
+
+/* Kinds of captured records. */
+enum cctalk_capture_type {
+	/* Frame written to the line. */
+	CCTALK_CAPTURE_TX = 1,
+
+	/* Frame read from the line. */
+	CCTALK_CAPTURE_RX = 2,
+
+	/* Unused space at the end of the ring, skip it. */
+	CCTALK_CAPTURE_PAD = 3,
+};
+
+/* Flags of captured records. */
+enum cctalk_capture_flags {
+	/* The frame used CRC-16-CCITT checksum. */
+	CCTALK_CAPTURE_CCITT = 1,
+
+	/* The checksum did not match. */
+	CCTALK_CAPTURE_BAD_CHECKSUM = 2,
+
+	/* The frame stopped arriving halfway. */
+	CCTALK_CAPTURE_TRUNCATED = 4,
+};
+
+/* Start of the capture file. */
+struct cctalk_capture_header {
+	char magic[8];
+
+	/* Size of the ring following the header. */
+	uint64_t size;
+
+	/* Offsets of the oldest record and past the newest one.
+	 * They only ever grow, position in the ring is offset % size. */
+	uint64_t tail, head;
+
+	/* Records written and dropped for being too large. */
+	uint64_t records, dropped;
+
+	uint8_t reserved[16];
+};
+
+/* Single captured frame, padded to 16 bytes. */
+struct cctalk_capture_record {
+	/* Length of the whole record, including the padding. */
+	uint32_t length;
+
+	/* See enum cctalk_capture_type and enum cctalk_capture_flags. */
+	uint8_t type;
+	uint8_t flags;
+
+	/* Number of the frame bytes. */
+	uint16_t size;
+
+	/* Microseconds since the epoch. */
+	int64_t time;
+
+	uint8_t data[0];
+};
+
+/* Open capture ring, see cctalk_capture_open(). */
+struct cctalk_capture;
+
+/*
+ * Open the capture ring file for writing, creating it with given size
+ * when it does not exist or has a different one.  Size is rounded
+ * up to a multiple of 16 bytes.  Existing records are kept.  The file
+ * is memory-mapped and records are only copied into it, so the capture
+ * is cheap enough to be left enabled.
+ *
+ * Attach it to a host by setting host->capture.  Every host needs its
+ * own capture, they are not safe to share between threads.
+ */
+struct cctalk_capture *cctalk_capture_open(const char *path, size_t size);
+
+/* Open the capture ring file for reading. */
+struct cctalk_capture *cctalk_capture_map(const char *path);
+
+/* Unmap and close the capture ring. */
+void cctalk_capture_close(struct cctalk_capture *cap);
+
+/* Append a record, the oldest records are overwritten when needed. */
+void cctalk_capture_write(struct cctalk_capture *cap,
+                          enum cctalk_capture_type type, int flags,
+                          const void *data, size_t size);
+
+/* Return the capture header. */
+const struct cctalk_capture_header *
+cctalk_capture_header(const struct cctalk_capture *cap);
+
+/*
+ * Iterate over the records, oldest first.  Start with *offset set
+ * to the tail from the header.  Returns NULL past the newest record
+ * or when the ring turns out to be damaged.
+ */
+const struct cctalk_capture_record *
+cctalk_capture_next(const struct cctalk_capture *cap, uint64_t *offset);
+
+
+#endif				/* !_CCTALK_CAPTURE_H */
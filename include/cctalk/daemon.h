@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_DAEMON_H
+#define _CCTALK_DAEMON_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <stdint.h>
+
+/*
+ * Protocol spoken by cctalkd over its Unix domain socket.
+ *
+ * Every message in both directions is a struct cctalkd_header
+ * followed by length bytes of data.  Fields are in host byte order,
+ * the socket never leaves the machine.
+ */
+
+/* Default path of the daemon socket. */
+#define CCTALKD_SOCKET "/run/cctalkd.sock"
+
+/* Kinds of messages. */
+enum cctalkd_message_type {
+	/* Request to forward to a device, answered with CCTALKD_REPLY.
+	 * Identical reading requests of several clients that are
+	 * queued at the same time share a single transaction. */
+	CCTALKD_REQUEST = 1,
+
+	/* Reply to any client message, with the same tag. */
+	CCTALKD_REPLY = 2,
+
+	/* Start or stop receiving events of the device or, with address
+	 * 0, of all devices on the line the daemon polls for them. */
+	CCTALKD_SUBSCRIBE = 3,
+	CCTALKD_UNSUBSCRIBE = 4,
+
+	/* Credit or bill event, carries struct cctalkd_event. */
+	CCTALKD_EVENT = 5,
+};
+
+/* Message header. */
+struct cctalkd_header {
+	/* See enum cctalkd_message_type. */
+	uint8_t type;
+
+	/* Serial line, in the order given to the daemon. */
+	uint8_t line;
+
+	/* Chosen by the client and copied into the reply. */
+	uint16_t tag;
+
+	/* Device address. */
+	uint8_t address;
+
+	/* Method of requests, status of replies and
+	 * enum cctalk_event_type of events. */
+	uint8_t header;
+
+	/* The errno value of failed replies, 0 otherwise. */
+	uint8_t error;
+
+	/* Number of data bytes that follow. */
+	uint8_t length;
+};
+
+/* Data of event messages, see struct cctalk_event. */
+struct cctalkd_event {
+	uint8_t seq;
+	uint8_t value;
+	uint8_t sorter;
+	uint8_t error;
+	uint8_t status;
+	uint8_t reserved;
+	uint16_t lost;
+};
+
+
+#endif				/* !_CCTALK_DAEMON_H */
@@ -21,13 +21,15 @@
 # error "This file cannot be included directly, include <cctalk.h> instead."
 #endif
 
+#include <sys/types.h>
+
 #include "enum.h"
 #include "host.h"
 
 /* Specific peer device. */
 struct cctalk_device {
 	/* Host this device can be reached through. */
-	const struct cctalk_host *host;
+	struct cctalk_host *host;
 
 	/* Address to use when communicating with the device. */
 	uint8_t id;
@@ -38,11 +40,34 @@ struct cctalk_device {
 	/* Bitmask of acceptable coins. */
 	uint16_t coin_mask;
 
+	/* Serial number, if known. */
+	uint32_t serial;
+
+	/* Last credit or bill event reported by the event engine. */
+	uint8_t credit_seq;
+
+	/* Acceptor error code or bill validator status of the last
+	 * error event reported by the event engine. */
+	uint8_t last_error;
+
 	/* Detected device features. */
 	unsigned has_master_inhibit_status : 1;
 	unsigned has_inhibit_status : 1;
+
+	/* Features are detected lazily, these tell which ones were. */
+	unsigned probed_master_inhibit_status : 1;
+	unsigned probed_inhibit_status : 1;
+
+	/* The credit_seq above is valid. */
+	unsigned credit_seq_known : 1;
+
+	/* Coins were last set to be accepted and the device agreed. */
+	unsigned accepting : 1;
 };
 
+/* Probe timeout suitable for cctalk_device_discover(). */
+#define CCTALK_DISCOVER_TIMEOUT 50
+
 /* Information about last 5 inserted coins. */
 struct cctalk_credit_info {
 	/* Sequence number starting with 0 on power up,
@@ -62,22 +87,51 @@ struct cctalk_credit_info {
 };
 
 /* Scan the peer device and prepare above structure.
- * You may not free the host before the device. */
-struct cctalk_device *cctalk_device_scan(const struct cctalk_host *host,
+ * You may not free the host before the device.
+ * Features are detected on first use. */
+struct cctalk_device *cctalk_device_scan(struct cctalk_host *host,
                                          uint8_t id);
 
+/*
+ * Scan the peer device using a capability cache file.
+ *
+ * The device is identified by its address and serial number (or
+ * product code) and, when found in the cache, comes up without any
+ * further probing.  Unknown devices are scanned, fully probed and
+ * added to the cache, unless some of the probes got no reply.
+ * Processes sharing the file take turns updating it.
+ */
+struct cctalk_device *cctalk_device_scan_cached(struct cctalk_host *host,
+                                                uint8_t id,
+                                                const char *path);
+
+/*
+ * Find all devices on the bus and scan them.
+ *
+ * Devices are located using the broadcast ADDRESS_POLL, which takes
+ * a little over a second.  When nobody answers it, every address is
+ * tried with SIMPLE_POLL and the given timeout in milliseconds.
+ *
+ * Returns number of devices stored into a newly allocated array,
+ * or -1 on failure.  Free the devices and then the array.
+ */
+ssize_t cctalk_device_discover(struct cctalk_host *host,
+                               struct cctalk_device ***devices,
+                               int probe_timeout);
+
 /* Free the device structure. */
 void cctalk_device_free(struct cctalk_device *device);
 
 /*
  * Make the device accept or reject coins in general.
- * Returns -1 in case of failure.
+ * Returns -1 in case of failure, including when the device did not
+ * answer whether it supports inhibiting at all.
  *
- * If the device cannot reject coins at all, pretends success.
+ * If the device is known not to reject coins at all, pretends success.
  */
-int cctalk_device_set_accept_coins(const struct cctalk_device *dev, int on);
+int cctalk_device_set_accept_coins(struct cctalk_device *dev, int on);
 
-/* Change set of acceptable coins.
+/* Change set of acceptable coins.  Returns -1 in case of failure.
  * If the device does not support masking coins, pretends success. */
 int cctalk_device_set_coin_mask(struct cctalk_device *dev, uint16_t mask);
 
@@ -85,5 +139,10 @@ int cctalk_device_set_coin_mask(struct cctalk_device *dev, uint16_t mask);
 int cctalk_device_query_credits(const struct cctalk_device *dev,
                                 struct cctalk_credit_info *info);
 
+/* Decode reply to the credits query made some other way,
+ * such as by the bus scheduler.  Returns -1 for error replies. */
+int cctalk_parse_credits(const struct cctalk_message *reply,
+                         struct cctalk_credit_info *info);
+
 
 #endif				/* !_CCTALK_DEVICE_H */
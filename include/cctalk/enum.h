@@ -228,4 +228,41 @@ enum cctalk_acceptor_error {
 	CCTALK_AE_UNSPECIFIED                 = 255,
 };
 
+/* Bill validator status and error events. */
+enum cctalk_bill_status {
+	CCTALK_BS_MASTER_INHIBIT_ACTIVE       = 0,
+	CCTALK_BS_RETURNED_FROM_ESCROW        = 1,
+	CCTALK_BS_INVALID_BILL_VALIDATION     = 2,
+	CCTALK_BS_INVALID_BILL_TRANSPORT      = 3,
+	CCTALK_BS_INHIBITED_BILL_SERIAL       = 4,
+	CCTALK_BS_INHIBITED_BILL_DIP_SWITCHES = 5,
+	CCTALK_BS_JAMMED_IN_TRANSPORT_UNSAFE  = 6,
+	CCTALK_BS_JAMMED_IN_STACKER           = 7,
+	CCTALK_BS_PULLED_BACKWARDS            = 8,
+	CCTALK_BS_TAMPER                      = 9,
+	CCTALK_BS_STACKER_OK                  = 10,
+	CCTALK_BS_STACKER_REMOVED             = 11,
+	CCTALK_BS_STACKER_INSERTED            = 12,
+	CCTALK_BS_STACKER_FAULTY              = 13,
+	CCTALK_BS_STACKER_FULL                = 14,
+	CCTALK_BS_STACKER_JAMMED              = 15,
+	CCTALK_BS_JAMMED_IN_TRANSPORT_SAFE    = 16,
+	CCTALK_BS_OPTO_FRAUD                  = 17,
+	CCTALK_BS_STRING_FRAUD                = 18,
+	CCTALK_BS_ANTI_STRING_FAULTY          = 19,
+	CCTALK_BS_BARCODE_DETECTED            = 20,
+	CCTALK_BS_UNKNOWN_BILL_STACKED        = 21,
+};
+
+/* Where to route the bill held in escrow. */
+enum cctalk_bill_route {
+	CCTALK_BILL_RETURN = 0,
+	CCTALK_BILL_STACK  = 1,
+	CCTALK_BILL_HOLD   = 255,
+};
+
+/* Name of the method without the prefix, such as "SIMPLE_POLL",
+ * or NULL for unknown methods. */
+const char *cctalk_method_name(enum cctalk_method method);
+
 #endif				/* !_CCTALK_ENUM_H */
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_EVENTS_H
+#define _CCTALK_EVENTS_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "enum.h"
+#include "host.h"
+#include "device.h"
+
+/* Kinds of acceptor and bill validator events. */
+enum cctalk_event_type {
+	/* Coin was accepted and should be credited. */
+	CCTALK_EVENT_CREDIT = 1,
+
+	/* Coin was rejected or something went wrong, see error. */
+	CCTALK_EVENT_ERROR = 2,
+
+	/* More events than the device buffers happened since the last
+	 * poll, some of them were lost.  Counted in the lost field. */
+	CCTALK_EVENT_OVERFLOW = 3,
+
+	/* The device was power cycled or reset, the events it had
+	 * not reported yet are gone. */
+	CCTALK_EVENT_RESET = 4,
+
+	/* Bill was stacked and should be credited. */
+	CCTALK_EVENT_BILL_CREDIT = 5,
+
+	/* Bill is held in escrow, waiting to be routed with
+	 * cctalk_bill_route() before the validator gives up. */
+	CCTALK_EVENT_BILL_ESCROW = 6,
+
+	/* Bill validator status or error, see status. */
+	CCTALK_EVENT_BILL_STATUS = 7,
+};
+
+/* Single event of an acceptor or bill validator. */
+struct cctalk_event {
+	/* Device that reported it. */
+	struct cctalk_device *dev;
+
+	enum cctalk_event_type type;
+
+	/* Event counter value of the event, 0 for reset. */
+	uint8_t seq;
+
+	/* Index of the accepted coin and its sorter path,
+	 * or type of the bill. */
+	uint8_t value;
+	uint8_t sorter;
+
+	/* Acceptor error code of error events. */
+	enum cctalk_acceptor_error error;
+
+	/* Bill validator status of status events. */
+	enum cctalk_bill_status status;
+
+	/* Number of events lost to an overflow. */
+	unsigned lost;
+
+	/* Milliseconds of CLOCK_MONOTONIC when the event was noticed. */
+	int64_t time;
+};
+
+/*
+ * Lock-free ring of events for exactly one producer thread
+ * (the one polling the devices) and one consumer thread.
+ */
+struct cctalk_event_ring;
+
+/* Create event ring, size is rounded up to a power of two. */
+struct cctalk_event_ring *cctalk_event_ring_new(size_t size);
+
+/* Free the event ring. */
+void cctalk_event_ring_free(struct cctalk_event_ring *ring);
+
+/* Append an event, producer side.
+ * Returns -1 with errno set to ENOBUFS when the ring is full. */
+int cctalk_event_ring_push(struct cctalk_event_ring *ring,
+                           const struct cctalk_event *event);
+
+/* Take up to count oldest events, consumer side.
+ * Returns number of events taken, never blocks. */
+size_t cctalk_event_ring_pop(struct cctalk_event_ring *ring,
+                             struct cctalk_event *events, size_t count);
+
+/*
+ * Turn the credit buffer of the device into events.
+ *
+ * Only events that were not reported yet are pushed into the ring,
+ * oldest first, the device remembers the last one.  The first buffer
+ * seen only sets the starting point, unless credit_seq_known was set
+ * by hand.  When the ring fills up, the remaining events are left for
+ * the next call, so nothing is lost as long as the device buffer
+ * still holds them.
+ *
+ * Returns number of events pushed.
+ */
+int cctalk_device_credit_events(struct cctalk_device *dev,
+                                const struct cctalk_credit_info *info,
+                                struct cctalk_event_ring *ring);
+
+/* Query credits and push the new events into the ring,
+ * see above.  Returns -1 on failure. */
+int cctalk_device_poll_credits(struct cctalk_device *dev,
+                               struct cctalk_event_ring *ring);
+
+
+#endif				/* !_CCTALK_EVENTS_H */
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_HOPPER_H
+#define _CCTALK_HOPPER_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "enum.h"
+#include "host.h"
+#include "device.h"
+#include "bus.h"
+
+/* Reply to REQUEST_HOPPER_STATUS. */
+struct cctalk_hopper_status {
+	/* Incremented by every accepted dispense request. */
+	uint8_t counter;
+
+	/* Coins still to be paid out. */
+	uint8_t remaining;
+
+	/* Coins paid and not paid by the last dispense request. */
+	uint8_t paid, unpaid;
+};
+
+/* Enable or disable the payout. */
+int cctalk_hopper_enable(const struct cctalk_device *dev, int on);
+
+/* Run the hopper self test and store its fault flags,
+ * 0 when everything is fine. */
+int cctalk_hopper_test(const struct cctalk_device *dev, uint8_t *flags);
+
+/* Query the hopper status. */
+int cctalk_hopper_query_status(const struct cctalk_device *dev,
+                               struct cctalk_hopper_status *status);
+
+/* Decode reply to the status query made some other way,
+ * such as by the bus scheduler.  Returns -1 for error replies. */
+int cctalk_parse_hopper_status(const struct cctalk_message *reply,
+                               struct cctalk_hopper_status *status);
+
+/*
+ * Start paying out given number of coins and return right away,
+ * watch the status for progress.  Only hoppers without payout
+ * encryption are supported.  Never retried.
+ */
+int cctalk_hopper_dispense(const struct cctalk_device *dev, uint8_t count);
+
+/* Stop paying out and disable the hopper.
+ * Returns number of coins that were not paid or -1. */
+int cctalk_hopper_stop(const struct cctalk_device *dev);
+
+
+/* Maximum number of hoppers taking part in a payout. */
+#define CCTALK_PAYOUT_MAX_HOPPERS 8
+
+/* Progress of a single hopper in the payout. */
+enum cctalk_hopper_state {
+	/* Not paying anything. */
+	CCTALK_HOPPER_IDLE = 0,
+
+	/* Dispense request is on its way. */
+	CCTALK_HOPPER_STARTING = 1,
+
+	/* Dispense request got lost, the status will tell whether
+	 * the hopper has started or not. */
+	CCTALK_HOPPER_VERIFYING = 2,
+
+	/* Paying out coins. */
+	CCTALK_HOPPER_PAYING = 3,
+};
+
+struct cctalk_payout;
+
+/* Hopper with coins of a single value. */
+struct cctalk_payout_hopper {
+	struct cctalk_payout *payout;
+	struct cctalk_device *dev;
+
+	/* Value of a single coin. */
+	unsigned value;
+
+	enum cctalk_hopper_state state;
+
+	/* Counter of the last dispense request. */
+	uint8_t counter;
+
+	/* Coins left for further dispense requests, coins requested
+	 * by the current one and how many of them are out already. */
+	unsigned pending, batch, batch_paid;
+
+	/* Coins paid and not paid so far. */
+	unsigned paid, unpaid;
+
+	/* Ran out of coins, will not be asked to pay any more. */
+	int empty;
+};
+
+/*
+ * Called whenever the payout makes progress, with done set
+ * once all the hoppers have stopped.
+ */
+typedef void (*cctalk_payout_cb)(struct cctalk_payout *payout, int done,
+                                 void *arg);
+
+/* Payout of an amount using several hoppers at once. */
+struct cctalk_payout {
+	/* Bus the hoppers are polled on. */
+	struct cctalk_bus *bus;
+
+	struct cctalk_payout_hopper hoppers[CCTALK_PAYOUT_MAX_HOPPERS];
+	size_t nhoppers;
+
+	/* Amount requested and how much of it could not be planned,
+	 * because the hoppers lack suitable coins. */
+	unsigned amount, shortfall;
+
+	/* Payout in progress and emergency stop requested. */
+	int active, stopping;
+
+	cctalk_payout_cb callback;
+	void *arg;
+};
+
+/* Create payout driven by given bus. */
+struct cctalk_payout *cctalk_payout_new(struct cctalk_bus *bus,
+                                        cctalk_payout_cb callback,
+                                        void *arg);
+
+/* Free the payout.  Its hoppers stay on the bus. */
+void cctalk_payout_free(struct cctalk_payout *payout);
+
+/*
+ * Let the bus take over the hopper with coins of given value and poll
+ * its status, which drives the payout.  Queries the hopper right away,
+ * so the host must be idle.
+ */
+int cctalk_payout_add_hopper(struct cctalk_payout *payout,
+                             struct cctalk_device *dev, unsigned value);
+
+/*
+ * Start paying out given amount and return right away.
+ *
+ * The amount is split among the hoppers starting with the most
+ * valuable coins and all of them pay at once, so that the payout
+ * takes as long as the slowest hopper.  When a hopper runs out of
+ * coins, the rest is taken over by the others, if possible.
+ * Payout that has nothing to pay is not active after the call.
+ * Returns -1 with errno set to EBUSY when a payout is in progress.
+ */
+int cctalk_payout_start(struct cctalk_payout *payout, unsigned amount);
+
+/* Stop all the hoppers as soon as possible. */
+int cctalk_payout_stop(struct cctalk_payout *payout);
+
+/* Value paid out so far. */
+unsigned cctalk_payout_paid(const struct cctalk_payout *payout);
+
+
+#endif				/* !_CCTALK_HOPPER_H */
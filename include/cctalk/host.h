@@ -36,21 +36,28 @@ enum cctalk_crc_mode {
 	CCTALK_CRC_CCITT = 1,
 };
 
-/* ccTalk host context for communication over serial line. */
-struct cctalk_host {
-	/* Serial line descriptor. */
-	int fd;
+/* Serial line settings. */
+struct cctalk_line {
+	/* Line speed, ccTalk devices default to 9600 baud. */
+	int baudrate;
 
-	/* Host identifier. */
-	uint8_t id;
+	/* Raw mode read parameters, see termios(3).  The host never
+	 * blocks in read(2), so they do not affect it at all. */
+	int vmin, vtime;
 
-	/* Selected CRC mode to send and to expect. */
-	enum cctalk_crc_mode crc_mode;
+	/* Ask the driver to push received bytes right away,
+	 * 0 to keep what the driver is set to. */
+	int low_latency;
 
-	/* Read/write timeout in milliseconds. */
-	int timeout;
+	/* FTDI adapter latency timer in milliseconds, 0 to keep.
+	 * Most of them default to 16 ms, which is added to every read. */
+	int latency_timer;
 };
 
+/* Settings used for newly opened lines. */
+#define CCTALK_LINE_DEFAULT \
+	((const struct cctalk_line){.baudrate = 9600, .vmin = 1})
+
 /* Single message with variable-length payload. */
 struct cctalk_message {
 	uint8_t destination;
@@ -60,9 +67,165 @@ struct cctalk_message {
 	uint8_t data[0];
 } __attribute__((__packed__));
 
+/* Longest possible frame on the wire, including the checksum. */
+#define CCTALK_FRAME_MAX (sizeof(struct cctalk_message) + 255 + 1)
+
+/* Size of the per-host receive buffer, fits several frames. */
+#define CCTALK_RXBUF_SIZE (4 * CCTALK_FRAME_MAX)
+
+/* States of the asynchronous request engine. */
+enum cctalk_host_state {
+	/* No request in progress, ready to submit. */
+	CCTALK_HOST_IDLE = 0,
+
+	/* Writing the request frame to the line. */
+	CCTALK_HOST_SENDING = 1,
+
+	/* Reading back our own frame from the line. */
+	CCTALK_HOST_ECHO = 2,
+
+	/* Waiting for the reply frame. */
+	CCTALK_HOST_REPLY = 3,
+};
+
+/*
+ * Number of round-trip latency histogram buckets.  Bucket i counts
+ * replies that took between 2^i and 2^(i+1) microseconds to arrive,
+ * the first one includes shorter and the last one longer round trips.
+ */
+#define CCTALK_RTT_BUCKETS 24
+
+/* Communication statistics, see cctalk_host_stats(). */
+struct cctalk_stats {
+	/* Frames and bytes written to the line. */
+	uint64_t frames_sent, bytes_sent;
+
+	/* Valid frames addressed to us and all bytes read from the line. */
+	uint64_t frames_received, bytes_received;
+
+	/* Our own frame did not come back from the line intact. */
+	uint64_t echo_errors;
+
+	/* Complete frames addressed to us with invalid checksum. */
+	uint64_t checksum_errors;
+
+	/* Expected data did not arrive in time. */
+	uint64_t timeouts;
+
+	/* Frames that stopped arriving halfway. */
+	uint64_t truncated;
+
+	/* Requests repeated after a failure. */
+	uint64_t retries;
+
+	/* Round-trip latency histograms per destination address. */
+	uint32_t rtt[256][CCTALK_RTT_BUCKETS];
+};
+
+/* Round-trip estimate for a single destination, in microseconds. */
+struct cctalk_rtt {
+	/* Smoothed round trip and its mean deviation, 0 if unknown. */
+	int32_t srtt, rttvar;
+
+	/* Consecutive timeouts, each one doubles the reply timeout. */
+	int32_t backoff;
+};
+
+struct cctalk_host;
+struct cctalk_capture;
+struct cctalk_transport;
+
+/*
+ * Completion callback for asynchronous requests.
+ *
+ * The reply is NULL if the request failed or timed out, errno is set
+ * accordingly.  The reply is only valid for the duration of the call.
+ */
+typedef void (*cctalk_reply_cb)(struct cctalk_host *host,
+                                const struct cctalk_message *reply,
+                                void *arg);
+
+/*
+ * ccTalk host context for communication over serial line.
+ * It must only be used by a single thread at a time, other threads
+ * can submit their requests through a cctalk_queue.
+ */
+struct cctalk_host {
+	/* Descriptor to poll(2) for the transport. */
+	int fd;
+
+	/* How the bytes get to the bus and its private data. */
+	const struct cctalk_transport *transport;
+	void *transport_data;
+
+	/* Host identifier. */
+	uint8_t id;
+
+	/* Selected CRC mode to send and to expect. */
+	enum cctalk_crc_mode crc_mode;
+
+	/* Read/write timeout in milliseconds.  Also the longest time to
+	 * wait for a reply to start arriving. */
+	int timeout;
+
+	/* Longest gap between bytes of a frame in milliseconds,
+	 * ccTalk itself allows 50 ms. */
+	int byte_timeout;
+
+	/* Lower bound of the adaptive reply timeout in milliseconds,
+	 * see cctalk_host_reply_timeout().  Set it to timeout to always
+	 * wait the full timeout. */
+	int min_timeout;
+
+	/* How many times cctalk_transact() repeats a request
+	 * that got no valid reply. */
+	int retries;
+
+	/* The line loops our own frames back to us, as the ccTalk bus
+	 * normally does.  Clear for point-to-point RS-232 wiring. */
+	int echo;
+
+	/* Asynchronous engine state, see cctalk_host_submit(). */
+	enum cctalk_host_state state;
+	int64_t deadline;
+	cctalk_reply_cb callback;
+	void *callback_arg;
+
+	/* Frame being sent and how much of it was already written. */
+	uint8_t txbuf[CCTALK_FRAME_MAX];
+	size_t txlen, txoff;
+
+	/* Receive buffer, bytes between rxoff and rxlen are pending. */
+	uint8_t rxbuf[CCTALK_RXBUF_SIZE];
+	size_t rxoff, rxlen;
+
+	/* Milliseconds of CLOCK_MONOTONIC when bytes last arrived. */
+	int64_t rx_at;
+
+	/* Microseconds of CLOCK_MONOTONIC when the last request left,
+	 * 0 once the reply to it arrived. */
+	int64_t sent_at;
+
+	/* The last request was a retransmission, its round trip is
+	 * ambiguous and must not be used for estimation. */
+	int retransmit;
+
+	/* Round-trip estimates per destination address. */
+	struct cctalk_rtt rtt[256];
+
+	/* Statistics collected so far. */
+	struct cctalk_stats stats;
+
+	/* Where to record the traffic, see cctalk_capture_open().
+	 * Not owned by the host. */
+	struct cctalk_capture *capture;
+};
+
 
 /*
  * Create ccTalk host context using specified serial port.
+ * Paths in the "tcp:node:port" form connect to a TCP serial bridge
+ * instead, see cctalk_host_new_tcp().
  *
  * You can freely tune the options in the returned structure
  * before you send any messages.
@@ -72,24 +235,123 @@ struct cctalk_host *cctalk_host_new(const char *path);
 /* Destroy the ccTalk host context. */
 void cctalk_host_free(struct cctalk_host *host);
 
+/*
+ * Reconfigure the serial line.  Fails with ENOTTY when the transport
+ * has no line to configure.  Low latency mode and latency timer are
+ * applied on a best effort basis, since not all drivers support them
+ * and the latter usually needs root.  Use cctalk_host_line_info()
+ * to find out what actually took effect.
+ */
+int cctalk_host_setup_line(struct cctalk_host *host,
+                           const struct cctalk_line *line);
+
+/* Report the effective serial line settings. */
+int cctalk_host_line_info(const struct cctalk_host *host,
+                          struct cctalk_line *line);
+
+/* Copy the statistics collected so far and optionally reset them. */
+void cctalk_host_stats(struct cctalk_host *host, struct cctalk_stats *stats,
+                       int reset);
+
+/*
+ * Estimate given percentile (0 to 100) of round-trip latency to given
+ * destination in microseconds, using the histogram bucket upper bounds.
+ * Returns -1 when there are no samples.
+ */
+int64_t cctalk_stats_rtt_percentile(const struct cctalk_stats *stats,
+                                    uint8_t destination, double percentile);
+
+/*
+ * Return how long to wait for a reply from given destination to start
+ * arriving, in milliseconds.  Smoothed round trip plus four times its
+ * deviation, doubled for every consecutive timeout and kept between
+ * min_timeout and timeout.  Destinations that never replied get the
+ * full timeout.
+ */
+int cctalk_host_reply_timeout(const struct cctalk_host *host,
+                              uint8_t destination);
+
+/*
+ * Send a request and receive the reply data, see cctalk_recv_data().
+ * Requests that time out or get garbled on the line are repeated up
+ * to host->retries times.  Only use it for requests that are safe
+ * to carry out twice.  Returns the reply status or -1 on failure.
+ */
+int cctalk_transact(struct cctalk_host *host, uint8_t destination,
+                    enum cctalk_method method, const void *data,
+                    size_t length, uint8_t *buf, size_t len);
+
 /* Send message via given ccTalk host. */
-int cctalk_send(const struct cctalk_host *host, uint8_t destination,
+int cctalk_send(struct cctalk_host *host, uint8_t destination,
                 enum cctalk_method method, void *data, size_t length);
 
 /*
  * Receive single message via given ccTalk host.
  * Returns NULL if no data arrives for more than timeout milliseconds.
+ * A frame that stops arriving for more than byte_timeout milliseconds
+ * fails with errno set to EBADMSG.
+ *
+ * Corrupted frames are skipped and the next valid frame addressed
+ * to the host is returned instead.
+ */
+struct cctalk_message *cctalk_recv(struct cctalk_host *host);
+
+/*
+ * Receive single message without copying it anywhere.
+ * Returns NULL if no data arrives for more than timeout milliseconds.
+ *
+ * The message lives in the host receive buffer and is only valid
+ * until the next call that communicates through the host.
+ */
+const struct cctalk_message *cctalk_recv_slot(struct cctalk_host *host);
+
+/*
+ * Receive single message into caller-provided storage of given size,
+ * CCTALK_FRAME_MAX bytes are always enough.  Checksum is kept right
+ * after the data.  Returns the message status or -1 on failure.
  */
-struct cctalk_message *cctalk_recv(const struct cctalk_host *host);
+int cctalk_recv_msg(struct cctalk_host *host, struct cctalk_message *msg,
+                    size_t size);
 
 /* Receive message and return it's status.
  * Returns -1 if no data arrives for more than timeout milliseconds. */
-int cctalk_recv_status(const struct cctalk_host *host);
+int cctalk_recv_status(struct cctalk_host *host);
 
 /* Receive message data and return it's status.
  * Returns -1 if no data arrives for more than timeout milliseconds.
  * If fewer than requested bytes arrives, buffer is nil padded. */
-int cctalk_recv_data(const struct cctalk_host *host, uint8_t *buf, size_t len);
+int cctalk_recv_data(struct cctalk_host *host, uint8_t *buf, size_t len);
+
+/*
+ * Start an asynchronous request.
+ *
+ * The request is carried out by cctalk_host_dispatch() calls made from
+ * your event loop and the callback is invoked with the reply once it
+ * arrives.  Only a single request can be in progress at a time, -1 with
+ * errno set to EBUSY is returned when the host is not idle.
+ *
+ * Do not mix asynchronous requests with the blocking functions above
+ * while a request is in progress.
+ */
+int cctalk_host_submit(struct cctalk_host *host, uint8_t destination,
+                       enum cctalk_method method, const void *data,
+                       size_t length, cctalk_reply_cb callback, void *arg);
+
+/* Return poll(2) events to wait for on the host fd, 0 when idle. */
+short cctalk_host_events(const struct cctalk_host *host);
+
+/* Return milliseconds until the current request times out,
+ * suitable for poll(2).  Returns -1 when idle. */
+int cctalk_host_next_timeout(const struct cctalk_host *host);
+
+/*
+ * Advance the request in progress.
+ *
+ * Pass the events poll(2) reported for the host fd, or 0 when your
+ * loop just timed out.  Never blocks.  Returns 1 if a request was
+ * completed (successfully or not) and 0 otherwise.
+ */
+int cctalk_host_dispatch(struct cctalk_host *host, short revents);
 
 
 #endif				/* !_CCTALK_HOST_H */
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_MANAGER_H
+#define _CCTALK_MANAGER_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include "enum.h"
+#include "host.h"
+#include "device.h"
+#include "bus.h"
+
+/* Result of a poll or request carried out by the manager. */
+struct cctalk_completion {
+	/* Bus the transaction happened on. */
+	struct cctalk_bus *bus;
+
+	/* Polled device or NULL for one-shot requests
+	 * and overflow reports. */
+	struct cctalk_device *dev;
+
+	/* Tag passed to cctalk_manager_submit(). */
+	void *tag;
+
+	/* Address and method of the request. */
+	uint8_t destination;
+	enum cctalk_method method;
+
+	/* Reply status or -1 on failure, in which case error
+	 * holds the errno value. */
+	int status;
+	int error;
+
+	/* Reply payload. */
+	uint8_t length;
+	uint8_t data[255];
+
+	/* Poll completions dropped because the queue was full, reported
+	 * with status -1 and ENOBUFS ahead of the queued ones. */
+	unsigned lost;
+};
+
+/* Manager of multiple buses, see cctalk_manager_new(). */
+struct cctalk_manager;
+
+/*
+ * Create manager running its buses on given number of threads.
+ *
+ * Buses are spread evenly among the threads, each of them waits
+ * for all its buses at once, so that a dead bus never delays others.
+ * With pin set, threads are pinned to consecutive processors.
+ */
+struct cctalk_manager *cctalk_manager_new(unsigned threads, int pin);
+
+/*
+ * Stop all threads.  Requests not carried out yet are cancelled with
+ * ECANCELED, their completions stay queued.  The manager cannot be
+ * started again.
+ */
+void cctalk_manager_stop(struct cctalk_manager *mgr);
+
+/* Stop the manager, free it, its buses and their hosts. */
+void cctalk_manager_free(struct cctalk_manager *mgr);
+
+/* Take over the bus and its host.  Only before the manager starts. */
+int cctalk_manager_add(struct cctalk_manager *mgr, struct cctalk_bus *bus);
+
+/*
+ * Schedule the device for polling with reports going to the
+ * completion queue.  Device must be on a bus of this manager that
+ * has not been started yet.
+ */
+int cctalk_manager_watch(struct cctalk_manager *mgr, struct cctalk_bus *bus,
+                         struct cctalk_device *dev,
+                         enum cctalk_method method);
+
+/* Start the threads. */
+int cctalk_manager_start(struct cctalk_manager *mgr);
+
+/*
+ * Queue one-shot request on the bus from any thread.
+ * The result arrives at the completion queue with the tag.
+ * It is never dropped, even when polls are.
+ */
+int cctalk_manager_submit(struct cctalk_manager *mgr, struct cctalk_bus *bus,
+                          uint8_t destination, enum cctalk_method method,
+                          const void *data, size_t length, void *tag);
+
+/* Descriptor that becomes readable when completions are pending. */
+int cctalk_manager_fd(const struct cctalk_manager *mgr);
+
+/*
+ * Take the oldest completion from the queue, waiting up to timeout
+ * milliseconds (-1 for ever).  Returns 1 on success, 0 on timeout.
+ */
+int cctalk_manager_wait(struct cctalk_manager *mgr,
+                        struct cctalk_completion *completion, int timeout);
+
+
+#endif				/* !_CCTALK_MANAGER_H */
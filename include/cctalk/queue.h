@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CCTALK_QUEUE_H
+#define _CCTALK_QUEUE_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <semaphore.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "enum.h"
+#include "host.h"
+#include "bus.h"
+
+struct cctalk_request;
+
+/* Called on the bus owner thread once the request completes. */
+typedef void (*cctalk_request_cb)(struct cctalk_request *req, void *arg);
+
+/*
+ * Request submitted from any thread, see cctalk_queue_submit().
+ * The submitter owns the memory, it must stay valid until the
+ * request completes.
+ */
+struct cctalk_request {
+	/* Link in the submission queue. */
+	struct cctalk_request *next;
+
+	uint8_t destination;
+	enum cctalk_method method;
+	uint8_t data[255];
+	size_t length;
+
+	/* Called on completion.  Without it, use cctalk_request_wait(). */
+	cctalk_request_cb callback;
+	void *arg;
+
+	/* Reply status or -1 with error holding the errno value. */
+	int status;
+	int error;
+
+	/* Reply data. */
+	uint8_t reply[255];
+	size_t reply_length;
+
+	/* Completion flag for polling and semaphore for waiting.
+	 * Only the latter says the request is no longer in use. */
+	int done;
+	sem_t sem;
+};
+
+/* Lock-free queue of requests from one priority lane. */
+struct cctalk_lane {
+	/* Last request pushed, the producers swap it atomically. */
+	struct cctalk_request *head __attribute__((aligned(64)));
+
+	/* Next request to take, owned by the consumer. */
+	struct cctalk_request *tail __attribute__((aligned(64)));
+
+	/* Placeholder that keeps the queue from ever being empty. */
+	struct cctalk_request *stub;
+};
+
+/*
+ * Requests from any number of threads to a bus run by a single owner
+ * thread.  Submitting takes no locks.  It is a single atomic exchange,
+ * and a wakeup write only when the owner sleeps.
+ *
+ * The urgent lane is handed over first and goes ahead of all polls and
+ * ordinary requests.  Emergency stops and inhibit changes take it on
+ * their own.
+ */
+struct cctalk_queue {
+	/* Bus the requests are carried out on. */
+	struct cctalk_bus *bus;
+
+	/* Ordinary and urgent submissions. */
+	struct cctalk_lane lanes[2];
+
+	/* The owner waits in poll(2) and needs the eventfd poked. */
+	int sleeping __attribute__((aligned(64)));
+
+	/* Wakeup eventfd. */
+	int fd;
+};
+
+/* Create the queue for given bus. */
+struct cctalk_queue *cctalk_queue_new(struct cctalk_bus *bus);
+
+/*
+ * Free the queue, failing its requests with ECANCELED, including
+ * those already handed to the bus.  A request the bus is carrying out
+ * right now still completes, or gets cancelled by cctalk_bus_free().
+ */
+void cctalk_queue_free(struct cctalk_queue *queue);
+
+/* Prepare the request, set callback and arg afterwards if needed. */
+int cctalk_request_init(struct cctalk_request *req, uint8_t destination,
+                        enum cctalk_method method, const void *data,
+                        size_t length);
+
+/* Release resources of a completed request before freeing it. */
+void cctalk_request_destroy(struct cctalk_request *req);
+
+/* Submit the request from any thread. */
+void cctalk_queue_submit(struct cctalk_queue *queue,
+                         struct cctalk_request *req);
+
+/* Submit the request to the urgent lane from any thread. */
+void cctalk_queue_submit_urgent(struct cctalk_queue *queue,
+                                struct cctalk_request *req);
+
+/* Block until the request without a callback completes.
+ * Returns the reply status or -1 with errno set. */
+int cctalk_request_wait(struct cctalk_request *req);
+
+/* Return the descriptor to wait for submissions on, with POLLIN. */
+int cctalk_queue_fd(const struct cctalk_queue *queue);
+
+/* Hand submitted requests over to the bus, owner thread only.
+ * Call it whenever the descriptor above becomes readable. */
+void cctalk_queue_dispatch(struct cctalk_queue *queue);
+
+/* Run the bus and the queue for given number of milliseconds,
+ * or until stop gets set, on the owner thread. */
+int cctalk_queue_run(struct cctalk_queue *queue, int duration,
+                     volatile int *stop);
+
+
+#endif				/* !_CCTALK_QUEUE_H */
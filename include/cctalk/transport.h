@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _CCTALK_TRANSPORT_H
+#define _CCTALK_TRANSPORT_H 1
+
+#ifndef _CCTALK_H
+# error "This file cannot be included directly, include <cctalk.h> instead."
+#endif
+
+#include <sys/types.h>
+
+#include "host.h"
+
+/*
+ * Carries bytes between the host and the bus.  Every transport keeps
+ * a descriptor in host->fd that polls readable when data arrive and
+ * writable when more can be sent, the protocol engine is the same
+ * for all of them.
+ */
+struct cctalk_transport {
+	/* Short name for messages, such as "serial" or "tcp". */
+	const char *name;
+
+	/* Non-blocking read(2) and write(2) of the raw bytes. */
+	ssize_t (*read)(struct cctalk_host *host, void *buf, size_t len);
+	ssize_t (*write)(struct cctalk_host *host, const void *buf,
+	                 size_t len);
+
+	/* Serial line settings, NULL when there is no line to set up. */
+	int (*setup_line)(struct cctalk_host *host,
+	                  const struct cctalk_line *line);
+	int (*line_info)(const struct cctalk_host *host,
+	                 struct cctalk_line *line);
+
+	/* Release host->fd and host->transport_data. */
+	void (*close)(struct cctalk_host *host);
+};
+
+/* Local serial line or pseudo-terminal. */
+extern const struct cctalk_transport cctalk_transport_serial;
+
+/* Raw TCP connection to an Ethernet-to-serial converter. */
+extern const struct cctalk_transport cctalk_transport_tcp;
+
+/* In-process stream socket, the other end is handed to the caller. */
+extern const struct cctalk_transport cctalk_transport_loopback;
+
+/*
+ * Create host context on a connected descriptor.  The host takes
+ * over the descriptor and makes it non-blocking.
+ */
+struct cctalk_host *cctalk_host_new_fd(const struct cctalk_transport *transport,
+                                       int fd, void *data);
+
+/* Create host context connected to a serial line or pty. */
+struct cctalk_host *cctalk_host_new_serial(const char *path);
+
+/*
+ * Create host context connected to a TCP serial bridge.
+ * The node is a host name or address and the service a port.
+ */
+struct cctalk_host *cctalk_host_new_tcp(const char *node,
+                                        const char *service);
+
+/*
+ * Create host context talking to another part of the same process.
+ * Stores the descriptor of the other end, which is up to the caller
+ * to serve and close.  Nothing echoes the frames back unless the
+ * other end does.
+ */
+struct cctalk_host *cctalk_host_new_loopback(int *peer);
+
+#endif				/* !_CCTALK_TRANSPORT_H */
@@ -1,5 +1,8 @@
 #!/usr/bin/make -f
 
-inc += cctalk.h cctalk/enum.h cctalk/host.h cctalk/device.h
+inc += cctalk.h cctalk/enum.h cctalk/host.h cctalk/transport.h \
+       cctalk/capture.h cctalk/board.h cctalk/device.h cctalk/events.h \
+       cctalk/bus.h cctalk/queue.h cctalk/bill.h cctalk/hopper.h \
+       cctalk/manager.h cctalk/daemon.h
 
 # EOF
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Host stack benchmark.
+ *
+ * Runs transactions against the simulator over a pseudo-terminal and
+ * reports their rate and latency percentiles together with syscalls
+ * and allocations made by the calling thread per transaction.
+ */
+
+#include "cctalk.h"
+#include "../util.h"
+#include "../../src/sim.h"
+
+#include <dlfcn.h>
+#include <error.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Counters of the benchmarking thread, the simulator has its own. */
+static __thread unsigned long syscalls, allocs;
+
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static int (*real_poll)(struct pollfd *, nfds_t, int);
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static void __attribute__((constructor)) init_wrappers(void)
+{
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_poll = dlsym(RTLD_NEXT, "poll");
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	syscalls++;
+	return real_read(fd, buf, count);
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	syscalls++;
+	return real_write(fd, buf, count);
+}
+
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	syscalls++;
+	return real_poll(fds, nfds, timeout);
+}
+
+void *malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/* Number of transactions per case. */
+static int rounds = 5000;
+
+static struct sim *sim;
+static volatile int sim_stop;
+
+static void *sim_main(void *arg)
+{
+	sim_run(sim, &sim_stop);
+	return NULL;
+}
+
+/* Single transaction, returns -1 on failure. */
+typedef int (*txn_fn)(struct cctalk_device *dev);
+
+static int txn_poll(struct cctalk_device *dev)
+{
+	if (-1 == cctalk_send(dev->host, dev->id, CCTALK_METHOD_SIMPLE_POLL,
+	                      NULL, 0))
+		return -1;
+
+	return cctalk_recv_status(dev->host);
+}
+
+static int txn_credits(struct cctalk_device *dev)
+{
+	struct cctalk_credit_info info;
+
+	return cctalk_device_query_credits(dev, &info);
+}
+
+static void on_reply(struct cctalk_host *host,
+                     const struct cctalk_message *reply, void *arg)
+{
+	*(int *)arg = reply ? reply->header : -1;
+}
+
+static int txn_async(struct cctalk_device *dev)
+{
+	struct pollfd pfd = {dev->host->fd, 0, 0};
+	int status = -1;
+
+	if (-1 == cctalk_host_submit(dev->host, dev->id,
+	                             CCTALK_METHOD_SIMPLE_POLL, NULL, 0,
+	                             on_reply, &status))
+		return -1;
+
+	while (CCTALK_HOST_IDLE != dev->host->state) {
+		pfd.events = cctalk_host_events(dev->host);
+		pfd.revents = 0;
+		poll(&pfd, 1, cctalk_host_next_timeout(dev->host));
+		cctalk_host_dispatch(dev->host, pfd.revents);
+	}
+
+	return status;
+}
+
+static void run_case(const char *mode, const char *name,
+                     struct cctalk_device *dev, txn_fn fn)
+{
+	int64_t lat[rounds], start, total;
+	unsigned long sc, al;
+	int i, failed = 0;
+
+	sc = syscalls;
+	al = allocs;
+	start = now_ns();
+
+	for (i = 0; i < rounds; i++) {
+		int64_t t0 = now_ns();
+
+		if (-1 == fn(dev))
+			failed++;
+
+		lat[i] = now_ns() - t0;
+	}
+
+	total = now_ns() - start;
+	sc = syscalls - sc;
+	al = allocs - al;
+
+	qsort(lat, rounds, sizeof(*lat), cmp_int64);
+
+	printf("%-7s %-8s %8.0f tps  p50 %6.1f us  p99 %6.1f us  "
+	       "p999 %6.1f us  %5.2f sys/txn  %4.2f alloc/txn  %i failed\n",
+	       mode, name, rounds * 1e9 / total,
+	       lat[rounds / 2] / 1e3, lat[rounds * 99 / 100] / 1e3,
+	       lat[rounds * 999 / 1000] / 1e3,
+	       (double)sc / rounds, (double)al / rounds, failed);
+}
+
+static void bench_mode(enum cctalk_crc_mode crc_mode, const char *mode)
+{
+	struct cctalk_host *host;
+	struct cctalk_device *dev;
+	pthread_t thread;
+	char path[256];
+
+	if (NULL == (sim = sim_new(path, sizeof(path))))
+		error(1, errno, "failed to create pseudo-terminal");
+
+	sim->crc_mode = crc_mode;
+	sim->coin_rate = 100;
+	sim_add(sim, SIM_ACCEPTOR, 2);
+
+	if (NULL == (host = cctalk_host_new(path)))
+		error(1, errno, "failed to open %s", path);
+
+	host->crc_mode = crc_mode;
+	sim_stop = 0;
+	pthread_create(&thread, NULL, sim_main, NULL);
+
+	if (NULL == (dev = cctalk_device_scan(host, 2)))
+		error(1, errno, "simulated device not found");
+
+	run_case(mode, "poll", dev, txn_poll);
+	run_case(mode, "credits", dev, txn_credits);
+	run_case(mode, "async", dev, txn_async);
+
+	sim_stop = 1;
+	pthread_join(thread, NULL);
+
+	cctalk_device_free(dev);
+	cctalk_host_free(host);
+	sim_free(sim);
+}
+
+static void bench_crc(const char *name, size_t length,
+                      uint8_t (*fn)(struct cctalk_message *, const void *))
+{
+	uint8_t buf[CCTALK_FRAME_MAX] = {2, 0, 1, 229};
+	struct cctalk_message *msg = (void *)buf;
+	const int count = 1000000;
+	volatile uint8_t sink = 0;
+	int64_t start, total;
+	int i;
+
+	msg->length = length;
+
+	for (i = 0; i < 255; i++)
+		msg->data[i] = i * 7;
+
+	start = now_ns();
+
+	for (i = 0; i < count; i++) {
+		msg->data[0] = i;
+		sink += fn(msg, msg->data);
+	}
+
+	total = now_ns() - start;
+
+	printf("%-13s %3zu bytes  %7.1f ns/frame  %7.1f MB/s\n",
+	       name, length, (double)total / count,
+	       (double)count * (length + 4) * 1e3 / total);
+	(void)sink;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1 && (rounds = atoi(argv[1])) < 1)
+		error(1, 0, "invalid number of rounds %s", argv[1]);
+
+	printf("[%s]\n", program_invocation_short_name);
+
+	bench_crc("crc_simple", 0, crc_simple);
+	bench_crc("crc_simple", 255, crc_simple);
+	bench_crc("crc_16_ccitt", 0, crc_16_ccitt);
+	bench_crc("crc_16_ccitt", 255, crc_16_ccitt);
+
+	bench_mode(CCTALK_CRC_SIMPLE, "simple");
+	bench_mode(CCTALK_CRC_CCITT, "ccitt");
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+#!/usr/bin/make -f
+
+bench += b-host
+
+b-host = ../libcctalk.so b-host.c ../../src/sim.c ../../src/sim.h -pthread -ldl
+
+# EOF
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Routing reply error meaning there was no bill to route,
+ * anything else means the bill could not be moved. */
+#define ROUTE_ESCROW_EMPTY 254
+
+static void decode_bills(struct cctalk_bill_info *info, const uint8_t *result)
+{
+	size_t i;
+
+	info->seq = result[0];
+
+	for (i = 0; i < 5; i++) {
+		info->bills[i].type = result[1 + 2 * i];
+		info->bills[i].code = result[2 + 2 * i];
+	}
+}
+
+int cctalk_bill_query_events(const struct cctalk_device *dev,
+                             struct cctalk_bill_info *info)
+{
+	uint8_t result[11] = {0};
+
+	if (0 != cctalk_transact(dev->host, dev->id,
+	                         CCTALK_METHOD_READ_BUFFERED_BILL_EVENTS,
+	                         NULL, 0, result, sizeof(result)))
+		return -1;
+
+	decode_bills(info, result);
+	return 0;
+}
+
+int cctalk_parse_bill_events(const struct cctalk_message *reply,
+                             struct cctalk_bill_info *info)
+{
+	uint8_t result[11] = {0};
+
+	if (0 != reply->header)
+		return -1;
+
+	memcpy(result, reply->data,
+	       reply->length < sizeof(result) ? reply->length : sizeof(result));
+
+	decode_bills(info, result);
+	return 0;
+}
+
+int cctalk_bill_route_result(const struct cctalk_message *reply)
+{
+	if (NULL == reply)
+		return -1;
+
+	if (0 != reply->header) {
+		errno = EIO;
+		return -1;
+	}
+
+	if (0 == reply->length)
+		return 0;
+
+	errno = ROUTE_ESCROW_EMPTY == reply->data[0] ? ENOENT : EIO;
+	return -1;
+}
+
+int cctalk_bill_route(const struct cctalk_device *dev,
+                      enum cctalk_bill_route route)
+{
+	uint8_t data[1] = {route};
+
+	if (-1 == cctalk_send(dev->host, dev->id, CCTALK_METHOD_ROUTE_BILL,
+	                      data, 1))
+		return -1;
+
+	return cctalk_bill_route_result(cctalk_recv_slot(dev->host));
+}
+
+int cctalk_bill_submit_route(struct cctalk_bus *bus,
+                             const struct cctalk_device *dev,
+                             enum cctalk_bill_route route,
+                             cctalk_reply_cb callback, void *arg)
+{
+	uint8_t data[1] = {route};
+
+	return cctalk_bus_submit_urgent(bus, dev->id, CCTALK_METHOD_ROUTE_BILL,
+	                                data, 1, callback, arg);
+}
+
+int cctalk_bill_query_id(const struct cctalk_device *dev, uint8_t type,
+                         char *id, size_t size)
+{
+	uint8_t data[1] = {type}, buf[256] = {0};
+
+	if (0 == size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (0 != cctalk_transact(dev->host, dev->id,
+	                         CCTALK_METHOD_REQUEST_BILL_ID, data, 1,
+	                         buf, sizeof(buf) - 1))
+		return -1;
+
+	snprintf(id, size, "%s", (const char *)buf);
+	return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Give up reading an entry that stays locked this long. */
+#define READ_ATTEMPTS 100000
+
+/* Seqlock protected state of a single address, odd while written. */
+struct board_entry {
+	uint32_t seq;
+
+	/* The state is valid, cleared when the publisher starts over. */
+	uint32_t present;
+
+	struct cctalk_board_state state;
+} __attribute__((aligned(64)));
+
+/* Layout of the board file. */
+struct board_file {
+	char magic[8];
+	uint32_t entry_size;
+	uint32_t reserved;
+
+	struct board_entry entries[256] __attribute__((aligned(64)));
+};
+
+struct cctalk_board {
+	struct board_file *file;
+};
+
+static struct cctalk_board *board_mmap(int fd, int prot)
+{
+	struct cctalk_board *board;
+	void *map;
+
+	map = mmap(NULL, sizeof(struct board_file), prot, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (MAP_FAILED == map)
+		return NULL;
+
+	board = calloc(1, sizeof(*board));
+	board->file = map;
+	return board;
+}
+
+static int header_valid(const struct board_file *file)
+{
+	return 0 == memcmp(file->magic, CCTALK_BOARD_MAGIC, 8) &&
+	       sizeof(struct board_entry) == file->entry_size;
+}
+
+/* Forget the published state, readers may be looking. */
+static void clear_entry(struct board_entry *entry)
+{
+	uint32_t seq = entry->seq;
+
+	__atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	entry->present = 0;
+	memset(&entry->state, 0, sizeof(entry->state));
+
+	__atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+struct cctalk_board *cctalk_board_open(const char *path)
+{
+	struct cctalk_board *board;
+	struct stat st;
+	int fd, i;
+
+	if (-1 == (fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)))
+		return NULL;
+
+	if (-1 == fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	/*
+	 * Readers only map files of the right size, so others can be
+	 * recreated freely.  Shrinking a mapped file would kill them.
+	 */
+	if ((size_t)st.st_size != sizeof(struct board_file) &&
+	    (-1 == ftruncate(fd, 0) ||
+	     -1 == ftruncate(fd, sizeof(struct board_file)))) {
+		close(fd);
+		return NULL;
+	}
+
+	if (NULL == (board = board_mmap(fd, PROT_READ | PROT_WRITE)))
+		return NULL;
+
+	/* Start over, so that readers never see stale devices. */
+	if (header_valid(board->file))
+		for (i = 0; i < 256; i++)
+			clear_entry(&board->file->entries[i]);
+	else
+		memset(board->file, 0, sizeof(*board->file));
+
+	board->file->entry_size = sizeof(struct board_entry);
+	memcpy(board->file->magic, CCTALK_BOARD_MAGIC, 8);
+	return board;
+}
+
+struct cctalk_board *cctalk_board_map(const char *path)
+{
+	struct cctalk_board *board;
+	struct stat st;
+	int fd;
+
+	if (-1 == (fd = open(path, O_RDONLY | O_CLOEXEC)))
+		return NULL;
+
+	if (-1 == fstat(fd, &st) ||
+	    (size_t)st.st_size != sizeof(struct board_file)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (NULL == (board = board_mmap(fd, PROT_READ)))
+		return NULL;
+
+	if (!header_valid(board->file)) {
+		cctalk_board_close(board);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return board;
+}
+
+void cctalk_board_close(struct cctalk_board *board)
+{
+	if (NULL == board)
+		return;
+
+	munmap(board->file, sizeof(*board->file));
+	free(board);
+}
+
+void cctalk_board_publish(struct cctalk_board *board, uint8_t address,
+                          const struct cctalk_board_state *state)
+{
+	struct board_entry *entry = &board->file->entries[address];
+	uint32_t seq = entry->seq;
+
+	__atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	entry->present = 1;
+	entry->state = *state;
+
+	__atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int cctalk_board_read(const struct cctalk_board *board, uint8_t address,
+                      struct cctalk_board_state *state)
+{
+	const struct board_entry *entry = &board->file->entries[address];
+	struct cctalk_board_state copy;
+	uint32_t seq, present;
+	int attempt;
+
+	for (attempt = 0; attempt < READ_ATTEMPTS; attempt++) {
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+
+		if (seq & 1)
+			continue;
+
+		present = entry->present;
+		copy = entry->state;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+		if (seq != __atomic_load_n(&entry->seq, __ATOMIC_RELAXED))
+			continue;
+
+		if (!present) {
+			errno = ENOENT;
+			return -1;
+		}
+
+		*state = copy;
+		return 0;
+	}
+
+	errno = EAGAIN;
+	return -1;
+}
@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Do not back off failing devices by more than 2^N intervals. */
+#define MAX_BACKOFF 4
+
+/* Convert REQUEST_POLLING_PRIORITY reply to milliseconds. */
+static int priority_to_ms(uint8_t units, uint8_t value)
+{
+	static const int64_t unit_ms[] = {
+		0, 1, 10, 1000, 60 * 1000, 60 * 60 * 1000,
+		24 * 60 * 60 * 1000,
+	};
+
+	int64_t ms;
+
+	/* Zero means the device needs special handling, such as
+	 * hoppers that should be polled while paying out only. */
+	if (0 == units || 0 == value)
+		return CCTALK_BUS_DEFAULT_INTERVAL;
+
+	if (units >= sizeof(unit_ms) / sizeof(*unit_ms))
+		return INT_MAX;
+
+	ms = unit_ms[units] * value;
+	return ms < INT_MAX ? ms : INT_MAX;
+}
+
+static int query_interval(struct cctalk_device *dev)
+{
+	uint8_t prio[2];
+
+	if (0 != cctalk_transact(dev->host, dev->id,
+	                         CCTALK_METHOD_REQUEST_POLLING_PRIORITY, NULL, 0,
+	                         prio, sizeof(prio)))
+		return CCTALK_BUS_DEFAULT_INTERVAL;
+
+	return priority_to_ms(prio[0], prio[1]);
+}
+
+struct cctalk_bus *cctalk_bus_new(struct cctalk_host *host)
+{
+	struct cctalk_bus *bus = calloc(1, sizeof(*bus));
+
+	bus->host = host;
+	bus->current = -1;
+	bus->requests_tail = &bus->requests;
+	bus->since = monotonic_ms();
+
+	return bus;
+}
+
+void cctalk_bus_free(struct cctalk_bus *bus)
+{
+	size_t i;
+
+	if (NULL == bus)
+		return;
+
+	for (i = 0; i < bus->nslots; i++)
+		cctalk_device_free(bus->slots[i].dev);
+
+	/* Nobody is going to carry out the remaining requests. */
+	while (NULL != bus->requests) {
+		struct cctalk_bus_request *req = bus->requests;
+		bus->requests = req->next;
+
+		if (NULL != req->callback) {
+			errno = ECANCELED;
+			req->callback(bus->host, NULL, req->arg);
+		}
+
+		free(req);
+	}
+
+	free(bus->slots);
+	free(bus);
+}
+
+int cctalk_bus_add(struct cctalk_bus *bus, struct cctalk_device *dev,
+                   enum cctalk_method method, cctalk_poll_cb callback,
+                   void *arg)
+{
+	struct cctalk_bus_slot *slots, *slot;
+
+	if (dev->host != bus->host) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (CCTALK_HOST_IDLE != bus->host->state) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	slots = realloc(bus->slots, (bus->nslots + 1) * sizeof(*slots));
+
+	if (NULL == slots)
+		return -1;
+
+	bus->slots = slots;
+	slot = &slots[bus->nslots++];
+
+	*slot = (struct cctalk_bus_slot){
+		.dev = dev,
+		.method = method,
+		.callback = callback,
+		.arg = arg,
+		.interval = query_interval(dev),
+		.due = monotonic_ms(),
+	};
+
+	return 0;
+}
+
+/* Publish state of the device after its poll.  Done after the poll
+ * callback, so that the events it processed are accounted for. */
+static void publish(struct cctalk_bus *bus, struct cctalk_bus_slot *slot,
+                    const struct cctalk_message *reply)
+{
+	const struct cctalk_device *dev = slot->dev;
+	struct cctalk_board_state state = {
+		.online = NULL != reply,
+		.status = reply ? reply->header : 0,
+		.accepting = dev->accepting,
+		.credit_seq = dev->credit_seq,
+		.last_error = dev->last_error,
+		.coin_mask = dev->coin_mask,
+		.failures = slot->failures,
+		.polls = slot->total_polls,
+		.errors = slot->total_errors,
+		.updated = realtime_ms(),
+	};
+
+	if (NULL != reply)
+		slot->seen = state.updated;
+
+	state.seen = slot->seen;
+	cctalk_board_publish(bus->board, dev->id, &state);
+}
+
+static void on_reply(struct cctalk_host *host,
+                     const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_bus *bus = arg;
+	struct cctalk_bus_slot *slot = &bus->slots[bus->current];
+	int64_t now = monotonic_ms();
+	int64_t took = now - bus->started;
+
+	bus->current = -1;
+	bus->busy += took;
+
+	slot->polls++;
+	slot->total_polls++;
+
+	if (0 == slot->duration)
+		slot->duration = took * 8;
+	else
+		slot->duration += took - slot->duration / 8;
+
+	if (NULL == reply) {
+		slot->errors++;
+		slot->total_errors++;
+
+		if (slot->failures < MAX_BACKOFF)
+			slot->failures++;
+	} else {
+		slot->failures = 0;
+	}
+
+	/* Keep the phase, but do not try to catch up on missed polls. */
+	slot->due += (int64_t)slot->interval << slot->failures;
+
+	if (slot->due < now)
+		slot->due = now;
+
+	if (NULL != slot->callback)
+		slot->callback(slot->dev, reply, slot->arg);
+
+	if (NULL != bus->board)
+		publish(bus, slot, reply);
+}
+
+static struct cctalk_bus_request *new_request(uint8_t destination,
+                                              enum cctalk_method method,
+                                              const void *data,
+                                              size_t length,
+                                              cctalk_reply_cb callback,
+                                              void *arg)
+{
+	struct cctalk_bus_request *req;
+
+	if (length > sizeof(req->data)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (NULL == (req = calloc(1, sizeof(*req))))
+		return NULL;
+
+	req->destination = destination;
+	req->method = method;
+	req->length = length;
+	req->callback = callback;
+	req->arg = arg;
+
+	if (length > 0)
+		memcpy(req->data, data, length);
+
+	return req;
+}
+
+int cctalk_bus_submit(struct cctalk_bus *bus, uint8_t destination,
+                      enum cctalk_method method, const void *data,
+                      size_t length, cctalk_reply_cb callback, void *arg)
+{
+	struct cctalk_bus_request *req;
+
+	req = new_request(destination, method, data, length, callback, arg);
+
+	if (NULL == req)
+		return -1;
+
+	*bus->requests_tail = req;
+	bus->requests_tail = &req->next;
+
+	return 0;
+}
+
+int cctalk_bus_submit_urgent(struct cctalk_bus *bus, uint8_t destination,
+                             enum cctalk_method method, const void *data,
+                             size_t length, cctalk_reply_cb callback,
+                             void *arg)
+{
+	struct cctalk_bus_request *req, **pos = &bus->requests;
+
+	req = new_request(destination, method, data, length, callback, arg);
+
+	if (NULL == req)
+		return -1;
+
+	req->urgent = 1;
+
+	/* The first request may be in progress already. */
+	if (NULL != *pos && -1 == bus->current &&
+	    CCTALK_HOST_IDLE != bus->host->state)
+		pos = &(*pos)->next;
+
+	while (NULL != *pos && (*pos)->urgent)
+		pos = &(*pos)->next;
+
+	if (NULL == (req->next = *pos))
+		bus->requests_tail = &req->next;
+
+	*pos = req;
+	return 0;
+}
+
+static void on_request_reply(struct cctalk_host *host,
+                             const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_bus *bus = arg;
+	struct cctalk_bus_request *req = bus->requests;
+	int err = errno;
+
+	bus->busy += monotonic_ms() - bus->started;
+
+	if (NULL == (bus->requests = req->next))
+		bus->requests_tail = &bus->requests;
+
+	if (NULL != req->callback) {
+		errno = err;
+		req->callback(host, reply, req->arg);
+	}
+
+	free(req);
+}
+
+/* Start the oldest one-shot request. */
+static void start_request(struct cctalk_bus *bus)
+{
+	struct cctalk_bus_request *req = bus->requests;
+
+	bus->started = monotonic_ms();
+
+	if (-1 == cctalk_host_submit(bus->host, req->destination, req->method,
+	                             req->data, req->length,
+	                             on_request_reply, bus))
+		on_request_reply(bus->host, NULL, bus);
+}
+
+/* Find the most overdue device. */
+static struct cctalk_bus_slot *next_slot(const struct cctalk_bus *bus)
+{
+	struct cctalk_bus_slot *best = NULL;
+	size_t i;
+
+	for (i = 0; i < bus->nslots; i++)
+		if (NULL == best || bus->slots[i].due < best->due)
+			best = &bus->slots[i];
+
+	return best;
+}
+
+/* Start the next request or poll if it is due already. */
+static void start_next(struct cctalk_bus *bus)
+{
+	struct cctalk_bus_slot *slot = next_slot(bus);
+	int64_t now = monotonic_ms(), lateness;
+
+	/* Let a poll that is a whole interval late in between ordinary
+	 * requests, so that steady request traffic cannot starve it. */
+	if (NULL != bus->requests &&
+	    (bus->requests->urgent || !bus->after_request || NULL == slot ||
+	     now - slot->due < slot->interval)) {
+		bus->after_request = 1;
+		start_request(bus);
+		return;
+	}
+
+	if (NULL == slot || slot->due > now)
+		return;
+
+	bus->after_request = 0;
+
+	lateness = now - slot->due;
+
+	if (lateness > slot->max_lateness)
+		slot->max_lateness = lateness;
+
+	if (lateness >= slot->interval)
+		slot->late++;
+
+	bus->current = slot - bus->slots;
+	bus->started = now;
+
+	if (-1 == cctalk_host_submit(bus->host, slot->dev->id, slot->method,
+	                             NULL, 0, on_reply, bus))
+		on_reply(bus->host, NULL, bus);
+}
+
+short cctalk_bus_events(const struct cctalk_bus *bus)
+{
+	return cctalk_host_events(bus->host);
+}
+
+int cctalk_bus_next_timeout(const struct cctalk_bus *bus)
+{
+	const struct cctalk_bus_slot *slot;
+	int64_t left;
+
+	if (CCTALK_HOST_IDLE != bus->host->state)
+		return cctalk_host_next_timeout(bus->host);
+
+	if (NULL != bus->requests)
+		return 0;
+
+	if (NULL == (slot = next_slot(bus)))
+		return -1;
+
+	left = slot->due - monotonic_ms();
+
+	if (left < 0)
+		return 0;
+
+	return left < INT_MAX ? left : INT_MAX;
+}
+
+void cctalk_bus_dispatch(struct cctalk_bus *bus, short revents)
+{
+	cctalk_host_dispatch(bus->host, revents);
+
+	/* Callbacks may have started something already. */
+	if (CCTALK_HOST_IDLE == bus->host->state)
+		start_next(bus);
+}
+
+int cctalk_bus_run(struct cctalk_bus *bus, int duration)
+{
+	int64_t end = monotonic_ms() + duration;
+	struct pollfd pfd = {bus->host->fd, 0, 0};
+	int64_t left;
+
+	while ((left = end - monotonic_ms()) > 0) {
+		int timeout = cctalk_bus_next_timeout(bus);
+
+		if (-1 == timeout || timeout > left)
+			timeout = left;
+
+		pfd.events = cctalk_bus_events(bus);
+		pfd.revents = 0;
+
+		if (-1 == poll(&pfd, 1, timeout) && EINTR != errno)
+			return -1;
+
+		cctalk_bus_dispatch(bus, pfd.revents);
+	}
+
+	return 0;
+}
+
+void cctalk_bus_load(struct cctalk_bus *bus, struct cctalk_bus_load *load,
+                     int reset)
+{
+	int64_t now = monotonic_ms();
+	size_t i;
+
+	*load = (struct cctalk_bus_load){0};
+
+	if (now > bus->since)
+		load->utilization = (double)bus->busy / (now - bus->since);
+
+	for (i = 0; i < bus->nslots; i++) {
+		struct cctalk_bus_slot *slot = &bus->slots[i];
+
+		load->demand += slot->duration / 8.0 / slot->interval;
+		load->polls += slot->polls;
+		load->errors += slot->errors;
+		load->late += slot->late;
+
+		if (slot->max_lateness > load->max_lateness)
+			load->max_lateness = slot->max_lateness;
+
+		if (reset) {
+			slot->polls = slot->errors = slot->late = 0;
+			slot->max_lateness = 0;
+		}
+	}
+
+	if (reset) {
+		bus->busy = 0;
+		bus->since = now;
+	}
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Records are padded to keep their headers aligned. */
+#define RECORD_ALIGN 16
+
+/* Largest ring, so that padding fits the record length. */
+#define MAX_SIZE (1ull << 30)
+
+struct cctalk_capture {
+	struct cctalk_capture_header *hdr;
+	uint8_t *data;
+	size_t maplen;
+};
+
+static size_t record_length(size_t size)
+{
+	size_t len = sizeof(struct cctalk_capture_record) + size;
+	return (len + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+/* Check that the header describes a ring fitting the mapping. */
+static int header_valid(const struct cctalk_capture_header *hdr,
+                        size_t maplen)
+{
+	return 0 == memcmp(hdr->magic, CCTALK_CAPTURE_MAGIC, 8) &&
+	       sizeof(*hdr) + hdr->size == maplen &&
+	       0 == hdr->size % RECORD_ALIGN &&
+	       hdr->tail <= hdr->head &&
+	       hdr->head - hdr->tail <= hdr->size &&
+	       0 == hdr->tail % RECORD_ALIGN &&
+	       0 == hdr->head % RECORD_ALIGN;
+}
+
+static struct cctalk_capture *capture_mmap(int fd, size_t maplen, int prot)
+{
+	struct cctalk_capture *cap;
+	void *map;
+
+	map = mmap(NULL, maplen, prot, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (MAP_FAILED == map)
+		return NULL;
+
+	cap = calloc(1, sizeof(*cap));
+	cap->hdr = map;
+	cap->data = (uint8_t *)map + sizeof(*cap->hdr);
+	cap->maplen = maplen;
+	return cap;
+}
+
+struct cctalk_capture *cctalk_capture_open(const char *path, size_t size)
+{
+	struct cctalk_capture *cap;
+	struct stat st;
+	size_t maplen;
+	int fd;
+
+	size = record_length(size) - sizeof(struct cctalk_capture_record);
+
+	if (size < CCTALK_CAPTURE_MIN_SIZE || size > MAX_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	maplen = sizeof(struct cctalk_capture_header) + size;
+
+	if (-1 == (fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)))
+		return NULL;
+
+	if (-1 == fstat(fd, &st))
+		goto fail;
+
+	/* Different size means different layout, start over. */
+	if ((size_t)st.st_size != maplen &&
+	    (-1 == ftruncate(fd, 0) || -1 == ftruncate(fd, maplen)))
+		goto fail;
+
+	if (NULL == (cap = capture_mmap(fd, maplen, PROT_READ | PROT_WRITE)))
+		return NULL;
+
+	if (!header_valid(cap->hdr, maplen)) {
+		memset(cap->hdr, 0, sizeof(*cap->hdr));
+		memcpy(cap->hdr->magic, CCTALK_CAPTURE_MAGIC, 8);
+		cap->hdr->size = size;
+	}
+
+	return cap;
+
+fail:
+	close(fd);
+	return NULL;
+}
+
+struct cctalk_capture *cctalk_capture_map(const char *path)
+{
+	struct cctalk_capture *cap;
+	struct stat st;
+	int fd;
+
+	if (-1 == (fd = open(path, O_RDONLY | O_CLOEXEC)))
+		return NULL;
+
+	if (-1 == fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+
+	if ((size_t)st.st_size < sizeof(struct cctalk_capture_header)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (NULL == (cap = capture_mmap(fd, st.st_size, PROT_READ)))
+		return NULL;
+
+	if (!header_valid(cap->hdr, cap->maplen)) {
+		cctalk_capture_close(cap);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return cap;
+}
+
+void cctalk_capture_close(struct cctalk_capture *cap)
+{
+	if (NULL == cap)
+		return;
+
+	munmap(cap->hdr, cap->maplen);
+	free(cap);
+}
+
+const struct cctalk_capture_header *
+cctalk_capture_header(const struct cctalk_capture *cap)
+{
+	return cap->hdr;
+}
+
+/*
+ * Drop the oldest records until there is room for len more bytes.
+ * A damaged record, such as one left behind by a power loss,
+ * drops all of them.
+ */
+static void reserve(struct cctalk_capture *cap, uint64_t len)
+{
+	struct cctalk_capture_header *hdr = cap->hdr;
+	uint64_t tail = hdr->tail;
+
+	while (hdr->head + len - tail > hdr->size) {
+		const struct cctalk_capture_record *rec;
+		uint64_t pos = tail % hdr->size;
+
+		rec = (const void *)(cap->data + pos);
+
+		if (rec->length < sizeof(*rec) || rec->length % RECORD_ALIGN ||
+		    rec->length > hdr->size - pos ||
+		    tail + rec->length > hdr->head) {
+			tail = hdr->head;
+			break;
+		}
+
+		tail += rec->length;
+	}
+
+	/* Publish the new tail before the space gets overwritten. */
+	__atomic_store_n(&hdr->tail, tail, __ATOMIC_RELEASE);
+}
+
+void cctalk_capture_write(struct cctalk_capture *cap,
+                          enum cctalk_capture_type type, int flags,
+                          const void *data, size_t size)
+{
+	struct cctalk_capture_header *hdr = cap->hdr;
+	struct cctalk_capture_record *rec;
+	size_t len = record_length(size);
+	uint64_t pos = hdr->head % hdr->size;
+	struct timespec ts;
+
+	if (size > UINT16_MAX || len > hdr->size / 2) {
+		hdr->dropped++;
+		return;
+	}
+
+	/* Records never wrap, pad the rest of the ring instead. */
+	if (pos + len > hdr->size) {
+		reserve(cap, hdr->size - pos);
+
+		rec = (void *)(cap->data + pos);
+		rec->length = hdr->size - pos;
+		rec->type = CCTALK_CAPTURE_PAD;
+		rec->flags = 0;
+		rec->size = 0;
+		rec->time = 0;
+
+		__atomic_store_n(&hdr->head, hdr->head + rec->length,
+		                 __ATOMIC_RELEASE);
+		pos = 0;
+	}
+
+	reserve(cap, len);
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	rec = (void *)(cap->data + pos);
+	rec->length = len;
+	rec->type = type;
+	rec->flags = flags;
+	rec->size = size;
+	rec->time = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	memcpy(rec->data, data, size);
+
+	hdr->records++;
+	__atomic_store_n(&hdr->head, hdr->head + len, __ATOMIC_RELEASE);
+}
+
+const struct cctalk_capture_record *
+cctalk_capture_next(const struct cctalk_capture *cap, uint64_t *offset)
+{
+	const struct cctalk_capture_header *hdr = cap->hdr;
+	uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+
+	while (*offset < head) {
+		const struct cctalk_capture_record *rec;
+		uint64_t pos = *offset % hdr->size;
+
+		if (head - *offset > hdr->size || pos % RECORD_ALIGN)
+			return NULL;
+
+		rec = (const void *)(cap->data + pos);
+
+		if (rec->length < sizeof(*rec) || rec->length % RECORD_ALIGN ||
+		    pos + rec->length > hdr->size ||
+		    *offset + rec->length > head)
+			return NULL;
+
+		*offset += rec->length;
+
+		if (CCTALK_CAPTURE_PAD == rec->type)
+			continue;
+
+		if (sizeof(*rec) + rec->size > rec->length)
+			return NULL;
+
+		return rec;
+	}
+
+	return NULL;
+}
+
+void host_capture(struct cctalk_host *host, enum cctalk_capture_type type,
+                  int flags, const void *data, size_t size)
+{
+	if (NULL == host->capture)
+		return;
+
+	if (CCTALK_CRC_CCITT == host->crc_mode)
+		flags |= CCTALK_CAPTURE_CCITT;
+
+	cctalk_capture_write(host->capture, type, flags, data, size);
+}
@@ -15,23 +15,39 @@
  */
 
 #include "cctalk.h"
+#include "util.h"
 
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+/* Devices answer ADDRESS_POLL within 4 ms * address, 1020 ms at most,
+ * and ignore the bus for 1200 ms in total. */
+#define ADDRESS_POLL_WINDOW 1250
+
+/* Returns 1 when the device ACKs the method, 0 when it NAKs it
+ * and -1 when it did not answer at all, so that nobody can tell. */
 inline static int detect_support(const struct cctalk_device *dev,
                                  enum cctalk_method method)
 {
+	int status;
+
 	if (-1 == cctalk_send(dev->host, dev->id, method, NULL, 0))
-		return 0;
+		return -1;
 
-	if (-1 == cctalk_recv_status(dev->host))
-		return 0;
+	if (-1 == (status = cctalk_recv_status(dev->host)))
+		return -1;
 
-	return 1;
+	return 0 == status;
 }
 
 
-struct cctalk_device *cctalk_device_scan(const struct cctalk_host *host,
+struct cctalk_device *cctalk_device_scan(struct cctalk_host *host,
                                          uint8_t id)
 {
 	uint8_t vers[3] = {0, 0, 0};
@@ -49,11 +65,235 @@ struct cctalk_device *cctalk_device_scan(const struct cctalk_host *host,
 	dev->version = (vers[1] << 8) | vers[2];
 	dev->coin_mask = 0xffff;
 
-	dev->has_master_inhibit_status = detect_support(dev, 227) &&
-	                                 detect_support(dev, 228);
+	return dev;
+}
+
+/*
+ * Features are detected on first use.  Only the harmless request
+ * methods are probed, devices that can report a status can also
+ * modify it.  Probes that get no reply are repeated next time.
+ */
+
+static int has_master_inhibit_status(struct cctalk_device *dev)
+{
+	int result;
+
+	if (!dev->probed_master_inhibit_status) {
+		if (-1 == (result = detect_support(dev, 227)))
+			return -1;
+
+		dev->has_master_inhibit_status = result;
+		dev->probed_master_inhibit_status = 1;
+	}
+
+	return dev->has_master_inhibit_status;
+}
+
+static int has_inhibit_status(struct cctalk_device *dev)
+{
+	int result;
+
+	if (!dev->probed_inhibit_status) {
+		if (-1 == (result = detect_support(dev, 230)))
+			return -1;
 
-	dev->has_inhibit_status = detect_support(dev, 230) &&
-	                          detect_support(dev, 231);
+		dev->has_inhibit_status = result;
+		dev->probed_inhibit_status = 1;
+	}
+
+	return dev->has_inhibit_status;
+}
+
+/* Identify the device by its serial number or product code,
+ * so that it can be looked up in the capability cache. */
+static int cache_key(struct cctalk_device *dev, char *key, size_t size)
+{
+	uint8_t data[256] = {0};
+	size_t i;
+
+	if (0 == cctalk_transact(dev->host, dev->id,
+	                         CCTALK_METHOD_REQUEST_SERIAL_NUMBER, NULL, 0,
+	                         data, 3)) {
+		dev->serial = data[0] | (data[1] << 8) | (data[2] << 16);
+		snprintf(key, size, "s:%06x", dev->serial);
+		return 0;
+	}
+
+	if (0 != cctalk_transact(dev->host, dev->id,
+	                         CCTALK_METHOD_REQUEST_PRODUCT_CODE, NULL, 0,
+	                         data, sizeof(data) - 1))
+		return -1;
+
+	/* Keep the key a single printable word. */
+	for (i = 0; data[i]; i++)
+		if (!isalnum(data[i]))
+			data[i] = '_';
+
+	snprintf(key, size, "p:%s", data);
+	return 0;
+}
+
+/* Flags stored in the capability cache. */
+enum {
+	CACHE_PROBED_MASTER_INHIBIT = 1,
+	CACHE_MASTER_INHIBIT = 2,
+	CACHE_PROBED_INHIBIT = 4,
+	CACHE_INHIBIT = 8,
+};
+
+static int cache_lookup(struct cctalk_device *dev, const char *path,
+                        const char *key)
+{
+	char line[512], entry[300];
+	unsigned id, version, flags;
+	int found = 0;
+	FILE *fp;
+
+	if (NULL == (fp = fopen(path, "r")))
+		return 0;
+
+	while (!found && NULL != fgets(line, sizeof(line), fp)) {
+		if (4 != sscanf(line, "%u %299s %x %x", &id, entry,
+		                &version, &flags))
+			continue;
+
+		if (id != dev->id || 0 != strcmp(entry, key))
+			continue;
+
+		dev->version = version;
+		dev->probed_master_inhibit_status =
+			!!(flags & CACHE_PROBED_MASTER_INHIBIT);
+		dev->has_master_inhibit_status =
+			!!(flags & CACHE_MASTER_INHIBIT);
+		dev->probed_inhibit_status = !!(flags & CACHE_PROBED_INHIBIT);
+		dev->has_inhibit_status = !!(flags & CACHE_INHIBIT);
+		found = 1;
+	}
+
+	fclose(fp);
+	return found;
+}
+
+/* Open the cache file and lock it against other writers.  Retries
+ * when somebody replaced the file while we waited for the lock. */
+static FILE *cache_lock(const char *path, struct stat *st)
+{
+	struct stat now;
+	FILE *fp;
+	int fd;
+
+	while (1) {
+		if (-1 == (fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, 0644)))
+			return NULL;
+
+		if (-1 == flock(fd, LOCK_EX) || -1 == fstat(fd, st)) {
+			close(fd);
+			return NULL;
+		}
+
+		if (0 == stat(path, &now) && now.st_dev == st->st_dev &&
+		    now.st_ino == st->st_ino)
+			break;
+
+		close(fd);
+	}
+
+	if (NULL == (fp = fdopen(fd, "r")))
+		close(fd);
+
+	return fp;
+}
+
+/* Replace the entry for the device, keeping all the others. */
+static int cache_store(const struct cctalk_device *dev, const char *path,
+                       const char *key)
+{
+	char tmp[strlen(path) + 8], line[512], entry[300];
+	int fd, flags = 0;
+	struct stat st;
+	FILE *in, *out;
+	unsigned id;
+
+	/* Held until the new file takes the place of this one. */
+	if (NULL == (in = cache_lock(path, &st)))
+		return -1;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+
+	if (-1 == (fd = mkstemp(tmp))) {
+		fclose(in);
+		return -1;
+	}
+
+	/* Keep the file readable by whoever could read it before. */
+	if (-1 == fchmod(fd, st.st_mode & 07777) ||
+	    NULL == (out = fdopen(fd, "w"))) {
+		close(fd);
+		unlink(tmp);
+		fclose(in);
+		return -1;
+	}
+
+	while (NULL != fgets(line, sizeof(line), in)) {
+		if (2 == sscanf(line, "%u %299s", &id, entry) &&
+		    id == dev->id && 0 == strcmp(entry, key))
+			continue;
+
+		fputs(line, out);
+	}
+
+	if (dev->probed_master_inhibit_status)
+		flags |= CACHE_PROBED_MASTER_INHIBIT;
+
+	if (dev->has_master_inhibit_status)
+		flags |= CACHE_MASTER_INHIBIT;
+
+	if (dev->probed_inhibit_status)
+		flags |= CACHE_PROBED_INHIBIT;
+
+	if (dev->has_inhibit_status)
+		flags |= CACHE_INHIBIT;
+
+	fprintf(out, "%u %s %x %x\n", dev->id, key, dev->version, flags);
+
+	if (0 != fclose(out) || -1 == rename(tmp, path)) {
+		unlink(tmp);
+		fclose(in);
+		return -1;
+	}
+
+	fclose(in);
+	return 0;
+}
+
+struct cctalk_device *cctalk_device_scan_cached(struct cctalk_host *host,
+                                                uint8_t id, const char *path)
+{
+	struct cctalk_device *dev, probe = {.host = host, .id = id};
+	char key[300];
+
+	if (-1 == cache_key(&probe, key, sizeof(key)))
+		return cctalk_device_scan(host, id);
+
+	if (cache_lookup(&probe, path, key)) {
+		if (NULL == (dev = malloc(sizeof(*dev))))
+			return NULL;
+
+		*dev = probe;
+		dev->coin_mask = 0xffff;
+		return dev;
+	}
+
+	if (NULL == (dev = cctalk_device_scan(host, id)))
+		return NULL;
+
+	/* Probe everything now, so that the entry is complete.
+	 * Only remember definitive answers, though. */
+	dev->serial = probe.serial;
+
+	if (-1 != has_master_inhibit_status(dev) &&
+	    -1 != has_inhibit_status(dev))
+		cache_store(dev, path, key);
 
 	return dev;
 }
@@ -69,56 +309,62 @@ void cctalk_device_free(struct cctalk_device *dev)
 static int set_master_inhibit_status(const struct cctalk_device *dev, int on)
 {
 	uint8_t data[1] = {on ? 1 : 0};
+	int status = cctalk_transact(dev->host, dev->id, 228, data, 1, NULL, 0);
 
-	if (-1 == cctalk_send(dev->host, dev->id, 228, data, 1))
-		return -1;
-
-	return 0 == cctalk_recv_status(dev->host);
+	return -1 == status ? -1 : 0 == status;
 }
 
 static int set_inhibit_status(const struct cctalk_device *dev, uint16_t mask)
 {
 	uint8_t data[2] = {mask & 0xff, mask >> 8};
+	int status = cctalk_transact(dev->host, dev->id, 231, data, 2, NULL, 0);
 
-	if (-1 == cctalk_send(dev->host, dev->id, 231, data, 2))
-		return -1;
-
-	return 0 == cctalk_recv_status(dev->host);
+	return -1 == status ? -1 : 0 == status;
 }
 
-int cctalk_device_set_accept_coins(const struct cctalk_device *dev, int on)
+int cctalk_device_set_accept_coins(struct cctalk_device *dev, int on)
 {
-	if (dev->has_master_inhibit_status)
-		return set_master_inhibit_status(dev, on);
+	int result = 0, master, inhibit = 0;
 
-	if (dev->has_inhibit_status)
-		return set_inhibit_status(dev, on ? dev->coin_mask : 0x0000);
+	if (-1 == (master = has_master_inhibit_status(dev)))
+		return -1;
 
-	return 0;
+	if (!master && -1 == (inhibit = has_inhibit_status(dev)))
+		return -1;
+
+	if (master)
+		result = set_master_inhibit_status(dev, on);
+	else if (inhibit)
+		result = set_inhibit_status(dev, on ? dev->coin_mask : 0x0000);
+
+	/* Only an acknowledged change takes effect. */
+	if (1 == result)
+		dev->accepting = !!on;
+
+	return result;
 }
 
 int cctalk_device_set_coin_mask(struct cctalk_device *dev, uint16_t mask)
 {
+	int inhibit;
+
 	dev->coin_mask = mask;
 
-	if (dev->has_inhibit_status)
+	if (-1 == (inhibit = has_inhibit_status(dev)))
+		return -1;
+
+	if (inhibit)
 		return set_inhibit_status(dev, mask);
 
 	return 0;
 }
 
-int cctalk_device_query_credits(const struct cctalk_device *dev,
-                                struct cctalk_credit_info *info)
+/* Fill in the credit info from the raw reply data. */
+static void decode_credits(struct cctalk_credit_info *info,
+                           const uint8_t *result)
 {
-	uint8_t result[11] = {0};
 	size_t i;
 
-	if (-1 == cctalk_send(dev->host, dev->id, 229, NULL, 0))
-		return -1;
-
-	if (0 != cctalk_recv_data(dev->host, result, sizeof(result)))
-		return -1;
-
 	info->seq = result[0];
 
 	for (i = 0; i < 5; i++) {
@@ -126,6 +372,112 @@ int cctalk_device_query_credits(const struct cctalk_device *dev,
 		info->coins[i].sorter = result[2 + 2 * i];
 		info->coins[i].error  = result[2 + 2 * i];
 	}
+}
+
+int cctalk_device_query_credits(const struct cctalk_device *dev,
+                                struct cctalk_credit_info *info)
+{
+	uint8_t result[11] = {0};
+
+	if (0 != cctalk_transact(dev->host, dev->id, 229, NULL, 0,
+	                         result, sizeof(result)))
+		return -1;
+
+	decode_credits(info, result);
+	return 0;
+}
+
+int cctalk_parse_credits(const struct cctalk_message *reply,
+                         struct cctalk_credit_info *info)
+{
+	uint8_t result[11] = {0};
+
+	if (0 != reply->header)
+		return -1;
+
+	memcpy(result, reply->data,
+	       reply->length < sizeof(result) ? reply->length : sizeof(result));
 
+	decode_credits(info, result);
 	return 0;
 }
+
+/* Find addresses of devices that answer the broadcast ADDRESS_POLL. */
+static int address_poll(struct cctalk_host *host, uint8_t *present)
+{
+	uint8_t replies[256];
+	ssize_t count, i;
+	int found = 0;
+
+	if (-1 == cctalk_send(host, 0, CCTALK_METHOD_ADDRESS_POLL, NULL, 0))
+		return -1;
+
+	count = host_recv_bytes(host, replies, sizeof(replies),
+	                        ADDRESS_POLL_WINDOW);
+
+	for (i = 0; i < count; i++) {
+		if (0 == replies[i] || host->id == replies[i])
+			continue;
+
+		found += !present[replies[i]];
+		present[replies[i]] = 1;
+	}
+
+	return found;
+}
+
+/* Check every address with SIMPLE_POLL and a short timeout. */
+static int address_sweep(struct cctalk_host *host, uint8_t *present,
+                         int timeout)
+{
+	int saved = host->timeout;
+	int found = 0;
+	unsigned id;
+
+	host->timeout = timeout;
+
+	for (id = 1; id < 256; id++) {
+		if (host->id == id)
+			continue;
+
+		if (-1 == cctalk_send(host, id, CCTALK_METHOD_SIMPLE_POLL,
+		                      NULL, 0))
+			continue;
+
+		if (-1 == cctalk_recv_status(host))
+			continue;
+
+		present[id] = 1;
+		found++;
+	}
+
+	host->timeout = saved;
+	return found;
+}
+
+ssize_t cctalk_device_discover(struct cctalk_host *host,
+                               struct cctalk_device ***devices,
+                               int probe_timeout)
+{
+	struct cctalk_device **devs;
+	uint8_t present[256] = {0};
+	size_t count = 0;
+	unsigned id;
+
+	if (address_poll(host, present) <= 0)
+		address_sweep(host, present, probe_timeout);
+
+	if (NULL == (devs = calloc(256, sizeof(*devs))))
+		return -1;
+
+	for (id = 1; id < 256; id++) {
+		if (!present[id])
+			continue;
+
+		if (NULL != (devs[count] = cctalk_device_scan(host, id)))
+			count++;
+	}
+
+	*devices = devs;
+	return count;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct cctalk_event_ring {
+	/* Number of slots minus one, slots are a power of two. */
+	size_t mask;
+
+	/* Next slot to write, only ever advanced by the producer. */
+	size_t head __attribute__((aligned(64)));
+
+	/* Last tail seen by the producer, so that it does not have
+	 * to touch the consumer cache line for every event. */
+	size_t tail_seen;
+
+	/* Next slot to read, only ever advanced by the consumer. */
+	size_t tail __attribute__((aligned(64)));
+
+	struct cctalk_event events[] __attribute__((aligned(64)));
+};
+
+struct cctalk_event_ring *cctalk_event_ring_new(size_t size)
+{
+	struct cctalk_event_ring *ring;
+	size_t slots = 1;
+	void *mem;
+
+	while (slots < size)
+		slots <<= 1;
+
+	if (0 != posix_memalign(&mem, 64, sizeof(*ring) +
+	                        slots * sizeof(*ring->events)))
+		return NULL;
+
+	ring = mem;
+	memset(ring, 0, sizeof(*ring));
+	ring->mask = slots - 1;
+
+	return ring;
+}
+
+void cctalk_event_ring_free(struct cctalk_event_ring *ring)
+{
+	free(ring);
+}
+
+int cctalk_event_ring_push(struct cctalk_event_ring *ring,
+                           const struct cctalk_event *event)
+{
+	size_t head = ring->head;
+
+	if (head - ring->tail_seen > ring->mask) {
+		ring->tail_seen = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+		if (head - ring->tail_seen > ring->mask) {
+			errno = ENOBUFS;
+			return -1;
+		}
+	}
+
+	ring->events[head & ring->mask] = *event;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+size_t cctalk_event_ring_pop(struct cctalk_event_ring *ring,
+                             struct cctalk_event *events, size_t count)
+{
+	size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	size_t tail = ring->tail;
+	size_t taken = 0;
+
+	while (taken < count && tail != head)
+		events[taken++] = ring->events[tail++ & ring->mask];
+
+	__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	return taken;
+}
+
+/* Number of events between two counter values.
+ * Counters start at 0 and then loop from 255 back to 1. */
+static unsigned seq_distance(uint8_t from, uint8_t to)
+{
+	if (to >= from)
+		return to - from;
+
+	return to + 255 - from;
+}
+
+/* Counter value given number of events back. */
+static uint8_t seq_back(uint8_t seq, unsigned back)
+{
+	return (seq - 1 + 255 - back % 255) % 255 + 1;
+}
+
+/* Fill in the event from a single (A, B) result pair. */
+typedef void (*decode_fn)(struct cctalk_event *ev, uint8_t a, uint8_t b);
+
+static void decode_coin(struct cctalk_event *ev, uint8_t a, uint8_t b)
+{
+	ev->value = a;
+
+	if (a) {
+		ev->type = CCTALK_EVENT_CREDIT;
+		ev->sorter = b;
+		ev->error = 0;
+	} else {
+		ev->type = CCTALK_EVENT_ERROR;
+		ev->sorter = 0;
+		ev->error = b;
+	}
+}
+
+static void decode_bill(struct cctalk_event *ev, uint8_t a, uint8_t b)
+{
+	ev->value = a;
+
+	if (a)
+		ev->type = 1 == b ? CCTALK_EVENT_BILL_ESCROW
+		                  : CCTALK_EVENT_BILL_CREDIT;
+	else
+		ev->type = CCTALK_EVENT_BILL_STATUS;
+
+	ev->status = a ? 0 : b;
+}
+
+/* Push new events from the buffer of last 5 result pairs,
+ * the most recent one first. */
+static int buffer_events(struct cctalk_device *dev, uint8_t seq,
+                         const uint8_t results[5][2], decode_fn decode,
+                         struct cctalk_event_ring *ring)
+{
+	struct cctalk_event ev = {.dev = dev, .time = monotonic_ms()};
+	unsigned count, avail, i;
+	int pushed = 0;
+
+	if (!dev->credit_seq_known) {
+		dev->credit_seq = seq;
+		dev->credit_seq_known = 1;
+		return 0;
+	}
+
+	if (seq == dev->credit_seq)
+		return 0;
+
+	if (0 == seq) {
+		ev.type = CCTALK_EVENT_RESET;
+
+		if (-1 == cctalk_event_ring_push(ring, &ev))
+			return 0;
+
+		dev->credit_seq = 0;
+		return 1;
+	}
+
+	/* Only last 5 events are buffered by the device. */
+	count = seq_distance(dev->credit_seq, seq);
+	avail = count < 5 ? count : 5;
+
+	if (count > avail) {
+		ev.type = CCTALK_EVENT_OVERFLOW;
+		ev.seq = seq_back(seq, avail);
+		ev.lost = count - avail;
+
+		if (-1 == cctalk_event_ring_push(ring, &ev))
+			return 0;
+
+		dev->credit_seq = ev.seq;
+		ev.lost = 0;
+		pushed++;
+	}
+
+	for (i = avail; i-- > 0;) {
+		ev.seq = seq_back(seq, i);
+		decode(&ev, results[i][0], results[i][1]);
+
+		/* Full ring, try the rest next time. */
+		if (-1 == cctalk_event_ring_push(ring, &ev))
+			break;
+
+		if (CCTALK_EVENT_ERROR == ev.type)
+			dev->last_error = ev.error;
+		else if (CCTALK_EVENT_BILL_STATUS == ev.type)
+			dev->last_error = ev.status;
+
+		dev->credit_seq = ev.seq;
+		pushed++;
+	}
+
+	return pushed;
+}
+
+int cctalk_device_credit_events(struct cctalk_device *dev,
+                                const struct cctalk_credit_info *info,
+                                struct cctalk_event_ring *ring)
+{
+	uint8_t results[5][2];
+	size_t i;
+
+	for (i = 0; i < 5; i++) {
+		results[i][0] = info->coins[i].value;
+		results[i][1] = info->coins[i].value ? info->coins[i].sorter
+		                                     : info->coins[i].error;
+	}
+
+	return buffer_events(dev, info->seq, results, decode_coin, ring);
+}
+
+int cctalk_device_bill_events(struct cctalk_device *dev,
+                              const struct cctalk_bill_info *info,
+                              struct cctalk_event_ring *ring)
+{
+	uint8_t results[5][2];
+	size_t i;
+
+	for (i = 0; i < 5; i++) {
+		results[i][0] = info->bills[i].type;
+		results[i][1] = info->bills[i].code;
+	}
+
+	return buffer_events(dev, info->seq, results, decode_bill, ring);
+}
+
+int cctalk_device_poll_credits(struct cctalk_device *dev,
+                               struct cctalk_event_ring *ring)
+{
+	struct cctalk_credit_info info;
+
+	if (-1 == cctalk_device_query_credits(dev, &info))
+		return -1;
+
+	return cctalk_device_credit_events(dev, &info, ring);
+}
+
+int cctalk_device_poll_bills(struct cctalk_device *dev,
+                             struct cctalk_event_ring *ring)
+{
+	struct cctalk_bill_info info;
+
+	if (-1 == cctalk_bill_query_events(dev, &info))
+		return -1;
+
+	return cctalk_device_bill_events(dev, &info, ring);
+}
@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Magic value that enables the payout. */
+#define HOPPER_ENABLE 165
+
+int cctalk_hopper_enable(const struct cctalk_device *dev, int on)
+{
+	uint8_t data[1] = {on ? HOPPER_ENABLE : 0};
+
+	if (0 != cctalk_transact(dev->host, dev->id,
+	                         CCTALK_METHOD_ENABLE_HOPPER, data, 1, NULL, 0))
+		return -1;
+
+	return 0;
+}
+
+int cctalk_hopper_test(const struct cctalk_device *dev, uint8_t *flags)
+{
+	if (0 != cctalk_transact(dev->host, dev->id, CCTALK_METHOD_TEST_HOPPER,
+	                         NULL, 0, flags, 1))
+		return -1;
+
+	return 0;
+}
+
+static void decode_status(struct cctalk_hopper_status *status,
+                          const uint8_t *result)
+{
+	status->counter = result[0];
+	status->remaining = result[1];
+	status->paid = result[2];
+	status->unpaid = result[3];
+}
+
+int cctalk_hopper_query_status(const struct cctalk_device *dev,
+                               struct cctalk_hopper_status *status)
+{
+	uint8_t result[4] = {0};
+
+	if (0 != cctalk_transact(dev->host, dev->id,
+	                         CCTALK_METHOD_REQUEST_HOPPER_STATUS, NULL, 0,
+	                         result, sizeof(result)))
+		return -1;
+
+	decode_status(status, result);
+	return 0;
+}
+
+int cctalk_parse_hopper_status(const struct cctalk_message *reply,
+                               struct cctalk_hopper_status *status)
+{
+	uint8_t result[4] = {0};
+
+	if (0 != reply->header)
+		return -1;
+
+	memcpy(result, reply->data,
+	       reply->length < sizeof(result) ? reply->length : sizeof(result));
+
+	decode_status(status, result);
+	return 0;
+}
+
+int cctalk_hopper_dispense(const struct cctalk_device *dev, uint8_t count)
+{
+	uint8_t data[1] = {count};
+
+	if (-1 == cctalk_send(dev->host, dev->id,
+	                      CCTALK_METHOD_DISPENSE_HOPPER_COINS, data, 1))
+		return -1;
+
+	if (0 != cctalk_recv_status(dev->host))
+		return -1;
+
+	return 0;
+}
+
+int cctalk_hopper_stop(const struct cctalk_device *dev)
+{
+	uint8_t unpaid[1] = {0};
+
+	if (-1 == cctalk_send(dev->host, dev->id, CCTALK_METHOD_EMERGENCY_STOP,
+	                      NULL, 0))
+		return -1;
+
+	if (0 != cctalk_recv_data(dev->host, unpaid, 1))
+		return -1;
+
+	return unpaid[0];
+}
+
+struct cctalk_payout *cctalk_payout_new(struct cctalk_bus *bus,
+                                        cctalk_payout_cb callback,
+                                        void *arg)
+{
+	struct cctalk_payout *payout = calloc(1, sizeof(*payout));
+
+	payout->bus = bus;
+	payout->callback = callback;
+	payout->arg = arg;
+
+	return payout;
+}
+
+void cctalk_payout_free(struct cctalk_payout *payout)
+{
+	free(payout);
+}
+
+static struct cctalk_payout_hopper *find_hopper(struct cctalk_payout *payout,
+                                                struct cctalk_device *dev)
+{
+	size_t i;
+
+	for (i = 0; i < payout->nhoppers; i++)
+		if (payout->hoppers[i].dev == dev)
+			return &payout->hoppers[i];
+
+	return NULL;
+}
+
+/*
+ * Split value among the hoppers, starting with the most valuable
+ * coins.  Returns the value that could not be split.
+ */
+static unsigned plan(struct cctalk_payout *payout, unsigned value)
+{
+	unsigned last = ~0u;
+
+	while (value > 0) {
+		struct cctalk_payout_hopper *best = NULL;
+		size_t i;
+
+		for (i = 0; i < payout->nhoppers; i++) {
+			struct cctalk_payout_hopper *h = &payout->hoppers[i];
+
+			if (h->empty || h->value > value || h->value >= last)
+				continue;
+
+			if (NULL == best || h->value > best->value)
+				best = h;
+		}
+
+		if (NULL == best)
+			break;
+
+		best->pending += value / best->value;
+		value %= best->value;
+		last = best->value;
+	}
+
+	return value;
+}
+
+static void on_dispense(struct cctalk_host *host,
+                        const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_payout_hopper *h = arg;
+
+	if (CCTALK_HOPPER_STARTING != h->state)
+		return;
+
+	if (NULL != reply && 0 == reply->header) {
+		h->counter = reply->length > 0 ? reply->data[0] : h->counter + 1;
+		h->state = CCTALK_HOPPER_PAYING;
+	} else {
+		h->state = CCTALK_HOPPER_VERIFYING;
+	}
+}
+
+/* Ask the hopper to pay out next batch of its pending coins. */
+static void start_batch(struct cctalk_payout_hopper *h)
+{
+	uint8_t enable[1] = {HOPPER_ENABLE}, count[1];
+
+	h->batch = h->pending < 255 ? h->pending : 255;
+	h->batch_paid = 0;
+	h->pending -= h->batch;
+	h->state = CCTALK_HOPPER_STARTING;
+	count[0] = h->batch;
+
+	if (-1 == cctalk_bus_submit(h->payout->bus, h->dev->id,
+	                            CCTALK_METHOD_ENABLE_HOPPER, enable, 1,
+	                            NULL, NULL) ||
+	    -1 == cctalk_bus_submit(h->payout->bus, h->dev->id,
+	                            CCTALK_METHOD_DISPENSE_HOPPER_COINS, count, 1,
+	                            on_dispense, h)) {
+		h->unpaid += h->batch;
+		h->batch = 0;
+		h->state = CCTALK_HOPPER_IDLE;
+	}
+}
+
+/* Account for a finished batch and keep the payout going. */
+static void finish_batch(struct cctalk_payout_hopper *h, unsigned paid,
+                         unsigned unpaid)
+{
+	struct cctalk_payout *payout = h->payout;
+	size_t i;
+
+	h->paid += paid;
+	h->unpaid += unpaid;
+	h->batch = h->batch_paid = 0;
+	h->state = CCTALK_HOPPER_IDLE;
+
+	/* Let the other hoppers pay what this one could not. */
+	if (unpaid > 0) {
+		h->empty = 1;
+
+		if (!payout->stopping) {
+			unsigned value = (h->pending + unpaid) * h->value;
+
+			h->pending = 0;
+			payout->shortfall += plan(payout, value);
+		}
+	}
+
+	for (i = 0; i < payout->nhoppers; i++) {
+		struct cctalk_payout_hopper *other = &payout->hoppers[i];
+
+		if (CCTALK_HOPPER_IDLE == other->state && other->pending > 0)
+			start_batch(other);
+	}
+}
+
+/* Payout is over once all the hoppers are idle with nothing to pay. */
+static int payout_done(const struct cctalk_payout *payout)
+{
+	size_t i;
+
+	for (i = 0; i < payout->nhoppers; i++)
+		if (CCTALK_HOPPER_IDLE != payout->hoppers[i].state ||
+		    payout->hoppers[i].pending > 0)
+			return 0;
+
+	return 1;
+}
+
+static void on_status(struct cctalk_device *dev,
+                      const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_payout *payout = arg;
+	struct cctalk_payout_hopper *h = find_hopper(payout, dev);
+	struct cctalk_hopper_status status;
+
+	if (NULL == h || NULL == reply ||
+	    -1 == cctalk_parse_hopper_status(reply, &status))
+		return;
+
+	switch (h->state) {
+		case CCTALK_HOPPER_IDLE:
+			h->counter = status.counter;
+			return;
+
+		case CCTALK_HOPPER_STARTING:
+			return;
+
+		case CCTALK_HOPPER_VERIFYING:
+			if (status.counter == h->counter) {
+				/* The request never made it. */
+				finish_batch(h, 0, h->batch);
+				break;
+			}
+
+			h->counter = status.counter;
+			h->state = CCTALK_HOPPER_PAYING;
+			/* fall through */
+
+		case CCTALK_HOPPER_PAYING:
+			/* Leftover from before the dispense request. */
+			if (status.counter != h->counter)
+				return;
+
+			h->batch_paid = status.paid;
+
+			if (0 == status.remaining)
+				finish_batch(h, status.paid, status.unpaid);
+
+			break;
+	}
+
+	if (!payout->active)
+		return;
+
+	if (payout_done(payout))
+		payout->active = 0;
+
+	if (NULL != payout->callback)
+		payout->callback(payout, !payout->active, payout->arg);
+}
+
+int cctalk_payout_add_hopper(struct cctalk_payout *payout,
+                             struct cctalk_device *dev, unsigned value)
+{
+	struct cctalk_payout_hopper *h;
+	struct cctalk_hopper_status status;
+
+	if (payout->nhoppers == CCTALK_PAYOUT_MAX_HOPPERS || 0 == value) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (payout->active) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	/* Dispense requests are told apart by the counter. */
+	if (-1 == cctalk_hopper_query_status(dev, &status))
+		return -1;
+
+	if (-1 == cctalk_bus_add(payout->bus, dev,
+	                         CCTALK_METHOD_REQUEST_HOPPER_STATUS,
+	                         on_status, payout))
+		return -1;
+
+	h = &payout->hoppers[payout->nhoppers++];
+	*h = (struct cctalk_payout_hopper){
+		.payout = payout,
+		.dev = dev,
+		.value = value,
+		.counter = status.counter,
+	};
+
+	return 0;
+}
+
+int cctalk_payout_start(struct cctalk_payout *payout, unsigned amount)
+{
+	size_t i;
+
+	if (payout->active) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	payout->amount = amount;
+	payout->stopping = 0;
+
+	for (i = 0; i < payout->nhoppers; i++) {
+		struct cctalk_payout_hopper *h = &payout->hoppers[i];
+
+		h->pending = h->batch = h->batch_paid = 0;
+		h->paid = h->unpaid = 0;
+		h->empty = 0;
+	}
+
+	payout->shortfall = plan(payout, amount);
+
+	for (i = 0; i < payout->nhoppers; i++)
+		if (payout->hoppers[i].pending > 0)
+			start_batch(&payout->hoppers[i]);
+
+	payout->active = !payout_done(payout);
+	return 0;
+}
+
+int cctalk_payout_stop(struct cctalk_payout *payout)
+{
+	size_t i;
+	int res;
+
+	payout->stopping = 1;
+
+	for (i = 0; i < payout->nhoppers; i++) {
+		struct cctalk_payout_hopper *h = &payout->hoppers[i];
+
+		h->unpaid += h->pending;
+		h->pending = 0;
+
+		if (CCTALK_HOPPER_IDLE == h->state)
+			continue;
+
+		/* Dispense request is still queued, stop right after it. */
+		if (CCTALK_HOPPER_STARTING == h->state)
+			res = cctalk_bus_submit(payout->bus, h->dev->id,
+			                        CCTALK_METHOD_EMERGENCY_STOP,
+			                        NULL, 0, NULL, NULL);
+		else
+			res = cctalk_bus_submit_urgent(payout->bus, h->dev->id,
+			                               CCTALK_METHOD_EMERGENCY_STOP,
+			                               NULL, 0, NULL, NULL);
+
+		if (-1 == res)
+			return -1;
+	}
+
+	return 0;
+}
+
+unsigned cctalk_payout_paid(const struct cctalk_payout *payout)
+{
+	unsigned paid = 0;
+	size_t i;
+
+	for (i = 0; i < payout->nhoppers; i++) {
+		const struct cctalk_payout_hopper *h = &payout->hoppers[i];
+		paid += (h->paid + h->batch_paid) * h->value;
+	}
+
+	return paid;
+}
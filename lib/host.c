@@ -17,162 +17,780 @@
 #include "cctalk.h"
 #include "util.h"
 
+#include <errno.h>
 #include <poll.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <termios.h>
 #include <sys/fcntl.h>
 
-/* Put the serial line into raw mode and discard any pending data. */
-static int setup_serial_line(int fd)
+int cctalk_host_setup_line(struct cctalk_host *host,
+                           const struct cctalk_line *line)
 {
-	struct termios tio = {0};
-
-	cfmakeraw(&tio);
-	cfsetspeed(&tio, B9600);
-
-	if (-1 == tcsetattr(fd, TCSANOW, &tio))
+	if (NULL == host->transport->setup_line) {
+		errno = ENOTTY;
 		return -1;
+	}
+
+	return host->transport->setup_line(host, line);
+}
 
-	if (-1 == tcflush(fd, TCIOFLUSH))
+int cctalk_host_line_info(const struct cctalk_host *host,
+                          struct cctalk_line *line)
+{
+	if (NULL == host->transport->line_info) {
+		errno = ENOTTY;
 		return -1;
+	}
 
-	return 0;
+	return host->transport->line_info(host, line);
 }
 
-struct cctalk_host *cctalk_host_new(const char *path)
+struct cctalk_host *cctalk_host_new_fd(const struct cctalk_transport *transport,
+                                       int fd, void *data)
 {
 	struct cctalk_host *host;
-	int fd;
-
-	if (-1 == (fd = open(path, O_RDWR | O_NOCTTY)))
-		return NULL;
 
-	if (-1 == setup_serial_line(fd))
+	/* The asynchronous engine must never block, the blocking
+	 * functions poll(2) before every read and write anyway. */
+	if (-1 == fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK))
 		return NULL;
 
-	host = malloc(sizeof(*host));
+	host = calloc(1, sizeof(*host));
 	host->fd = fd;
+	host->transport = transport;
+	host->transport_data = data;
 	host->id = 1;
 	host->crc_mode = CCTALK_CRC_SIMPLE;
 	host->timeout = 1000;
+	host->byte_timeout = 50;
+	host->min_timeout = 20;
+	host->retries = 2;
+	host->echo = 1;
 
 	return host;
 }
 
+struct cctalk_host *cctalk_host_new(const char *path)
+{
+	char node[256], *service;
+
+	if (0 != strncmp(path, "tcp:", 4))
+		return cctalk_host_new_serial(path);
+
+	snprintf(node, sizeof(node), "%s", path + 4);
+
+	if (NULL == (service = strrchr(node, ':'))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	*service++ = '\0';
+
+	/* Literal IPv6 addresses come in brackets. */
+	if ('[' == node[0] && ']' == service[-2]) {
+		service[-2] = '\0';
+		return cctalk_host_new_tcp(node + 1, service);
+	}
+
+	return cctalk_host_new_tcp(node, service);
+}
+
 void cctalk_host_free(struct cctalk_host *host)
 {
 	if (NULL == host)
 		return;
 
-	close(host->fd);
+	host->transport->close(host);
 	free(host);
 }
 
-int cctalk_send(const struct cctalk_host *host, uint8_t destination,
-                enum cctalk_method method, void *data, size_t length)
+void cctalk_host_stats(struct cctalk_host *host, struct cctalk_stats *stats,
+                       int reset)
 {
-	uint8_t checksum;
+	if (NULL != stats)
+		*stats = host->stats;
+
+	if (reset)
+		memset(&host->stats, 0, sizeof(host->stats));
+}
 
-	struct cctalk_message header = {
-		.destination = destination,
-		.length = length,
-		.source = host->id,
-		.header = method,
-	};
+int64_t cctalk_stats_rtt_percentile(const struct cctalk_stats *stats,
+                                    uint8_t destination, double percentile)
+{
+	const uint32_t *hist = stats->rtt[destination];
+	uint64_t total = 0, seen = 0;
+	int i;
 
-	uint8_t echobuf[sizeof(header) + length + 1];
+	for (i = 0; i < CCTALK_RTT_BUCKETS; i++)
+		total += hist[i];
+
+	if (0 == total)
+		return -1;
+
+	for (i = 0; i < CCTALK_RTT_BUCKETS - 1; i++)
+		if ((seen += hist[i]) > 0 && seen >= total * percentile / 100)
+			break;
+
+	return (int64_t)2 << i;
+}
+
+/* Write the whole frame, waiting for the line when it is busy. */
+static int tx_write(struct cctalk_host *host)
+{
+	struct pollfd pfd = {host->fd, POLLOUT, 0};
+	size_t total = 0;
 
-	if (CCTALK_CRC_CCITT == host->crc_mode)
-		checksum = crc_16_ccitt(&header, data);
-	else
-		checksum = crc_simple(&header, data);
+	while (total < host->txlen) {
+		ssize_t written = host->transport->write(host,
+		                                         host->txbuf + total,
+		                                         host->txlen - total);
 
-	/* Write our message to the wire. */
+		/* Only wait when the line is not ready, which is rare
+		 * for frames as short as ours. */
+		if (-1 == written && (EAGAIN == errno || EINTR == errno)) {
+			int ready = poll(&pfd, 1, host->timeout);
 
-	if (-1 == xwrite(host->fd, &header, sizeof(header), host->timeout))
+			if (0 == ready)
+				errno = ETIMEDOUT;
+
+			if (1 != ready && !(-1 == ready && EINTR == errno))
+				return -1;
+
+			continue;
+		}
+
+		/* A line that takes nothing is as good as a broken one,
+		 * report it so that the transaction gets retried. */
+		if (0 == written)
+			errno = EIO;
+
+		if (written < 1)
+			return -1;
+
+		total += written;
+	}
+
+	return 0;
+}
+
+/* Drop consumed bytes and read as much as fits into the buffer. */
+static ssize_t rx_read(struct cctalk_host *host)
+{
+	ssize_t rread;
+
+	if (host->rxoff > 0) {
+		host->rxlen -= host->rxoff;
+		memmove(host->rxbuf, host->rxbuf + host->rxoff, host->rxlen);
+		host->rxoff = 0;
+	}
+
+	/* Full buffer without a single frame in it is just noise. */
+	if (host->rxlen == sizeof(host->rxbuf))
+		host->rxlen = 0;
+
+	rread = host->transport->read(host, host->rxbuf + host->rxlen,
+	                              sizeof(host->rxbuf) - host->rxlen);
+
+	if (0 == rread) {
+		errno = EPIPE;
 		return -1;
+	}
+
+	if (rread > 0) {
+		host->rx_at = monotonic_ms();
+		host->rxlen += rread;
+		host->stats.bytes_received += rread;
+	}
+
+	return rread;
+}
+
+/* Update the round-trip estimate of the destination, like TCP does. */
+static void rtt_estimate(struct cctalk_rtt *est, int64_t rtt)
+{
+	int32_t err;
+
+	if (rtt < 1)
+		rtt = 1;
+
+	if (rtt > INT32_MAX / 8)
+		rtt = INT32_MAX / 8;
+
+	if (0 == est->srtt) {
+		est->srtt = rtt;
+		est->rttvar = rtt / 2;
+		return;
+	}
+
+	err = rtt - est->srtt;
+	est->srtt += err / 8;
+	est->rttvar += (abs(err) - est->rttvar) / 4;
+}
+
+/* Put the round trip of the request in progress into the histogram. */
+static void rtt_record(struct cctalk_host *host)
+{
+	int64_t rtt = monotonic_us() - host->sent_at;
+	struct cctalk_rtt *est = &host->rtt[host->txbuf[0]];
+	int bucket = 0;
+
+	if (!host->retransmit)
+		rtt_estimate(est, rtt);
+
+	est->backoff = 0;
+
+	while (rtt > 1 && bucket < CCTALK_RTT_BUCKETS - 1) {
+		rtt >>= 1;
+		bucket++;
+	}
 
-	if (-1 == xwrite(host->fd, data, length, host->timeout))
+	host->stats.rtt[host->txbuf[0]][bucket]++;
+	host->sent_at = 0;
+}
+
+/* The reply to the request in progress did not arrive in time. */
+static void rtt_timeout(struct cctalk_host *host)
+{
+	struct cctalk_rtt *est = &host->rtt[host->txbuf[0]];
+
+	if (host->sent_at > 0 && est->srtt > 0 && est->backoff < 16)
+		est->backoff++;
+}
+
+int cctalk_host_reply_timeout(const struct cctalk_host *host,
+                              uint8_t destination)
+{
+	const struct cctalk_rtt *est = &host->rtt[destination];
+	int64_t ms;
+
+	if (0 == est->srtt)
+		return host->timeout;
+
+	ms = ((est->srtt + 4 * (int64_t)est->rttvar) / 1000 + 1) << est->backoff;
+
+	if (ms < host->min_timeout)
+		ms = host->min_timeout;
+
+	if (ms > host->timeout)
+		ms = host->timeout;
+
+	return ms;
+}
+
+/* When the reply to the last request must start arriving. */
+static int64_t reply_deadline(const struct cctalk_host *host)
+{
+	/* Not waiting for a reply to any particular request. */
+	if (0 == host->sent_at)
+		return monotonic_ms() + host->timeout;
+
+	return host->sent_at / 1000 +
+	       cctalk_host_reply_timeout(host, host->txbuf[0]);
+}
+
+/* When the next byte must arrive, counting from the last one
+ * received or from given moment, whichever is later. */
+static int64_t byte_deadline(const struct cctalk_host *host, int64_t since)
+{
+	return (host->rx_at > since ? host->rx_at : since) + host->byte_timeout;
+}
+
+/* Note that a request frame has just been written out. */
+static void tx_done(struct cctalk_host *host)
+{
+	host->stats.frames_sent++;
+	host->sent_at = monotonic_us();
+	host_capture(host, CCTALK_CAPTURE_TX, 0, host->txbuf, host->txlen);
+}
+
+/* Record the start of a frame that never finished arriving. */
+static void rx_truncated(struct cctalk_host *host)
+{
+	host->stats.truncated++;
+	host_capture(host, CCTALK_CAPTURE_RX, CCTALK_CAPTURE_TRUNCATED,
+	             host->rxbuf + host->rxoff, host->rxlen - host->rxoff);
+}
+
+/* The buffer starts with a frame addressed to us.  Anything else
+ * left behind by rx_frame() is noise, not a reply being received. */
+static int rx_started(const struct cctalk_host *host)
+{
+	return host->rxoff < host->rxlen &&
+	       host->rxbuf[host->rxoff] == host->id;
+}
+
+/* Extract next valid frame from the receive buffer, if any. */
+static const struct cctalk_message *rx_frame(struct cctalk_host *host)
+{
+	const struct cctalk_message *msg;
+	size_t skip, len;
+
+	len = frame_scan(host, host->rxbuf + host->rxoff,
+	                 host->rxlen - host->rxoff, &skip);
+	host->rxoff += skip;
+
+	if (0 == len)
+		return NULL;
+
+	msg = (const void *)(host->rxbuf + host->rxoff);
+	host->rxoff += len;
+	host->stats.frames_received++;
+	host_capture(host, CCTALK_CAPTURE_RX, 0, msg, len);
+
+	if (host->sent_at > 0)
+		rtt_record(host);
+
+	return msg;
+}
+
+/*
+ * The frame at the start of the buffer stopped arriving, so its length
+ * byte was probably bogus.  Look for a valid frame in what follows.
+ */
+static const struct cctalk_message *rx_resync(struct cctalk_host *host)
+{
+	const struct cctalk_message *msg;
+
+	rx_truncated(host);
+
+	while (host->rxoff < host->rxlen) {
+		host->rxoff++;
+
+		if (NULL != (msg = rx_frame(host)))
+			return msg;
+	}
+
+	return NULL;
+}
+
+/* Block until more data arrive into the receive buffer
+ * or the deadline passes. */
+static int rx_wait(struct cctalk_host *host, int64_t deadline)
+{
+	struct pollfd pfd = {host->fd, POLLIN, 0};
+	int64_t left = deadline - monotonic_ms();
+	int ready = poll(&pfd, 1, left > 0 ? left : 0);
+
+	if (0 == ready)
+		errno = ETIMEDOUT;
+
+	if (1 != ready)
 		return -1;
 
-	if (-1 == xwrite(host->fd, &checksum, 1, host->timeout))
+	if (-1 == rx_read(host) && EAGAIN != errno && EINTR != errno)
 		return -1;
 
-	/* Read our own message from the wire. */
+	return 0;
+}
 
-	if (-1 == xread(host->fd, echobuf, sizeof(echobuf), host->timeout))
-		return -1;
+/* Consume bytes identical to the given ones from the receive buffer.
+ * Fails as soon as a mismatching byte arrives. */
+static int rx_expect(struct cctalk_host *host, const void *buf, size_t len)
+{
+	const uint8_t *bytes = buf;
+	int64_t start = monotonic_ms();
+
+	while (len > 0) {
+		size_t have = host->rxlen - host->rxoff;
+		size_t cmp = have < len ? have : len;
+
+		if (0 != memcmp(host->rxbuf + host->rxoff, bytes, cmp)) {
+			host->stats.echo_errors++;
+			errno = EIO;
+			return -1;
+		}
+
+		host->rxoff += cmp;
+		bytes += cmp;
+		len -= cmp;
+
+		if (len > 0 && -1 == rx_wait(host, byte_deadline(host, start))) {
+			if (ETIMEDOUT == errno)
+				host->stats.timeouts++;
 
-	if (0 != memcmp(&header, echobuf, sizeof(header)))
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Wait for the next valid frame.  It stays in the receive buffer
+ * and is only valid until the buffer is read into again.
+ *
+ * The reply must start arriving before its deadline and once it does,
+ * its bytes must not be more than byte_timeout apart.  Frames that stop
+ * arriving halfway fail with EBADMSG, unless a valid one follows.
+ */
+static const struct cctalk_message *recv_frame(struct cctalk_host *host)
+{
+	const struct cctalk_message *msg;
+	int64_t deadline = reply_deadline(host);
+
+	while (NULL == (msg = rx_frame(host))) {
+		int started = rx_started(host);
+
+		if (0 == rx_wait(host, started ? byte_deadline(host, 0) : deadline))
+			continue;
+
+		if (ETIMEDOUT != errno)
+			return NULL;
+
+		if (started) {
+			if (NULL != (msg = rx_resync(host)))
+				return msg;
+
+			errno = EBADMSG;
+		} else {
+			host->stats.timeouts++;
+			rtt_timeout(host);
+		}
+
+		return NULL;
+	}
+
+	return msg;
+}
+
+static int send_request(struct cctalk_host *host, uint8_t destination,
+                        enum cctalk_method method, const void *data,
+                        size_t length, int retransmit)
+{
+	if (length > 255) {
+		errno = EINVAL;
 		return -1;
+	}
 
-	if (0 != memcmp(data, echobuf + sizeof(header), length))
+	/* Anything received so far is a leftover from earlier exchanges. */
+	host->rxoff = host->rxlen = 0;
+	host->sent_at = 0;
+	host->retransmit = retransmit;
+
+	/* Write our message to the wire in one go. */
+
+	host->txlen = frame_encode(host, host->txbuf, destination, method,
+	                           data, length);
+
+	if (-1 == tx_write(host))
 		return -1;
 
-	if (echobuf[sizeof(echobuf) - 1] != checksum)
+	host->stats.bytes_sent += host->txlen;
+	tx_done(host);
+
+	/* Read our own message from the wire. */
+
+	if (host->echo && -1 == rx_expect(host, host->txbuf, host->txlen))
 		return -1;
 
 	return 0;
 }
 
-struct cctalk_message *cctalk_recv(const struct cctalk_host *host)
+int cctalk_send(struct cctalk_host *host, uint8_t destination,
+                enum cctalk_method method, void *data, size_t length)
 {
-	struct cctalk_message *msg;
-	struct cctalk_message header;
-	uint8_t data[256] = {0};
-	uint8_t checksum, our_checksum;
+	return send_request(host, destination, method, data, length, 0);
+}
 
-	if (-1 == xread(host->fd, &header, sizeof(header), host->timeout))
-		return NULL;
+int cctalk_transact(struct cctalk_host *host, uint8_t destination,
+                    enum cctalk_method method, const void *data,
+                    size_t length, uint8_t *buf, size_t len)
+{
+	int attempt, status;
 
-	if (-1 == xread(host->fd, data, header.length, host->timeout))
-		return NULL;
+	for (attempt = 0; attempt <= host->retries; attempt++) {
+		if (attempt > 0)
+			host->stats.retries++;
 
-	if (-1 == xread(host->fd, &checksum, 1, host->timeout))
-		return NULL;
+		if (-1 != send_request(host, destination, method, data, length,
+		                       attempt > 0) &&
+		    -1 != (status = cctalk_recv_data(host, buf, len)))
+			return status;
+
+		/* Only lost and garbled frames are worth another try. */
+		if (ETIMEDOUT != errno && EIO != errno && EBADMSG != errno)
+			return -1;
+	}
+
+	return -1;
+}
 
-	if (CCTALK_CRC_CCITT == host->crc_mode)
-		our_checksum = crc_16_ccitt(&header, data);
-	else
-		our_checksum = crc_simple(&header, data);
+struct cctalk_message *cctalk_recv(struct cctalk_host *host)
+{
+	const struct cctalk_message *frame;
+	struct cctalk_message *msg;
 
-	if (checksum != our_checksum)
+	if (NULL == (frame = recv_frame(host)))
 		return NULL;
 
-	msg = malloc(sizeof(header) + header.length + 1);
-	memcpy(msg, &header, sizeof(header));
-	memcpy(msg->data, data, header.length + 1);
+	msg = malloc(sizeof(*frame) + frame->length + 1);
+	memcpy(msg, frame, sizeof(*frame) + frame->length + 1);
 
 	return msg;
 }
 
-int cctalk_recv_status(const struct cctalk_host *host)
+const struct cctalk_message *cctalk_recv_slot(struct cctalk_host *host)
 {
-	struct cctalk_message *reply;
+	return recv_frame(host);
+}
 
-	if (NULL == (reply = cctalk_recv(host)))
+int cctalk_recv_msg(struct cctalk_host *host, struct cctalk_message *msg,
+                    size_t size)
+{
+	const struct cctalk_message *frame;
+	size_t len;
+
+	if (NULL == (frame = recv_frame(host)))
 		return -1;
 
-	int status = reply->header;
+	len = sizeof(*frame) + frame->length + 1;
+
+	if (len > size) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	memcpy(msg, frame, len);
+	return msg->header;
+}
+
+int cctalk_recv_status(struct cctalk_host *host)
+{
+	const struct cctalk_message *reply;
+
+	if (NULL == (reply = recv_frame(host)))
+		return -1;
 
-	free(reply);
-	return status;
+	return reply->header;
 }
 
-int cctalk_recv_data(const struct cctalk_host *host, uint8_t *buf, size_t len)
+int cctalk_recv_data(struct cctalk_host *host, uint8_t *buf, size_t len)
 {
-	struct cctalk_message *reply;
+	const struct cctalk_message *reply;
 
 	memset(buf, 0, len);
 
-	if (NULL == (reply = cctalk_recv(host)))
+	if (NULL == (reply = recv_frame(host)))
 		return -1;
 
-	int status = reply->header;
-	memcpy(buf, reply->data, reply->length <= len ? len : reply->length);
+	memcpy(buf, reply->data, reply->length < len ? reply->length : len);
+	return reply->header;
+}
+
+ssize_t host_recv_bytes(struct cctalk_host *host, uint8_t *buf, size_t len,
+                        int timeout)
+{
+	struct pollfd pfd = {host->fd, POLLIN, 0};
+	int64_t deadline = monotonic_ms() + timeout;
+	size_t total = 0;
+
+	for (;;) {
+		size_t have = host->rxlen - host->rxoff;
+		int64_t left;
+
+		if (have > len - total)
+			have = len - total;
+
+		memcpy(buf + total, host->rxbuf + host->rxoff, have);
+		host->rxoff += have;
+		total += have;
+
+		if (total == len)
+			break;
+
+		if ((left = deadline - monotonic_ms()) <= 0)
+			break;
+
+		if (1 != poll(&pfd, 1, left))
+			break;
+
+		if (-1 == rx_read(host) && EAGAIN != errno && EINTR != errno)
+			return -1;
+	}
+
+	return total;
+}
+
+/* Finish the request in progress and report the outcome. */
+static int complete(struct cctalk_host *host, const struct cctalk_message *reply,
+                    int err)
+{
+	cctalk_reply_cb callback = host->callback;
+	void *arg = host->callback_arg;
+
+	if (ETIMEDOUT == err)
+		host->stats.timeouts++;
+
+	if (ETIMEDOUT == err && CCTALK_HOST_REPLY == host->state)
+		rtt_timeout(host);
+
+	/* Become idle first so that the callback can submit right away. */
+	host->state = CCTALK_HOST_IDLE;
+	host->callback = NULL;
+	host->callback_arg = NULL;
+
+	if (NULL != callback) {
+		errno = err;
+		callback(host, reply, arg);
+	}
+
+	return 1;
+}
+
+int cctalk_host_submit(struct cctalk_host *host, uint8_t destination,
+                       enum cctalk_method method, const void *data,
+                       size_t length, cctalk_reply_cb callback, void *arg)
+{
+	if (CCTALK_HOST_IDLE != host->state) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (length > 255) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	host->txlen = frame_encode(host, host->txbuf, destination, method,
+	                           data, length);
+	host->txoff = 0;
+	host->rxoff = host->rxlen = 0;
+	host->sent_at = 0;
+	host->retransmit = 0;
+
+	host->callback = callback;
+	host->callback_arg = arg;
+	host->deadline = monotonic_ms() + host->timeout;
+	host->state = CCTALK_HOST_SENDING;
+
+	return 0;
+}
+
+short cctalk_host_events(const struct cctalk_host *host)
+{
+	switch (host->state) {
+		case CCTALK_HOST_SENDING:
+			return POLLOUT;
+
+		case CCTALK_HOST_ECHO:
+		case CCTALK_HOST_REPLY:
+			return POLLIN;
+
+		default:
+			return 0;
+	}
+}
+
+int cctalk_host_next_timeout(const struct cctalk_host *host)
+{
+	int64_t left;
+
+	if (CCTALK_HOST_IDLE == host->state)
+		return -1;
+
+	left = host->deadline - monotonic_ms();
+	return left > 0 ? left : 0;
+}
+
+/* Write as much of the pending frame as the line accepts. */
+static int dispatch_send(struct cctalk_host *host)
+{
+	ssize_t written = host->transport->write(host,
+	                                         host->txbuf + host->txoff,
+	                                         host->txlen - host->txoff);
+
+	if (-1 == written)
+		return (EAGAIN == errno || EINTR == errno) ? 0 : -1;
+
+	host->txoff += written;
+	host->stats.bytes_sent += written;
+
+	if (host->txoff < host->txlen)
+		return 0;
+
+	tx_done(host);
+
+	if (host->echo) {
+		host->state = CCTALK_HOST_ECHO;
+		host->deadline = byte_deadline(host, monotonic_ms());
+	} else {
+		host->state = CCTALK_HOST_REPLY;
+		host->deadline = reply_deadline(host);
+	}
+
+	return 0;
+}
+
+/* Read whatever is available and try to make progress with it. */
+static int dispatch_recv(struct cctalk_host *host)
+{
+	const struct cctalk_message *msg;
+
+	if (-1 == rx_read(host))
+		return (EAGAIN == errno || EINTR == errno) ? 0 : -1;
+
+	if (CCTALK_HOST_ECHO == host->state) {
+		size_t have = host->rxlen - host->rxoff;
+		size_t cmp = have < host->txlen ? have : host->txlen;
+
+		if (0 != memcmp(host->rxbuf + host->rxoff, host->txbuf, cmp)) {
+			host->stats.echo_errors++;
+			errno = EIO;
+			return -1;
+		}
+
+		if (have < host->txlen) {
+			host->deadline = byte_deadline(host, 0);
+			return 0;
+		}
+
+		host->rxoff += host->txlen;
+		host->state = CCTALK_HOST_REPLY;
+		host->deadline = reply_deadline(host);
+	}
+
+	if (NULL == (msg = rx_frame(host))) {
+		/* Part of the reply is here, the rest must follow closely. */
+		if (rx_started(host))
+			host->deadline = byte_deadline(host, 0);
+
+		return 0;
+	}
+
+	return complete(host, msg, 0);
+}
+
+int cctalk_host_dispatch(struct cctalk_host *host, short revents)
+{
+	int result = 0;
+
+	if (CCTALK_HOST_IDLE == host->state)
+		return 0;
+
+	if (revents & (POLLERR | POLLNVAL))
+		return complete(host, NULL, EIO);
+
+	if (CCTALK_HOST_SENDING == host->state && (revents & POLLOUT))
+		result = dispatch_send(host);
+	else if (revents & (POLLIN | POLLHUP))
+		result = dispatch_recv(host);
+
+	if (-1 == result)
+		return complete(host, NULL, errno);
+
+	if (result > 0)
+		return result;
+
+	if (monotonic_ms() < host->deadline)
+		return 0;
+
+	if (CCTALK_HOST_REPLY == host->state && rx_started(host)) {
+		const struct cctalk_message *msg = rx_resync(host);
+
+		return complete(host, msg, msg ? 0 : EBADMSG);
+	}
 
-	free(reply);
-	return status;
+	return complete(host, NULL, ETIMEDOUT);
 }
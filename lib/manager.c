@@ -0,0 +1,660 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+/* Poll completions queued before new ones get dropped. */
+#define QUEUE_LIMIT 256
+
+/* Bus run by the manager. */
+struct member {
+	struct cctalk_manager *mgr;
+	struct cctalk_bus *bus;
+	struct worker *worker;
+};
+
+/* Device polled with reports going to the completion queue. */
+struct watch {
+	struct member *member;
+	enum cctalk_method method;
+};
+
+/* One-shot request on its way to the worker thread. */
+struct pending {
+	struct pending *next;
+	struct member *member;
+
+	uint8_t destination;
+	enum cctalk_method method;
+	uint8_t data[255];
+	size_t length;
+	void *tag;
+};
+
+/* Thread running a subset of the buses. */
+struct worker {
+	struct cctalk_manager *mgr;
+	pthread_t thread;
+	int cpu;
+
+	/* Wakes the thread up when pending requests arrive. */
+	int wakefd;
+
+	/* Requests submitted by other threads, newest first. */
+	pthread_mutex_t lock;
+	struct pending *pending;
+
+	struct member **members;
+	size_t nmembers;
+};
+
+struct cctalk_manager {
+	struct worker *workers;
+	unsigned nworkers;
+	int pin, running;
+	volatile int stop;
+
+	struct member **members;
+	size_t nmembers;
+
+	struct watch **watches;
+	size_t nwatches;
+
+	/* Completion queue, a circular array.  There is always room
+	 * for the results of all one-shot requests not taken yet. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int eventfd;
+	struct cctalk_completion *queue;
+	size_t head, count, capacity, requests;
+
+	/* Poll completions dropped since the consumer last heard. */
+	unsigned lost;
+};
+
+static void on_request(struct cctalk_host *host,
+                       const struct cctalk_message *reply, void *arg);
+
+/* Signal an eventfd.  It can only fail when the counter is about
+ * to overflow, in which case it is readable already. */
+static void wake(int fd)
+{
+	uint64_t one = 1;
+	ssize_t res = write(fd, &one, sizeof(one));
+	(void)res;
+}
+
+/* Reset an eventfd.  Fails with EAGAIN when not signalled. */
+static void drain(int fd)
+{
+	uint64_t count;
+	ssize_t res = read(fd, &count, sizeof(count));
+	(void)res;
+}
+
+/* Make room for given number of completions, with the lock held. */
+static int reserve(struct cctalk_manager *mgr, size_t capacity)
+{
+	struct cctalk_completion *queue;
+	size_t i;
+
+	if (capacity <= mgr->capacity)
+		return 0;
+
+	if (capacity < 2 * mgr->capacity)
+		capacity = 2 * mgr->capacity;
+
+	if (NULL == (queue = malloc(capacity * sizeof(*queue))))
+		return -1;
+
+	for (i = 0; i < mgr->count; i++)
+		queue[i] = mgr->queue[(mgr->head + i) % mgr->capacity];
+
+	free(mgr->queue);
+	mgr->queue = queue;
+	mgr->capacity = capacity;
+	mgr->head = 0;
+	return 0;
+}
+
+struct cctalk_manager *cctalk_manager_new(unsigned threads, int pin)
+{
+	struct cctalk_manager *mgr = calloc(1, sizeof(*mgr));
+	pthread_condattr_t attr;
+	unsigned i;
+
+	if (0 == threads)
+		threads = 1;
+
+	mgr->nworkers = threads;
+	mgr->workers = calloc(threads, sizeof(*mgr->workers));
+	mgr->pin = pin;
+	mgr->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	pthread_mutex_init(&mgr->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&mgr->cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/* Without it, polls are reported lost. */
+	reserve(mgr, QUEUE_LIMIT);
+
+	for (i = 0; i < threads; i++) {
+		struct worker *worker = &mgr->workers[i];
+
+		worker->mgr = mgr;
+		worker->cpu = i;
+		worker->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		pthread_mutex_init(&worker->lock, NULL);
+	}
+
+	return mgr;
+}
+
+/* Complete one-shot requests the bus did not carry out with ECANCELED. */
+static void cancel_requests(struct cctalk_bus *bus)
+{
+	struct cctalk_bus_request **pos = &bus->requests;
+
+	while (NULL != *pos) {
+		struct cctalk_bus_request *req = *pos;
+
+		if (on_request != req->callback) {
+			pos = &req->next;
+			continue;
+		}
+
+		*pos = req->next;
+		errno = ECANCELED;
+		on_request(bus->host, NULL, req->arg);
+		free(req);
+	}
+
+	bus->requests_tail = pos;
+}
+
+void cctalk_manager_stop(struct cctalk_manager *mgr)
+{
+	size_t i;
+
+	mgr->stop = 1;
+
+	if (mgr->running) {
+
+		for (i = 0; i < mgr->nworkers; i++)
+			wake(mgr->workers[i].wakefd);
+
+		for (i = 0; i < mgr->nworkers; i++)
+			pthread_join(mgr->workers[i].thread, NULL);
+
+		mgr->running = 0;
+	}
+
+	for (i = 0; i < mgr->nworkers; i++) {
+		struct worker *worker = &mgr->workers[i];
+
+		pthread_mutex_lock(&worker->lock);
+
+		while (NULL != worker->pending) {
+			struct pending *req = worker->pending;
+			worker->pending = req->next;
+			errno = ECANCELED;
+			on_request(req->member->bus->host, NULL, req);
+		}
+
+		pthread_mutex_unlock(&worker->lock);
+	}
+
+	for (i = 0; i < mgr->nmembers; i++)
+		cancel_requests(mgr->members[i]->bus);
+}
+
+void cctalk_manager_free(struct cctalk_manager *mgr)
+{
+	size_t i;
+
+	if (NULL == mgr)
+		return;
+
+	cctalk_manager_stop(mgr);
+
+	for (i = 0; i < mgr->nworkers; i++) {
+		struct worker *worker = &mgr->workers[i];
+
+		pthread_mutex_destroy(&worker->lock);
+		close(worker->wakefd);
+		free(worker->members);
+	}
+
+	for (i = 0; i < mgr->nmembers; i++) {
+		struct cctalk_host *host = mgr->members[i]->bus->host;
+
+		cctalk_bus_free(mgr->members[i]->bus);
+		cctalk_host_free(host);
+		free(mgr->members[i]);
+	}
+
+	for (i = 0; i < mgr->nwatches; i++)
+		free(mgr->watches[i]);
+
+	pthread_cond_destroy(&mgr->cond);
+	pthread_mutex_destroy(&mgr->lock);
+	close(mgr->eventfd);
+
+	free(mgr->queue);
+	free(mgr->watches);
+	free(mgr->members);
+	free(mgr->workers);
+	free(mgr);
+}
+
+static struct member *find_member(const struct cctalk_manager *mgr,
+                                  const struct cctalk_bus *bus)
+{
+	size_t i;
+
+	for (i = 0; i < mgr->nmembers; i++)
+		if (mgr->members[i]->bus == bus)
+			return mgr->members[i];
+
+	errno = ENOENT;
+	return NULL;
+}
+
+/* Append pointer to a growing array. */
+static int append(void *array, size_t *count, void *item)
+{
+	void ***items = array;
+	void **grown = realloc(*items, (*count + 1) * sizeof(*grown));
+
+	if (NULL == grown)
+		return -1;
+
+	grown[(*count)++] = item;
+	*items = grown;
+	return 0;
+}
+
+int cctalk_manager_add(struct cctalk_manager *mgr, struct cctalk_bus *bus)
+{
+	struct member *member;
+	struct worker *worker;
+
+	if (mgr->running) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (NULL == (member = calloc(1, sizeof(*member))))
+		return -1;
+
+	worker = &mgr->workers[mgr->nmembers % mgr->nworkers];
+
+	member->mgr = mgr;
+	member->bus = bus;
+	member->worker = worker;
+
+	if (-1 == append(&worker->members, &worker->nmembers, member)) {
+		free(member);
+		return -1;
+	}
+
+	if (-1 == append(&mgr->members, &mgr->nmembers, member)) {
+		worker->nmembers--;
+		free(member);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Append completion to the queue and wake up the consumer.  Poll
+ * completions are dropped when the consumer falls behind, results of
+ * requests have their room reserved by cctalk_manager_submit(). */
+static void push_completion(struct cctalk_manager *mgr,
+                            const struct cctalk_completion *completion)
+{
+	pthread_mutex_lock(&mgr->lock);
+
+	if (NULL != completion->dev &&
+	    (mgr->count >= QUEUE_LIMIT || mgr->count == mgr->capacity)) {
+		if (0 == mgr->lost++ && 0 == mgr->count)
+			wake(mgr->eventfd);
+
+		pthread_cond_signal(&mgr->cond);
+		pthread_mutex_unlock(&mgr->lock);
+		return;
+	}
+
+	mgr->queue[(mgr->head + mgr->count++) % mgr->capacity] = *completion;
+
+	if (1 == mgr->count)
+		wake(mgr->eventfd);
+
+	pthread_cond_signal(&mgr->cond);
+	pthread_mutex_unlock(&mgr->lock);
+}
+
+static void fill_reply(struct cctalk_completion *completion,
+                       const struct cctalk_message *reply)
+{
+	if (NULL == reply) {
+		completion->status = -1;
+		completion->error = errno;
+		return;
+	}
+
+	completion->status = reply->header;
+	completion->length = reply->length;
+	memcpy(completion->data, reply->data, reply->length);
+}
+
+static void on_poll(struct cctalk_device *dev,
+                    const struct cctalk_message *reply, void *arg)
+{
+	struct watch *watch = arg;
+	struct cctalk_completion completion = {
+		.bus = watch->member->bus,
+		.dev = dev,
+		.destination = dev->id,
+		.method = watch->method,
+	};
+
+	fill_reply(&completion, reply);
+	push_completion(watch->member->mgr, &completion);
+}
+
+static void on_request(struct cctalk_host *host,
+                       const struct cctalk_message *reply, void *arg)
+{
+	struct pending *req = arg;
+	struct cctalk_completion completion = {
+		.bus = req->member->bus,
+		.tag = req->tag,
+		.destination = req->destination,
+		.method = req->method,
+	};
+
+	fill_reply(&completion, reply);
+	push_completion(req->member->mgr, &completion);
+	free(req);
+}
+
+int cctalk_manager_watch(struct cctalk_manager *mgr, struct cctalk_bus *bus,
+                         struct cctalk_device *dev,
+                         enum cctalk_method method)
+{
+	struct member *member;
+	struct watch *watch;
+
+	if (mgr->running) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	if (NULL == (member = find_member(mgr, bus)))
+		return -1;
+
+	if (NULL == (watch = calloc(1, sizeof(*watch))))
+		return -1;
+
+	watch->member = member;
+	watch->method = method;
+
+	if (-1 == append(&mgr->watches, &mgr->nwatches, watch)) {
+		free(watch);
+		return -1;
+	}
+
+	return cctalk_bus_add(bus, dev, method, on_poll, watch);
+}
+
+/* Hand requests submitted by other threads over to their buses. */
+static void take_pending(struct worker *worker)
+{
+	struct pending *list, *prev = NULL;
+
+	drain(worker->wakefd);
+
+	pthread_mutex_lock(&worker->lock);
+	list = worker->pending;
+	worker->pending = NULL;
+	pthread_mutex_unlock(&worker->lock);
+
+	/* Restore submission order. */
+	while (NULL != list) {
+		struct pending *next = list->next;
+		list->next = prev;
+		prev = list;
+		list = next;
+	}
+
+	for (list = prev; NULL != list; list = prev) {
+		prev = list->next;
+
+		if (-1 == cctalk_bus_submit(list->member->bus,
+		                            list->destination, list->method,
+		                            list->data, list->length,
+		                            on_request, list))
+			on_request(list->member->bus->host, NULL, list);
+	}
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *worker = arg;
+	struct pollfd pfds[worker->nmembers + 1];
+	size_t i;
+
+	pfds[0] = (struct pollfd){worker->wakefd, POLLIN, 0};
+
+	for (i = 0; i < worker->nmembers; i++)
+		pfds[i + 1].fd = worker->members[i]->bus->host->fd;
+
+	while (!worker->mgr->stop) {
+		int timeout = -1;
+
+		for (i = 0; i < worker->nmembers; i++) {
+			struct cctalk_bus *bus = worker->members[i]->bus;
+			int left = cctalk_bus_next_timeout(bus);
+
+			if (-1 == timeout || (left >= 0 && left < timeout))
+				timeout = left;
+
+			pfds[i + 1].events = cctalk_bus_events(bus);
+			pfds[i + 1].revents = 0;
+		}
+
+		if (-1 == poll(pfds, worker->nmembers + 1, timeout))
+			continue;
+
+		if (pfds[0].revents & POLLIN)
+			take_pending(worker);
+
+		for (i = 0; i < worker->nmembers; i++)
+			cctalk_bus_dispatch(worker->members[i]->bus,
+			                    pfds[i + 1].revents);
+	}
+
+	return NULL;
+}
+
+int cctalk_manager_start(struct cctalk_manager *mgr)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned i;
+
+	if (mgr->running || mgr->stop) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	for (i = 0; i < mgr->nworkers; i++) {
+		struct worker *worker = &mgr->workers[i];
+		pthread_attr_t attr;
+		int err;
+
+		pthread_attr_init(&attr);
+
+		if (mgr->pin && cpus > 0) {
+			cpu_set_t set;
+
+			CPU_ZERO(&set);
+			CPU_SET(worker->cpu % cpus, &set);
+			pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		}
+
+		err = pthread_create(&worker->thread, &attr, worker_main, worker);
+		pthread_attr_destroy(&attr);
+
+		if (0 != err) {
+			/* Stop the threads started so far. */
+			mgr->stop = 1;
+
+			while (i-- > 0) {
+				wake(mgr->workers[i].wakefd);
+				pthread_join(mgr->workers[i].thread, NULL);
+			}
+
+			mgr->stop = 0;
+			errno = err;
+			return -1;
+		}
+	}
+
+	mgr->running = 1;
+	return 0;
+}
+
+int cctalk_manager_submit(struct cctalk_manager *mgr, struct cctalk_bus *bus,
+                          uint8_t destination, enum cctalk_method method,
+                          const void *data, size_t length, void *tag)
+{
+	struct member *member;
+	struct pending *req;
+
+	if (length > sizeof(req->data)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (NULL == (member = find_member(mgr, bus)))
+		return -1;
+
+	if (NULL == (req = calloc(1, sizeof(*req))))
+		return -1;
+
+	pthread_mutex_lock(&mgr->lock);
+
+	if (-1 == reserve(mgr, QUEUE_LIMIT + mgr->requests + 1)) {
+		pthread_mutex_unlock(&mgr->lock);
+		free(req);
+		return -1;
+	}
+
+	mgr->requests++;
+	pthread_mutex_unlock(&mgr->lock);
+
+	req->member = member;
+	req->destination = destination;
+	req->method = method;
+	req->length = length;
+	req->tag = tag;
+
+	if (length > 0)
+		memcpy(req->data, data, length);
+
+	pthread_mutex_lock(&member->worker->lock);
+	req->next = member->worker->pending;
+	member->worker->pending = req;
+	pthread_mutex_unlock(&member->worker->lock);
+
+	wake(member->worker->wakefd);
+	return 0;
+}
+
+int cctalk_manager_fd(const struct cctalk_manager *mgr)
+{
+	return mgr->eventfd;
+}
+
+int cctalk_manager_wait(struct cctalk_manager *mgr,
+                        struct cctalk_completion *completion, int timeout)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000;
+
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&mgr->lock);
+
+	while (0 == mgr->count && 0 == mgr->lost) {
+		int err;
+
+		if (timeout < 0)
+			err = pthread_cond_wait(&mgr->cond, &mgr->lock);
+		else
+			err = pthread_cond_timedwait(&mgr->cond, &mgr->lock,
+			                             &deadline);
+
+		if (ETIMEDOUT == err) {
+			pthread_mutex_unlock(&mgr->lock);
+			return 0;
+		}
+	}
+
+	if (mgr->lost > 0) {
+		/* Tell the consumer it is too slow first. */
+		*completion = (struct cctalk_completion){
+			.status = -1,
+			.error = ENOBUFS,
+			.lost = mgr->lost,
+		};
+
+		mgr->lost = 0;
+	} else {
+		*completion = mgr->queue[mgr->head];
+		mgr->head = (mgr->head + 1) % mgr->capacity;
+		mgr->count--;
+
+		if (NULL == completion->dev)
+			mgr->requests--;
+	}
+
+	if (0 == mgr->count)
+		drain(mgr->eventfd);
+
+	pthread_mutex_unlock(&mgr->lock);
+	return 1;
+}
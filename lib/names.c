@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+
+#include <stddef.h>
+
+static const char *const method_names[256] = {
+	[CCTALK_METHOD_RESET_DEVICE] = "RESET_DEVICE",
+	[CCTALK_METHOD_REQUEST_COMMS_STATUS_VARIABLES] = "REQUEST_COMMS_STATUS_VARIABLES",
+	[CCTALK_METHOD_CLEAR_COMMS_STATUS_VARIABLES] = "CLEAR_COMMS_STATUS_VARIABLES",
+	[CCTALK_METHOD_REQUEST_COMMS_REVISION] = "REQUEST_COMMS_REVISION",
+	[CCTALK_METHOD_READ_BARCODE_DATA] = "READ_BARCODE_DATA",
+	[CCTALK_METHOD_REQUEST_INDEXED_HOPPER_DISPENSE_COUNT] = "REQUEST_INDEXED_HOPPER_DISPENSE_COUNT",
+	[CCTALK_METHOD_REQUEST_HOPPER_COIN_VALUE] = "REQUEST_HOPPER_COIN_VALUE",
+	[CCTALK_METHOD_EMERGENCY_STOP_VALUE] = "EMERGENCY_STOP_VALUE",
+	[CCTALK_METHOD_REQUEST_HOPPER_POLLING_VALUE] = "REQUEST_HOPPER_POLLING_VALUE",
+	[CCTALK_METHOD_DISPENSE_HOPPER_VALUE] = "DISPENSE_HOPPER_VALUE",
+	[CCTALK_METHOD_SET_ACCEPT_LIMIT] = "SET_ACCEPT_LIMIT",
+	[CCTALK_METHOD_STORE_ENCRYPTION_CODE] = "STORE_ENCRYPTION_CODE",
+	[CCTALK_METHOD_SWITCH_ENCRYPTION_CODE] = "SWITCH_ENCRYPTION_CODE",
+	[CCTALK_METHOD_FINISH_FIRMWARE_UPGRADE] = "FINISH_FIRMWARE_UPGRADE",
+	[CCTALK_METHOD_BEGIN_FIRMWARE_UPGRADE] = "BEGIN_FIRMWARE_UPGRADE",
+	[CCTALK_METHOD_UPLOAD_FIRMWARE] = "UPLOAD_FIRMWARE",
+	[CCTALK_METHOD_REQUEST_FIRMWARE_UPGRADE_CAPABILITY] = "REQUEST_FIRMWARE_UPGRADE_CAPABILITY",
+	[CCTALK_METHOD_FINISH_BILL_TABLE_UPGRADE] = "FINISH_BILL_TABLE_UPGRADE",
+	[CCTALK_METHOD_BEGIN_BILL_TABLE_UPGRADE] = "BEGIN_BILL_TABLE_UPGRADE",
+	[CCTALK_METHOD_UPLOAD_BILL_TABLES] = "UPLOAD_BILL_TABLES",
+	[CCTALK_METHOD_REQUEST_CURRENCY_REVISION] = "REQUEST_CURRENCY_REVISION",
+	[CCTALK_METHOD_OPERATE_BIDIRECTIONAL_MOTORS] = "OPERATE_BIDIRECTIONAL_MOTORS",
+	[CCTALK_METHOD_PERFORM_STACKER_CYCLE] = "PERFORM_STACKER_CYCLE",
+	[CCTALK_METHOD_READ_OPTO_VOLTAGES] = "READ_OPTO_VOLTAGES",
+	[CCTALK_METHOD_REQUEST_INDIVIDUAL_ERROR_COUNTER] = "REQUEST_INDIVIDUAL_ERROR_COUNTER",
+	[CCTALK_METHOD_REQUEST_INDIVIDUAL_ACCEPT_COUNTER] = "REQUEST_INDIVIDUAL_ACCEPT_COUNTER",
+	[CCTALK_METHOD_TEST_LAMPS] = "TEST_LAMPS",
+	[CCTALK_METHOD_REQUEST_BILL_OPERATING_MODE] = "REQUEST_BILL_OPERATING_MODE",
+	[CCTALK_METHOD_MODIFY_BILL_OPERATING_MODE] = "MODIFY_BILL_OPERATING_MODE",
+	[CCTALK_METHOD_ROUTE_BILL] = "ROUTE_BILL",
+	[CCTALK_METHOD_REQUEST_BILL_POSITION] = "REQUEST_BILL_POSITION",
+	[CCTALK_METHOD_REQUEST_COUNTRY_SCALING_FACTOR] = "REQUEST_COUNTRY_SCALING_FACTOR",
+	[CCTALK_METHOD_REQUEST_BILL_ID] = "REQUEST_BILL_ID",
+	[CCTALK_METHOD_MODIFY_BILL_ID] = "MODIFY_BILL_ID",
+	[CCTALK_METHOD_READ_BUFFERED_BILL_EVENTS] = "READ_BUFFERED_BILL_EVENTS",
+	[CCTALK_METHOD_REQUEST_CIPHER_KEY] = "REQUEST_CIPHER_KEY",
+	[CCTALK_METHOD_PUMP_RNG] = "PUMP_RNG",
+	[CCTALK_METHOD_MODIFY_INHIBIT_AND_OVERRIDE_REGISTERS] = "MODIFY_INHIBIT_AND_OVERRIDE_REGISTERS",
+	[CCTALK_METHOD_TEST_HOPPER] = "TEST_HOPPER",
+	[CCTALK_METHOD_ENABLE_HOPPER] = "ENABLE_HOPPER",
+	[CCTALK_METHOD_MODIFY_VARIABLE_SET] = "MODIFY_VARIABLE_SET",
+	[CCTALK_METHOD_REQUEST_HOPPER_STATUS] = "REQUEST_HOPPER_STATUS",
+	[CCTALK_METHOD_DISPENSE_HOPPER_COINS] = "DISPENSE_HOPPER_COINS",
+	[CCTALK_METHOD_REQUEST_HOPPER_DISPENSE_COUNT] = "REQUEST_HOPPER_DISPENSE_COUNT",
+	[CCTALK_METHOD_REQUEST_ADDRESS_MODE] = "REQUEST_ADDRESS_MODE",
+	[CCTALK_METHOD_REQUEST_BASE_YEAR] = "REQUEST_BASE_YEAR",
+	[CCTALK_METHOD_REQUEST_HOPPER_COIN] = "REQUEST_HOPPER_COIN",
+	[CCTALK_METHOD_EMERGENCY_STOP] = "EMERGENCY_STOP",
+	[CCTALK_METHOD_REQUEST_THERMISTOR_READING] = "REQUEST_THERMISTOR_READING",
+	[CCTALK_METHOD_REQUEST_PAYOUT_FLOAT] = "REQUEST_PAYOUT_FLOAT",
+	[CCTALK_METHOD_MODIFY_PAYOUT_FLOAT] = "MODIFY_PAYOUT_FLOAT",
+	[CCTALK_METHOD_REQUEST_ALARM_COUNTER] = "REQUEST_ALARM_COUNTER",
+	[CCTALK_METHOD_HANDHELD_FUNCTION] = "HANDHELD_FUNCTION",
+	[CCTALK_METHOD_REQUEST_BANK_SELECT] = "REQUEST_BANK_SELECT",
+	[CCTALK_METHOD_MODIFY_BANK_SELECT] = "MODIFY_BANK_SELECT",
+	[CCTALK_METHOD_REQUEST_SECURITY_SETTING] = "REQUEST_SECURITY_SETTING",
+	[CCTALK_METHOD_MODIFY_SECURITY_SETTING] = "MODIFY_SECURITY_SETTING",
+	[CCTALK_METHOD_DOWNLOAD_CALIBRATION_INFO] = "DOWNLOAD_CALIBRATION_INFO",
+	[CCTALK_METHOD_UPLOAD_WINDOW_DATA] = "UPLOAD_WINDOW_DATA",
+	[CCTALK_METHOD_REQUEST_COIN_ID] = "REQUEST_COIN_ID",
+	[CCTALK_METHOD_MODIFY_COIN_ID] = "MODIFY_COIN_ID",
+	[CCTALK_METHOD_REQUEST_PAYOUT_CAPACITY] = "REQUEST_PAYOUT_CAPACITY",
+	[CCTALK_METHOD_MODIFY_PAYOUT_CAPACITY] = "MODIFY_PAYOUT_CAPACITY",
+	[CCTALK_METHOD_REQUEST_DEFAULT_SORTER_PATH] = "REQUEST_DEFAULT_SORTER_PATH",
+	[CCTALK_METHOD_MODIFY_DEFAULT_SORTER_PATH] = "MODIFY_DEFAULT_SORTER_PATH",
+	[CCTALK_METHOD_REQUEST_PAYOUT_STATUS] = "REQUEST_PAYOUT_STATUS",
+	[CCTALK_METHOD_KEYPAD_CONTROL] = "KEYPAD_CONTROL",
+	[CCTALK_METHOD_REQUEST_BUILD_CODE] = "REQUEST_BUILD_CODE",
+	[CCTALK_METHOD_REQUEST_FRAUD_COUNTER] = "REQUEST_FRAUD_COUNTER",
+	[CCTALK_METHOD_REQUEST_REJECT_COUNTER] = "REQUEST_REJECT_COUNTER",
+	[CCTALK_METHOD_REQUEST_LAST_MODIFICATION_DATE] = "REQUEST_LAST_MODIFICATION_DATE",
+	[CCTALK_METHOD_REQUEST_CREATION_DATE] = "REQUEST_CREATION_DATE",
+	[CCTALK_METHOD_CALCULATE_ROM_CHECKSUM] = "CALCULATE_ROM_CHECKSUM",
+	[CCTALK_METHOD_COUNTERS_TO_EEPROM] = "COUNTERS_TO_EEPROM",
+	[CCTALK_METHOD_CONFIGURATION_TO_EEPROM] = "CONFIGURATION_TO_EEPROM",
+	[CCTALK_METHOD_UPLOAD_COIN_DATA] = "UPLOAD_COIN_DATA",
+	[CCTALK_METHOD_REQUEST_TEACH_STATUS] = "REQUEST_TEACH_STATUS",
+	[CCTALK_METHOD_TEACH_MODE_CONTROL] = "TEACH_MODE_CONTROL",
+	[CCTALK_METHOD_DISPLAY_CONTROL] = "DISPLAY_CONTROL",
+	[CCTALK_METHOD_METER_CONTROL] = "METER_CONTROL",
+	[CCTALK_METHOD_REQUEST_AUDIT_INFORMATION_BLOCK] = "REQUEST_AUDIT_INFORMATION_BLOCK",
+	[CCTALK_METHOD_EMPTY_PAYOUT] = "EMPTY_PAYOUT",
+	[CCTALK_METHOD_REQUEST_PAYOUT_ABSOLUTE_COUNT] = "REQUEST_PAYOUT_ABSOLUTE_COUNT",
+	[CCTALK_METHOD_MODIFY_PAYOUT_ABSOLUTE_COUNT] = "MODIFY_PAYOUT_ABSOLUTE_COUNT",
+	[CCTALK_METHOD_REQUEST_SORTER_PATHS] = "REQUEST_SORTER_PATHS",
+	[CCTALK_METHOD_MODIFY_SORTER_PATHS] = "MODIFY_SORTER_PATHS",
+	[CCTALK_METHOD_POWER_MANAGEMENT_CONTROL] = "POWER_MANAGEMENT_CONTROL",
+	[CCTALK_METHOD_REQUEST_COIN_POSITION] = "REQUEST_COIN_POSITION",
+	[CCTALK_METHOD_REQUEST_OPTION_FLAGS] = "REQUEST_OPTION_FLAGS",
+	[CCTALK_METHOD_WRITE_DATA_BLOCK] = "WRITE_DATA_BLOCK",
+	[CCTALK_METHOD_READ_DATA_BLOCK] = "READ_DATA_BLOCK",
+	[CCTALK_METHOD_REQUEST_DATA_STORAGE_AVAILABILITY] = "REQUEST_DATA_STORAGE_AVAILABILITY",
+	[CCTALK_METHOD_REQUEST_PAYOUT_HIGH_LOW_STATUS] = "REQUEST_PAYOUT_HIGH_LOW_STATUS",
+	[CCTALK_METHOD_ENTER_PIN_NUMBER] = "ENTER_PIN_NUMBER",
+	[CCTALK_METHOD_ENTER_NEW_PIN_NUMBER] = "ENTER_NEW_PIN_NUMBER",
+	[CCTALK_METHOD_ONE_SHOT_CREDIT] = "ONE_SHOT_CREDIT",
+	[CCTALK_METHOD_REQUEST_SORTER_OVERRIDE_STATUS] = "REQUEST_SORTER_OVERRIDE_STATUS",
+	[CCTALK_METHOD_MODIFY_SORTER_OVERRIDE_STATUS] = "MODIFY_SORTER_OVERRIDE_STATUS",
+	[CCTALK_METHOD_DISPENSE_CHANGE] = "DISPENSE_CHANGE",
+	[CCTALK_METHOD_DISPENSE_COINS] = "DISPENSE_COINS",
+	[CCTALK_METHOD_REQUEST_ACCEPT_COUNTER] = "REQUEST_ACCEPT_COUNTER",
+	[CCTALK_METHOD_REQUEST_INSERTION_COUNTER] = "REQUEST_INSERTION_COUNTER",
+	[CCTALK_METHOD_REQUEST_MASTER_INHIBIT_STATUS] = "REQUEST_MASTER_INHIBIT_STATUS",
+	[CCTALK_METHOD_MODIFY_MASTER_INHIBIT_STATUS] = "MODIFY_MASTER_INHIBIT_STATUS",
+	[CCTALK_METHOD_READ_BUFFERED_CREDIT_OR_ERROR_CODES] = "READ_BUFFERED_CREDIT_OR_ERROR_CODES",
+	[CCTALK_METHOD_REQUEST_INHIBIT_STATUS] = "REQUEST_INHIBIT_STATUS",
+	[CCTALK_METHOD_MODIFY_INHIBIT_STATUS] = "MODIFY_INHIBIT_STATUS",
+	[CCTALK_METHOD_PERFORM_SELF_CHECK] = "PERFORM_SELF_CHECK",
+	[CCTALK_METHOD_LATCH_OUTPUT_LINES] = "LATCH_OUTPUT_LINES",
+	[CCTALK_METHOD_ISSUE_GUARD_CODE] = "ISSUE_GUARD_CODE",
+	[CCTALK_METHOD_READ_LAST_CREDIT_OR_ERROR_CODE] = "READ_LAST_CREDIT_OR_ERROR_CODE",
+	[CCTALK_METHOD_READ_OPTO_STATES] = "READ_OPTO_STATES",
+	[CCTALK_METHOD_READ_INPUT_LINES] = "READ_INPUT_LINES",
+	[CCTALK_METHOD_TEST_OUTPUT_LINES] = "TEST_OUTPUT_LINES",
+	[CCTALK_METHOD_OPERATE_MOTORS] = "OPERATE_MOTORS",
+	[CCTALK_METHOD_TEST_SOLENOIDS] = "TEST_SOLENOIDS",
+	[CCTALK_METHOD_REQUEST_SOFTWARE_REVISION] = "REQUEST_SOFTWARE_REVISION",
+	[CCTALK_METHOD_REQUEST_SERIAL_NUMBER] = "REQUEST_SERIAL_NUMBER",
+	[CCTALK_METHOD_REQUEST_DATABASE_VERSION] = "REQUEST_DATABASE_VERSION",
+	[CCTALK_METHOD_REQUEST_PRODUCT_CODE] = "REQUEST_PRODUCT_CODE",
+	[CCTALK_METHOD_REQUEST_EQUIPMENT_CATEGORY_ID] = "REQUEST_EQUIPMENT_CATEGORY_ID",
+	[CCTALK_METHOD_REQUEST_MANUFACTURER_ID] = "REQUEST_MANUFACTURER_ID",
+	[CCTALK_METHOD_REQUEST_VARIABLE_SET] = "REQUEST_VARIABLE_SET",
+	[CCTALK_METHOD_REQUEST_STATUS] = "REQUEST_STATUS",
+	[CCTALK_METHOD_REQUEST_POLLING_PRIORITY] = "REQUEST_POLLING_PRIORITY",
+	[CCTALK_METHOD_ADDRESS_RANDOM] = "ADDRESS_RANDOM",
+	[CCTALK_METHOD_ADDRESS_CHANGE] = "ADDRESS_CHANGE",
+	[CCTALK_METHOD_ADDRESS_CLASH] = "ADDRESS_CLASH",
+	[CCTALK_METHOD_ADDRESS_POLL] = "ADDRESS_POLL",
+	[CCTALK_METHOD_SIMPLE_POLL] = "SIMPLE_POLL",
+	[CCTALK_METHOD_FACTORY_SETUP_AND_RESET] = "FACTORY_SETUP_AND_RESET",
+};
+
+const char *cctalk_method_name(enum cctalk_method method)
+{
+	if ((unsigned)method >= sizeof(method_names) / sizeof(*method_names))
+		return NULL;
+
+	return method_names[method];
+}
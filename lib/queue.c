@@ -0,0 +1,348 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+/* Index of the lanes. */
+#define LANE_NORMAL 0
+#define LANE_URGENT 1
+
+/*
+ * The lanes are intrusive multiple producer, single consumer queues
+ * after Dmitry Vyukov.  Producers swap the head and then link the
+ * previous head to the new request, the consumer follows the links
+ * from the tail.  The stub keeps the list from ever becoming empty.
+ */
+
+static void lane_init(struct cctalk_lane *lane)
+{
+	lane->stub = calloc(1, sizeof(*lane->stub));
+	lane->head = lane->tail = lane->stub;
+}
+
+static void lane_push(struct cctalk_lane *lane, struct cctalk_request *req)
+{
+	struct cctalk_request *prev;
+
+	__atomic_store_n(&req->next, NULL, __ATOMIC_RELAXED);
+	prev = __atomic_exchange_n(&lane->head, req, __ATOMIC_ACQ_REL);
+	__atomic_store_n(&prev->next, req, __ATOMIC_RELEASE);
+}
+
+/* Take the oldest request or NULL.  Returns NULL as well while
+ * a producer is halfway through linking its request. */
+static struct cctalk_request *lane_pop(struct cctalk_lane *lane)
+{
+	struct cctalk_request *tail = lane->tail, *next;
+
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (tail == lane->stub) {
+		if (NULL == next)
+			return NULL;
+
+		lane->tail = tail = next;
+		next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+	}
+
+	if (NULL != next) {
+		lane->tail = next;
+		return tail;
+	}
+
+	if (tail != __atomic_load_n(&lane->head, __ATOMIC_ACQUIRE))
+		return NULL;
+
+	/* Last one, put the stub behind it so that it can go. */
+	lane_push(lane, lane->stub);
+	next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+	if (NULL != next) {
+		lane->tail = next;
+		return tail;
+	}
+
+	return NULL;
+}
+
+static int lane_empty(struct cctalk_lane *lane)
+{
+	return lane->tail == lane->stub &&
+	       lane->stub == __atomic_load_n(&lane->head, __ATOMIC_SEQ_CST);
+}
+
+struct cctalk_queue *cctalk_queue_new(struct cctalk_bus *bus)
+{
+	struct cctalk_queue *queue;
+	int fd;
+
+	if (-1 == (fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)))
+		return NULL;
+
+	if (0 != posix_memalign((void **)&queue, 64, sizeof(*queue))) {
+		close(fd);
+		return NULL;
+	}
+
+	memset(queue, 0, sizeof(*queue));
+	queue->bus = bus;
+	queue->fd = fd;
+	lane_init(&queue->lanes[LANE_NORMAL]);
+	lane_init(&queue->lanes[LANE_URGENT]);
+
+	return queue;
+}
+
+static void on_reply(struct cctalk_host *host,
+                     const struct cctalk_message *reply, void *arg);
+
+static void complete(struct cctalk_request *req)
+{
+	cctalk_request_cb callback = req->callback;
+
+	__atomic_store_n(&req->done, 1, __ATOMIC_RELEASE);
+
+	/* The waiter owns the request again once the semaphore is
+	 * posted, it must not be touched afterwards. */
+	if (NULL != callback)
+		callback(req, req->arg);
+	else
+		sem_post(&req->sem);
+}
+
+/* Fail our requests waiting on the bus, except one in progress. */
+static void cancel_requests(struct cctalk_bus *bus)
+{
+	struct cctalk_bus_request **pos = &bus->requests;
+
+	if (NULL != *pos && -1 == bus->current &&
+	    CCTALK_HOST_IDLE != bus->host->state)
+		pos = &(*pos)->next;
+
+	while (NULL != *pos) {
+		struct cctalk_bus_request *req = *pos;
+
+		if (on_reply != req->callback) {
+			pos = &req->next;
+			continue;
+		}
+
+		*pos = req->next;
+		errno = ECANCELED;
+		on_reply(bus->host, NULL, req->arg);
+		free(req);
+	}
+
+	bus->requests_tail = pos;
+}
+
+void cctalk_queue_free(struct cctalk_queue *queue)
+{
+	struct cctalk_request *req;
+	int i;
+
+	if (NULL == queue)
+		return;
+
+	cancel_requests(queue->bus);
+
+	for (i = 0; i < 2; i++) {
+		while (NULL != (req = lane_pop(&queue->lanes[i]))) {
+			req->status = -1;
+			req->error = ECANCELED;
+			complete(req);
+		}
+
+		free(queue->lanes[i].stub);
+	}
+
+	close(queue->fd);
+	free(queue);
+}
+
+int cctalk_request_init(struct cctalk_request *req, uint8_t destination,
+                        enum cctalk_method method, const void *data,
+                        size_t length)
+{
+	if (length > sizeof(req->data)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(req, 0, sizeof(*req));
+	req->destination = destination;
+	req->method = method;
+	req->length = length;
+
+	if (length > 0)
+		memcpy(req->data, data, length);
+
+	return sem_init(&req->sem, 0, 0);
+}
+
+void cctalk_request_destroy(struct cctalk_request *req)
+{
+	sem_destroy(&req->sem);
+}
+
+static void submit(struct cctalk_queue *queue, struct cctalk_request *req,
+                   int lane)
+{
+	lane_push(&queue->lanes[lane], req);
+
+	/* Only pay for the wakeup when the owner actually sleeps. */
+	if (__atomic_exchange_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST)) {
+		uint64_t one = 1;
+
+		if (-1 == write(queue->fd, &one, sizeof(one)))
+			return;
+	}
+}
+
+/* Methods that must not wait behind routine traffic. */
+static int is_urgent(enum cctalk_method method)
+{
+	return CCTALK_METHOD_EMERGENCY_STOP == method ||
+	       CCTALK_METHOD_MODIFY_MASTER_INHIBIT_STATUS == method ||
+	       CCTALK_METHOD_MODIFY_INHIBIT_STATUS == method;
+}
+
+void cctalk_queue_submit(struct cctalk_queue *queue,
+                         struct cctalk_request *req)
+{
+	submit(queue, req, is_urgent(req->method) ? LANE_URGENT : LANE_NORMAL);
+}
+
+void cctalk_queue_submit_urgent(struct cctalk_queue *queue,
+                                struct cctalk_request *req)
+{
+	submit(queue, req, LANE_URGENT);
+}
+
+int cctalk_request_wait(struct cctalk_request *req)
+{
+	/* Only the post hands the request back, not the done flag. */
+	while (-1 == sem_wait(&req->sem))
+		if (EINTR != errno)
+			return -1;
+
+	if (-1 == req->status)
+		errno = req->error;
+
+	return req->status;
+}
+
+int cctalk_queue_fd(const struct cctalk_queue *queue)
+{
+	return queue->fd;
+}
+
+static void on_reply(struct cctalk_host *host,
+                     const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_request *req = arg;
+
+	if (NULL == reply) {
+		req->status = -1;
+		req->error = errno;
+	} else {
+		req->status = reply->header;
+		req->reply_length = reply->length;
+		memcpy(req->reply, reply->data, reply->length);
+	}
+
+	complete(req);
+}
+
+void cctalk_queue_dispatch(struct cctalk_queue *queue)
+{
+	struct cctalk_request *req;
+	uint64_t count;
+	int i, result;
+
+	if (-1 == read(queue->fd, &count, sizeof(count)) && EAGAIN != errno)
+		return;
+
+	for (i = LANE_URGENT; i >= LANE_NORMAL; i--) {
+		while (NULL != (req = lane_pop(&queue->lanes[i]))) {
+			if (LANE_URGENT == i)
+				result = cctalk_bus_submit_urgent(queue->bus,
+				                                  req->destination,
+				                                  req->method,
+				                                  req->data,
+				                                  req->length,
+				                                  on_reply, req);
+			else
+				result = cctalk_bus_submit(queue->bus,
+				                           req->destination,
+				                           req->method, req->data,
+				                           req->length, on_reply,
+				                           req);
+
+			if (-1 == result) {
+				req->status = -1;
+				req->error = errno;
+				complete(req);
+			}
+		}
+	}
+}
+
+int cctalk_queue_run(struct cctalk_queue *queue, int duration,
+                     volatile int *stop)
+{
+	int64_t end = monotonic_ms() + duration;
+	struct pollfd pfd[2] = {
+		{queue->bus->host->fd, 0, 0},
+		{queue->fd, POLLIN, 0},
+	};
+	int64_t left;
+
+	while ((NULL == stop || !*stop) &&
+	       (left = end - monotonic_ms()) > 0) {
+		int timeout = cctalk_bus_next_timeout(queue->bus);
+
+		if (-1 == timeout || timeout > left)
+			timeout = left;
+
+		/* Announce the sleep first, then look for stragglers. */
+		__atomic_store_n(&queue->sleeping, 1, __ATOMIC_SEQ_CST);
+
+		if (!lane_empty(&queue->lanes[LANE_NORMAL]) ||
+		    !lane_empty(&queue->lanes[LANE_URGENT]))
+			timeout = 0;
+
+		pfd[0].events = cctalk_bus_events(queue->bus);
+		pfd[0].revents = pfd[1].revents = 0;
+
+		if (-1 == poll(pfd, 2, timeout) && EINTR != errno)
+			return -1;
+
+		__atomic_store_n(&queue->sleeping, 0, __ATOMIC_SEQ_CST);
+
+		cctalk_queue_dispatch(queue);
+		cctalk_bus_dispatch(queue->bus, pfd[0].revents);
+	}
+
+	return 0;
+}
@@ -2,6 +2,8 @@
 
 lib += libcctalk.so.0
 
-libcctalk.so.0 = -Wl,-h,libcctalk.so.0 util.c host.c device.c
+libcctalk.so.0 = -Wl,-h,libcctalk.so.0 -pthread \
+                 util.c names.c capture.c board.c transport.c host.c device.c \
+                 events.c bus.c queue.c bill.c hopper.c manager.c
 
 # EOF
@@ -1,8 +1,16 @@
 #!/usr/bin/make -f
 
-tests = t-link
+tests = t-link t-host t-device t-events t-capture t-board t-daemon \
+        t-manager
 
 $(foreach t,${tests},$(eval ${t} = ../libcctalk.so ${t}.c cutest.h))
 check += ${tests}
 
+t-device += ../../src/sim.c ../../src/sim.h -pthread
+t-events += -pthread
+t-board += -pthread
+t-daemon += ../../src/server.c ../../src/server.h \
+            ../../src/sim.c ../../src/sim.h -pthread
+t-manager += ../../src/sim.c ../../src/sim.h -pthread
+
 # EOF
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cutest.h"
+#include "cctalk.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Number of states published by the stress test. */
+#define STRESS_STATES 200000
+
+static char path[] = "/tmp/t-board-XXXXXX";
+
+static struct cctalk_board *open_board(void)
+{
+	int fd;
+
+	if (-1 == (fd = mkstemp(path)))
+		skip_test();
+
+	close(fd);
+	return cctalk_board_open(path);
+}
+
+decl_test(publish)
+{
+	struct cctalk_board *board = open_board(), *reader;
+	struct cctalk_board_state state = {.online = 1, .polls = 42};
+
+	assert(NULL != board);
+	assert(NULL != (reader = cctalk_board_map(path)));
+
+	assert(-1 == cctalk_board_read(reader, 2, &state));
+	assert(ENOENT == errno);
+	assert(1 == state.online);
+
+	cctalk_board_publish(board, 2, &state);
+	memset(&state, 0, sizeof(state));
+
+	assert(0 == cctalk_board_read(reader, 2, &state));
+	assert(1 == state.online && 42 == state.polls);
+	assert(-1 == cctalk_board_read(reader, 3, &state));
+
+	cctalk_board_close(reader);
+	cctalk_board_close(board);
+	unlink(path);
+}
+
+static void *publisher(void *arg)
+{
+	struct cctalk_board_state state = {0};
+	uint64_t i;
+
+	for (i = 1; i <= STRESS_STATES; i++) {
+		state.polls = state.errors = i;
+		state.updated = state.seen = i;
+		cctalk_board_publish(arg, 7, &state);
+	}
+
+	return NULL;
+}
+
+decl_test(consistent)
+{
+	struct cctalk_board *board = open_board(), *reader;
+	struct cctalk_board_state state = {0};
+	pthread_t thread;
+
+	assert(NULL != board);
+	assert(NULL != (reader = cctalk_board_map(path)));
+
+	pthread_create(&thread, NULL, publisher, board);
+
+	do {
+		if (-1 == cctalk_board_read(reader, 7, &state))
+			continue;
+
+		/* Never a mix of two states. */
+		assert(state.polls == state.errors);
+		assert(state.polls == (uint64_t)state.updated);
+		assert(state.polls == (uint64_t)state.seen);
+	} while (state.polls < STRESS_STATES);
+
+	pthread_join(thread, NULL);
+	cctalk_board_close(reader);
+	cctalk_board_close(board);
+	unlink(path);
+}
+
+static volatile int reading;
+
+static void *reader_main(void *arg)
+{
+	struct cctalk_board_state state;
+
+	while (reading)
+		cctalk_board_read(arg, 7, &state);
+
+	return NULL;
+}
+
+decl_test(reopen)
+{
+	struct cctalk_board *board = open_board(), *reader;
+	struct cctalk_board_state state = {.polls = 1};
+	pthread_t thread;
+	int i;
+
+	assert(NULL != board);
+	assert(NULL != (reader = cctalk_board_map(path)));
+
+	reading = 1;
+	pthread_create(&thread, NULL, reader_main, reader);
+
+	/* Restarting publisher must not pull the file from under readers. */
+	for (i = 0; i < 1000; i++) {
+		cctalk_board_publish(board, 7, &state);
+		cctalk_board_close(board);
+		assert(NULL != (board = cctalk_board_open(path)));
+	}
+
+	reading = 0;
+	pthread_join(thread, NULL);
+
+	assert(-1 == cctalk_board_read(reader, 7, &state));
+	assert(ENOENT == errno);
+
+	cctalk_board_publish(board, 7, &state);
+	assert(0 == cctalk_board_read(reader, 7, &state));
+	assert(1 == state.polls);
+
+	cctalk_board_close(reader);
+	cctalk_board_close(board);
+	unlink(path);
+}
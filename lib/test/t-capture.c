@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cutest.h"
+#include "cctalk.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static char path[] = "/tmp/t-capture-XXXXXX";
+
+static struct cctalk_capture *open_capture(size_t size)
+{
+	int fd;
+
+	if (-1 == (fd = mkstemp(path)))
+		skip_test();
+
+	close(fd);
+	return cctalk_capture_open(path, size);
+}
+
+/* Walk the whole ring, checking the records are numbered in order. */
+static int count_records(struct cctalk_capture *cap, uint8_t *last)
+{
+	const struct cctalk_capture_header *hdr = cctalk_capture_header(cap);
+	const struct cctalk_capture_record *rec;
+	uint64_t offset = hdr->tail;
+	int count = 0;
+
+	while (NULL != (rec = cctalk_capture_next(cap, &offset))) {
+		assert(CCTALK_CAPTURE_TX == rec->type);
+		assert(0 == count || (uint8_t)(*last + 1) == rec->data[0]);
+		*last = rec->data[0];
+		count++;
+	}
+
+	assert(offset == hdr->head);
+	return count;
+}
+
+decl_test(wrap)
+{
+	struct cctalk_capture *cap = open_capture(CCTALK_CAPTURE_MIN_SIZE);
+	uint8_t frame[37] = {0}, last = 0;
+	int i, count;
+
+	assert(NULL != cap);
+
+	for (i = 0; i < 1000; i++) {
+		frame[0] = i;
+		cctalk_capture_write(cap, CCTALK_CAPTURE_TX, 0, frame,
+		                     i % 2 ? sizeof(frame) : 5);
+	}
+
+	assert(1000 == cctalk_capture_header(cap)->records);
+	count = count_records(cap, &last);
+	assert(count > 50 && count < 1000);
+	assert((uint8_t)999 == last);
+	cctalk_capture_close(cap);
+
+	/* Records survive reopening, for reading as well as writing. */
+	assert(NULL != (cap = cctalk_capture_map(path)));
+	assert(count == count_records(cap, &last));
+	cctalk_capture_close(cap);
+
+	assert(NULL != (cap = cctalk_capture_open(path, CCTALK_CAPTURE_MIN_SIZE)));
+	frame[0] = (uint8_t)1000;
+	cctalk_capture_write(cap, CCTALK_CAPTURE_TX, 0, frame, 5);
+	assert(count <= count_records(cap, &last));
+	assert((uint8_t)1000 == last);
+	cctalk_capture_close(cap);
+
+	unlink(path);
+}
+
+decl_test(damaged)
+{
+	struct cctalk_capture *cap = open_capture(CCTALK_CAPTURE_MIN_SIZE);
+	uint8_t frame[37] = {0}, last = 0;
+	uint32_t zero = 0;
+	uint64_t tail;
+	int i, fd;
+
+	assert(NULL != cap);
+
+	for (i = 0; i < 200; i++) {
+		frame[0] = i;
+		cctalk_capture_write(cap, CCTALK_CAPTURE_TX, 0, frame, 37);
+	}
+
+	tail = cctalk_capture_header(cap)->tail % CCTALK_CAPTURE_MIN_SIZE;
+	cctalk_capture_close(cap);
+
+	/* Zero length of the oldest record, as if torn by a power loss. */
+	assert(-1 != (fd = open(path, O_RDWR)));
+	assert(4 == pwrite(fd, &zero, 4,
+	                   sizeof(struct cctalk_capture_header) + tail));
+	close(fd);
+
+	/* Writing must neither hang nor leave the ring. */
+	assert(NULL != (cap = cctalk_capture_open(path, CCTALK_CAPTURE_MIN_SIZE)));
+
+	for (i = 0; i < 200; i++) {
+		frame[0] = i;
+		cctalk_capture_write(cap, CCTALK_CAPTURE_TX, 0, frame, 37);
+	}
+
+	assert(count_records(cap, &last) > 0);
+	assert((uint8_t)199 == last);
+	cctalk_capture_close(cap);
+
+	unlink(path);
+}
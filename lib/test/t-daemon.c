@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cutest.h"
+#include "../../src/server.h"
+#include "../../src/sim.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static struct sim *sim;
+static pthread_t sim_thread;
+static volatile int sim_stop;
+
+static struct server *server;
+static pthread_t server_thread;
+static volatile int server_stop;
+static char socket_path[64];
+
+static void *sim_main(void *arg)
+{
+	sim_run(sim, &sim_stop);
+	return NULL;
+}
+
+static void *server_main(void *arg)
+{
+	server_run(server, &server_stop);
+	return NULL;
+}
+
+/* Start simulated acceptor and the daemon on its line. */
+static void start_daemon(int poll_coins)
+{
+	struct server_line *line;
+	char path[256];
+
+	if (NULL == (sim = sim_new(path, sizeof(path))))
+		skip_test();
+
+	sim_add(sim, SIM_ACCEPTOR, 2);
+	pthread_create(&sim_thread, NULL, sim_main, NULL);
+
+	server = server_new();
+	server->timeout = 200;
+	line = server_add_line(server, path);
+
+	if (poll_coins)
+		line->coins[line->ncoins++] = 2;
+
+	snprintf(socket_path, sizeof(socket_path), "/tmp/t-daemon-%i.sock",
+	         (int)getpid());
+
+	server_open(server);
+	server_listen(server, socket_path);
+	pthread_create(&server_thread, NULL, server_main, NULL);
+}
+
+static void stop_daemon(void)
+{
+	server_stop = 1;
+	pthread_join(server_thread, NULL);
+	sim_stop = 1;
+	pthread_join(sim_thread, NULL);
+}
+
+static int connect_client(void)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int fd;
+
+	strcpy(addr.sun_path, socket_path);
+	assert(-1 != (fd = socket(AF_UNIX, SOCK_STREAM, 0)));
+	assert(0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr)));
+	return fd;
+}
+
+static void send_header(int fd, uint8_t type, uint16_t tag, uint8_t address,
+                        uint8_t header)
+{
+	struct cctalkd_header hdr = {
+		.type = type,
+		.tag = tag,
+		.address = address,
+		.header = header,
+	};
+
+	assert(sizeof(hdr) == write(fd, &hdr, sizeof(hdr)));
+}
+
+/* Wait for the next message, returns 0 on timeout. */
+static int recv_message(int fd, struct cctalkd_header *hdr, void *data,
+                        int timeout)
+{
+	struct pollfd pfd = {fd, POLLIN, 0};
+
+	if (0 == poll(&pfd, 1, timeout))
+		return 0;
+
+	assert(sizeof(*hdr) == read(fd, hdr, sizeof(*hdr)));
+	assert(hdr->length == read(fd, data, hdr->length));
+	return 1;
+}
+
+decl_test(coalesce)
+{
+	struct cctalkd_header hdr;
+	uint8_t data[2][255];
+	uint64_t frames;
+	int a, b;
+
+	start_daemon(0);
+	a = connect_client();
+	b = connect_client();
+
+	/* Second request arrives while the first one is on the bus. */
+	sim->latency = 50000;
+	frames = sim->frames;
+
+	send_header(a, CCTALKD_REQUEST, 1, 2,
+	            CCTALK_METHOD_REQUEST_SERIAL_NUMBER);
+	send_header(b, CCTALKD_REQUEST, 7, 2,
+	            CCTALK_METHOD_REQUEST_SERIAL_NUMBER);
+
+	assert(recv_message(a, &hdr, data[0], 1000));
+	assert(CCTALKD_REPLY == hdr.type && 1 == hdr.tag);
+	assert(0 == hdr.error && 3 == hdr.length);
+
+	assert(recv_message(b, &hdr, data[1], 1000));
+	assert(CCTALKD_REPLY == hdr.type && 7 == hdr.tag);
+	assert(0 == hdr.error && 3 == hdr.length);
+	assert(0 == memcmp(data[0], data[1], 3));
+
+	stop_daemon();
+	assert(1 == sim->frames - frames);
+	assert(1 == server->transactions);
+	assert(1 == server->coalesced);
+
+	close(a);
+	close(b);
+	server_free(server);
+	sim_free(sim);
+}
+
+decl_test(subscribe)
+{
+	struct cctalkd_event ev;
+	struct cctalkd_header hdr;
+	int a, b;
+
+	start_daemon(1);
+	a = connect_client();
+	b = connect_client();
+
+	send_header(a, CCTALKD_SUBSCRIBE, 1, 2, 0);
+	send_header(b, CCTALKD_SUBSCRIBE, 1, 3, 0);
+	assert(recv_message(a, &hdr, &ev, 1000));
+	assert(CCTALKD_REPLY == hdr.type && 0 == hdr.error);
+	assert(recv_message(b, &hdr, &ev, 1000));
+	assert(CCTALKD_REPLY == hdr.type && 0 == hdr.error);
+
+	sim->coin_rate = 100;
+
+	assert(recv_message(a, &hdr, &ev, 2000));
+	assert(CCTALKD_EVENT == hdr.type);
+	assert(2 == hdr.address && sizeof(ev) == hdr.length);
+
+	/* Events of the acceptor do not reach other subscribers. */
+	assert(!recv_message(b, &hdr, &ev, 0));
+
+	stop_daemon();
+	assert(server->events > 0);
+
+	close(a);
+	close(b);
+	server_free(server);
+	sim_free(sim);
+}
@@ -0,0 +1,768 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cutest.h"
+#include "../../src/sim.h"
+
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+static struct sim *sim;
+static pthread_t sim_thread;
+static volatile int sim_stop;
+
+static void *sim_main(void *arg)
+{
+	sim_run(sim, &sim_stop);
+	return NULL;
+}
+
+/* Start simulated bus and open host on it. */
+static struct cctalk_host *start_sim(enum cctalk_crc_mode crc_mode)
+{
+	struct cctalk_host *host;
+	char path[256];
+
+	if (NULL == (sim = sim_new(path, sizeof(path))))
+		skip_test();
+
+	sim->crc_mode = crc_mode;
+	sim_add(sim, SIM_ACCEPTOR, 2);
+	sim_add(sim, SIM_HOPPER, 3);
+	sim_add(sim, SIM_HOPPER, 4);
+	sim_add(sim, SIM_VALIDATOR, 40);
+
+	if (NULL == (host = cctalk_host_new(path)))
+		skip_test();
+
+	host->crc_mode = crc_mode;
+	host->timeout = 200;
+
+	pthread_create(&sim_thread, NULL, sim_main, NULL);
+	return host;
+}
+
+static void stop_sim(struct cctalk_host *host)
+{
+	sim_stop = 1;
+	pthread_join(sim_thread, NULL);
+	cctalk_host_free(host);
+	sim_free(sim);
+}
+
+static void check_acceptor(enum cctalk_crc_mode crc_mode)
+{
+	struct cctalk_host *host = start_sim(crc_mode);
+	struct cctalk_credit_info info;
+	struct cctalk_device *dev;
+
+	assert(NULL != (dev = cctalk_device_scan(host, 2)));
+	assert(0x0406 == dev->version);
+	assert(NULL == cctalk_device_scan(host, 42));
+
+	sim->coin_rate = 1000;
+	assert(-1 != cctalk_device_set_accept_coins(dev, 1));
+	assert(dev->has_master_inhibit_status);
+
+	usleep(10000);
+	assert(0 == cctalk_device_query_credits(dev, &info));
+	assert(info.seq > 0);
+	assert(0 != info.coins[0].value);
+
+	cctalk_device_free(dev);
+	stop_sim(host);
+}
+
+decl_test(acceptor_simple)
+{
+	check_acceptor(CCTALK_CRC_SIMPLE);
+}
+
+decl_test(acceptor_ccitt)
+{
+	check_acceptor(CCTALK_CRC_CCITT);
+}
+
+decl_test(probe_failure)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_device *dev;
+
+	assert(NULL != (dev = cctalk_device_scan(host, 2)));
+
+	/* No usable reply tells nothing about the support. */
+	sim->corrupt = 1;
+	assert(-1 == cctalk_device_set_accept_coins(dev, 0));
+	assert(!dev->probed_master_inhibit_status);
+
+	sim->corrupt = 0;
+	assert(1 == cctalk_device_set_accept_coins(dev, 0));
+	assert(dev->probed_master_inhibit_status);
+	assert(dev->has_master_inhibit_status);
+
+	cctalk_device_free(dev);
+	stop_sim(host);
+}
+
+/* Addresses of the devices remembered in the cache file. */
+static unsigned cached_ids(const char *path)
+{
+	char line[512], key[300];
+	unsigned id, ids = 0;
+	FILE *fp;
+
+	assert(NULL != (fp = fopen(path, "r")));
+
+	while (NULL != fgets(line, sizeof(line), fp))
+		if (2 == sscanf(line, "%u %299s", &id, key))
+			ids = ids * 100 + id;
+
+	fclose(fp);
+	return ids;
+}
+
+decl_test(scan_cached)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	char path[] = "/tmp/t-device-XXXXXX";
+	struct cctalk_device *dev;
+	uint64_t frames;
+	struct stat st;
+	int fd;
+
+	if (-1 == (fd = mkstemp(path)))
+		skip_test();
+
+	/* Entry of a device from another line. */
+	assert(18 == write(fd, "9 s:123456 406 f\n", 18));
+	fchmod(fd, 0644);
+	close(fd);
+
+	/* Unknown device gets probed and remembered. */
+	assert(NULL != (dev = cctalk_device_scan_cached(host, 2, path)));
+	assert(dev->probed_master_inhibit_status);
+	assert(dev->has_master_inhibit_status);
+	assert(902 == cached_ids(path));
+	cctalk_device_free(dev);
+
+	/* Known one needs just the serial number. */
+	frames = sim->frames;
+	assert(NULL != (dev = cctalk_device_scan_cached(host, 2, path)));
+	assert(1 == sim->frames - frames);
+	assert(0x0406 == dev->version);
+	assert(dev->probed_master_inhibit_status);
+	assert(dev->has_master_inhibit_status);
+	assert(dev->probed_inhibit_status && dev->has_inhibit_status);
+	cctalk_device_free(dev);
+
+	/* Hoppers ignore the probes, so there is nothing to remember. */
+	assert(NULL != (dev = cctalk_device_scan_cached(host, 3, path)));
+	assert(!dev->probed_master_inhibit_status);
+	assert(902 == cached_ids(path));
+	cctalk_device_free(dev);
+
+	assert(NULL != (dev = cctalk_device_scan_cached(host, 40, path)));
+	assert(90240 == cached_ids(path));
+	cctalk_device_free(dev);
+
+	/* Still readable by everyone. */
+	assert(0 == stat(path, &st));
+	assert(0644 == (st.st_mode & 0777));
+
+	unlink(path);
+	stop_sim(host);
+}
+
+decl_test(discover)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_device **devs;
+	ssize_t count, i;
+
+	count = cctalk_device_discover(host, &devs, CCTALK_DISCOVER_TIMEOUT);
+	assert(4 == count);
+	assert(2 == devs[0]->id);
+	assert(3 == devs[1]->id);
+	assert(4 == devs[2]->id);
+	assert(40 == devs[3]->id);
+
+	for (i = 0; i < count; i++)
+		cctalk_device_free(devs[i]);
+
+	free(devs);
+	stop_sim(host);
+}
+
+/* Poll the validator until an event of given type shows up. */
+static struct cctalk_event wait_event(struct cctalk_device *dev,
+                                      struct cctalk_event_ring *ring,
+                                      enum cctalk_event_type type)
+{
+	struct cctalk_event ev;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		assert(-1 != cctalk_device_poll_bills(dev, ring));
+
+		while (1 == cctalk_event_ring_pop(ring, &ev, 1))
+			if (type == ev.type)
+				return ev;
+
+		usleep(5000);
+	}
+
+	assert(!"event did not arrive");
+	return ev;
+}
+
+decl_test(validator)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_event_ring *ring = cctalk_event_ring_new(16);
+	struct cctalk_event escrow, credit;
+	struct cctalk_device *dev;
+	char id[16];
+
+	assert(NULL != (dev = cctalk_device_scan(host, 40)));
+	assert(0 == cctalk_bill_query_id(dev, 4, id, sizeof(id)));
+	assert(0 == strcmp("EU0020A", id));
+
+	/* Nothing to route yet. */
+	assert(-1 == cctalk_bill_route(dev, CCTALK_BILL_STACK));
+	assert(ENOENT == errno);
+
+	assert(0 == cctalk_device_poll_bills(dev, ring));
+	sim->bill_rate = 100;
+	escrow = wait_event(dev, ring, CCTALK_EVENT_BILL_ESCROW);
+	sim->bill_rate = 0;
+
+	/* Credited only once stacked. */
+	assert(0 == cctalk_bill_route(dev, CCTALK_BILL_STACK));
+	credit = wait_event(dev, ring, CCTALK_EVENT_BILL_CREDIT);
+	assert(escrow.value == credit.value);
+	assert(credit.seq == escrow.seq % 255 + 1);
+
+	cctalk_event_ring_free(ring);
+	cctalk_device_free(dev);
+	stop_sim(host);
+}
+
+static int payout_paying, payout_done;
+
+static void on_payout(struct cctalk_payout *payout, int done, void *arg)
+{
+	int paying = 0;
+	size_t i;
+
+	for (i = 0; i < payout->nhoppers; i++)
+		paying += CCTALK_HOPPER_PAYING == payout->hoppers[i].state;
+
+	if (paying > payout_paying)
+		payout_paying = paying;
+
+	payout_done = done;
+}
+
+static void run_payout(struct cctalk_payout *payout, unsigned amount)
+{
+	int i;
+
+	payout_paying = payout_done = 0;
+	assert(0 == cctalk_payout_start(payout, amount));
+	assert(0 == payout->shortfall);
+
+	for (i = 0; i < 50 && !payout_done; i++)
+		cctalk_bus_run(payout->bus, 100);
+
+	assert(payout_done);
+	assert(!payout->active);
+}
+
+decl_test(payout)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	struct cctalk_payout *payout = cctalk_payout_new(bus, on_payout, NULL);
+
+	sim->payout_rate = 100;
+	assert(0 == cctalk_payout_add_hopper(payout,
+	                                     cctalk_device_scan(host, 3), 50));
+	assert(0 == cctalk_payout_add_hopper(payout,
+	                                     cctalk_device_scan(host, 4), 20));
+
+	/* Both hoppers pay at the same time. */
+	run_payout(payout, 190);
+	assert(190 == cctalk_payout_paid(payout));
+	assert(3 == payout->hoppers[0].paid);
+	assert(2 == payout->hoppers[1].paid);
+	assert(2 == payout_paying);
+
+	/* Empty hopper gets replaced by the other one. */
+	sim->devices[1].stock = 1;
+	run_payout(payout, 150);
+	assert(150 == cctalk_payout_paid(payout));
+	assert(1 == payout->hoppers[0].paid);
+	assert(2 == payout->hoppers[0].unpaid);
+	assert(5 == payout->hoppers[1].paid);
+
+	cctalk_payout_free(payout);
+	cctalk_bus_free(bus);
+	stop_sim(host);
+}
+
+/* Addresses of the polled devices and requests, in order. */
+static uint8_t order[64];
+static size_t norder;
+
+static void record_poll(struct cctalk_device *dev,
+                        const struct cctalk_message *reply, void *arg)
+{
+	if (norder < sizeof(order))
+		order[norder++] = dev->id;
+}
+
+static void record_request(struct cctalk_host *host,
+                           const struct cctalk_message *reply, void *arg)
+{
+	if (norder < sizeof(order))
+		order[norder++] = NULL != reply ? 0 : errno;
+}
+
+/* Schedule the devices at given addresses with the simple poll. */
+static void add_polls(struct cctalk_host *host, struct cctalk_bus *bus,
+                      const uint8_t *addrs, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		assert(0 == cctalk_bus_add(bus, cctalk_device_scan(host, addrs[i]),
+		                           CCTALK_METHOD_SIMPLE_POLL,
+		                           record_poll, NULL));
+}
+
+decl_test(poll_rates)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	static const uint8_t addrs[] = {2, 3};
+
+	/* 20 ms for the acceptor, 100 ms for the hopper. */
+	sim->devices[0].poll_value = 2;
+	add_polls(host, bus, addrs, 2);
+	assert(20 == bus->slots[0].interval);
+	assert(100 == bus->slots[1].interval);
+
+	assert(0 == cctalk_bus_run(bus, 1000));
+	assert(bus->slots[0].polls >= 40 && bus->slots[0].polls <= 51);
+	assert(bus->slots[1].polls >= 8 && bus->slots[1].polls <= 11);
+
+	cctalk_bus_free(bus);
+	stop_sim(host);
+}
+
+decl_test(overdue_first)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	static const uint8_t addrs[] = {2, 3, 4};
+	int64_t base;
+	size_t i;
+
+	add_polls(host, bus, addrs, 3);
+	base = bus->slots[2].due;
+
+	for (i = 0; i < 3; i++)
+		bus->slots[i].interval = 10000;
+
+	bus->slots[0].due = base - 10;
+	bus->slots[1].due = base - 30;
+	bus->slots[2].due = base - 20;
+
+	norder = 0;
+	assert(0 == cctalk_bus_run(bus, 100));
+	assert(3 == norder);
+	assert(3 == order[0] && 4 == order[1] && 2 == order[2]);
+
+	cctalk_bus_free(bus);
+	stop_sim(host);
+}
+
+decl_test(oversubscribed)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	static const uint8_t addrs[] = {2, 3, 4};
+	struct cctalk_bus_load load;
+	size_t i;
+
+	add_polls(host, bus, addrs, 3);
+
+	/* Every poll takes longer than the devices are willing to wait. */
+	sim->latency = 2000;
+
+	for (i = 0; i < 3; i++)
+		bus->slots[i].interval = 2;
+
+	assert(0 == cctalk_bus_run(bus, 300));
+
+	cctalk_bus_load(bus, &load, 1);
+	assert(load.demand > 1.0);
+	assert(load.utilization > 0.9);
+	assert(load.polls > 0 && load.late > 0);
+	assert(load.max_lateness >= 2);
+
+	cctalk_bus_load(bus, &load, 0);
+	assert(0 == load.polls + load.late);
+
+	cctalk_bus_free(bus);
+	stop_sim(host);
+}
+
+decl_test(interleave)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	static const uint8_t addrs[] = {2};
+	size_t i, polls = 0;
+
+	add_polls(host, bus, addrs, 1);
+	bus->slots[0].interval = 10;
+	sim->latency = 2000;
+
+	/* More requests than the bus can carry out within the interval. */
+	for (i = 0; i < 20; i++)
+		assert(0 == cctalk_bus_submit(bus, 3, CCTALK_METHOD_SIMPLE_POLL,
+		                              NULL, 0, record_request, NULL));
+
+	norder = 0;
+	assert(0 == cctalk_bus_run(bus, 100));
+	assert(norder > 20);
+
+	/* Late polls do not wait for the queue to run dry. */
+	for (i = 0; i < 20; i++)
+		if (2 == order[i])
+			polls++;
+
+	assert(0 == order[0]);
+	assert(polls > 1);
+
+	/* Whatever remains is cancelled when the bus goes away. */
+	for (i = 0; i < 3; i++)
+		assert(0 == cctalk_bus_submit(bus, 3, CCTALK_METHOD_SIMPLE_POLL,
+		                              NULL, 0, record_request, NULL));
+
+	norder = 0;
+	cctalk_bus_free(bus);
+	assert(3 == norder);
+	assert(ECANCELED == order[0] && ECANCELED == order[2]);
+
+	stop_sim(host);
+}
+
+/* Talk to the acceptor at address 2, collecting its credits. */
+static void replay_session(struct cctalk_host *host,
+                           struct cctalk_credit_info *info)
+{
+	struct cctalk_device *dev;
+
+	assert(NULL != (dev = cctalk_device_scan(host, 2)));
+	assert(-1 != cctalk_device_set_accept_coins(dev, 1));
+	usleep(10000);
+	assert(0 == cctalk_device_query_credits(dev, info));
+	cctalk_device_free(dev);
+}
+
+decl_test(replay)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_credit_info recorded, replayed;
+	char capture[] = "/tmp/t-device-XXXXXX", path[256];
+	struct sim_replay *rp;
+	int fd;
+
+	if (-1 == (fd = mkstemp(capture)))
+		skip_test();
+
+	close(fd);
+	assert(NULL != (host->capture = cctalk_capture_open(capture, 0x10000)));
+
+	sim->coin_rate = 1000;
+	replay_session(host, &recorded);
+	assert(recorded.seq > 0);
+
+	cctalk_capture_close(host->capture);
+	stop_sim(host);
+
+	/* The devices are gone, only the recording answers now. */
+	assert(NULL != (sim = sim_new(path, sizeof(path))));
+	assert(0 == sim_replay(sim, capture, 4));
+	assert(NULL != (host = cctalk_host_new(path)));
+	host->timeout = 200;
+
+	sim_stop = 0;
+	pthread_create(&sim_thread, NULL, sim_main, NULL);
+
+	replay_session(host, &replayed);
+	assert(0 == memcmp(&recorded, &replayed, sizeof(recorded)));
+
+	rp = sim->replay;
+	assert(sim_replay_done(sim));
+	assert(rp->matched == rp->nexchanges);
+	assert(0 == rp->skipped && 0 == rp->extra);
+
+	stop_sim(host);
+	unlink(capture);
+}
+
+decl_test(board)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	char path[] = "/tmp/t-device-XXXXXX";
+	struct cctalk_board_state state;
+	struct cctalk_board *reader;
+	struct cctalk_bus_load load;
+	uint64_t polls;
+	int fd;
+
+	if (-1 == (fd = mkstemp(path)))
+		skip_test();
+
+	close(fd);
+	assert(NULL != (bus->board = cctalk_board_open(path)));
+	assert(NULL != (reader = cctalk_board_map(path)));
+
+	assert(0 == cctalk_bus_add(bus, cctalk_device_scan(host, 2),
+	                           CCTALK_METHOD_SIMPLE_POLL, NULL, NULL));
+	bus->slots[0].interval = 10;
+	assert(0 == cctalk_bus_run(bus, 100));
+
+	assert(0 == cctalk_board_read(reader, 2, &state));
+	assert(state.online && state.polls > 1 && 0 == state.errors);
+	assert(state.seen == state.updated);
+	polls = state.polls;
+
+	/* Load reports do not reset the totals. */
+	cctalk_bus_load(bus, &load, 1);
+	assert(0 == cctalk_bus_run(bus, 50));
+	assert(0 == cctalk_board_read(reader, 2, &state));
+	assert(state.polls > polls);
+
+	cctalk_board_close(reader);
+	cctalk_board_close(bus->board);
+	cctalk_bus_free(bus);
+	stop_sim(host);
+	unlink(path);
+}
+
+static struct cctalk_queue *queue;
+static volatile int producers_done;
+
+static void *producer(void *arg)
+{
+	struct cctalk_request req;
+	int i;
+
+	for (i = 0; i < 10; i++) {
+		cctalk_request_init(&req, 2, CCTALK_METHOD_SIMPLE_POLL, NULL, 0);
+		cctalk_queue_submit(queue, &req);
+		assert(0 == cctalk_request_wait(&req));
+		cctalk_request_destroy(&req);
+	}
+
+	__atomic_add_fetch(&producers_done, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+decl_test(queue)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	volatile int stop = 0;
+	pthread_t threads[4];
+	int i;
+
+	assert(NULL != (queue = cctalk_queue_new(bus)));
+
+	for (i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, producer, NULL);
+
+	while (4 != producers_done)
+		assert(0 == cctalk_queue_run(queue, 10, &stop));
+
+	for (i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+
+	assert(40 == host->stats.frames_received);
+
+	cctalk_queue_free(queue);
+	cctalk_bus_free(bus);
+	stop_sim(host);
+}
+
+static int completed;
+
+static void on_complete(struct cctalk_request *req, void *arg)
+{
+	*(int *)arg = ++completed;
+}
+
+decl_test(queue_urgent)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	struct cctalk_request reqs[9];
+	int order[9] = {0}, i;
+
+	assert(NULL != (queue = cctalk_queue_new(bus)));
+
+	for (i = 0; i < 9; i++) {
+		cctalk_request_init(&reqs[i], 2, CCTALK_METHOD_SIMPLE_POLL,
+		                    NULL, 0);
+		reqs[i].callback = on_complete;
+		reqs[i].arg = &order[i];
+	}
+
+	for (i = 0; i < 8; i++)
+		cctalk_queue_submit(queue, &reqs[i]);
+
+	cctalk_queue_submit_urgent(queue, &reqs[8]);
+
+	while (completed < 9)
+		assert(0 == cctalk_queue_run(queue, 10, NULL));
+
+	assert(1 == order[8]);
+
+	for (i = 0; i < 8; i++)
+		assert(i + 2 == order[i] && 0 == reqs[i].status);
+
+	for (i = 0; i < 9; i++)
+		cctalk_request_destroy(&reqs[i]);
+
+	cctalk_queue_free(queue);
+	cctalk_bus_free(bus);
+	stop_sim(host);
+}
+
+decl_test(queue_free)
+{
+	struct cctalk_host *host = start_sim(CCTALK_CRC_SIMPLE);
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	struct cctalk_request reqs[3];
+	int i;
+
+	assert(NULL != (queue = cctalk_queue_new(bus)));
+
+	for (i = 0; i < 3; i++)
+		cctalk_request_init(&reqs[i], 2, CCTALK_METHOD_SIMPLE_POLL,
+		                    NULL, 0);
+
+	/* Two of them get handed to the bus, the last one does not. */
+	cctalk_queue_submit(queue, &reqs[0]);
+	cctalk_queue_submit(queue, &reqs[1]);
+	cctalk_queue_dispatch(queue);
+	assert(NULL != bus->requests);
+	cctalk_queue_submit(queue, &reqs[2]);
+
+	cctalk_queue_free(queue);
+	assert(NULL == bus->requests);
+
+	for (i = 0; i < 3; i++) {
+		assert(-1 == cctalk_request_wait(&reqs[i]));
+		assert(ECANCELED == errno);
+		cctalk_request_destroy(&reqs[i]);
+	}
+
+	cctalk_bus_free(bus);
+	stop_sim(host);
+}
+
+/* Serve the simulated bus on given descriptor instead of the pty. */
+static void attach_sim(int fd)
+{
+	char path[256];
+
+	if (NULL == (sim = sim_new(path, sizeof(path))))
+		skip_test();
+
+	sim_attach(sim, fd);
+	sim_add(sim, SIM_ACCEPTOR, 2);
+	pthread_create(&sim_thread, NULL, sim_main, NULL);
+}
+
+/* Same conversation regardless of how the bytes travel. */
+static void check_transport(struct cctalk_host *host)
+{
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	struct cctalk_device *dev;
+
+	host->timeout = 200;
+	assert(NULL != (dev = cctalk_device_scan(host, 2)));
+	assert(0x0406 == dev->version);
+	assert(-1 == cctalk_host_setup_line(host, &CCTALK_LINE_DEFAULT));
+	assert(ENOTTY == errno);
+
+	assert(0 == cctalk_bus_add(bus, dev, CCTALK_METHOD_SIMPLE_POLL,
+	                           NULL, NULL));
+	bus->slots[0].interval = 10;
+	assert(0 == cctalk_bus_run(bus, 100));
+	assert(host->stats.frames_received > 2);
+	assert(0 == host->stats.timeouts + host->stats.echo_errors);
+
+	cctalk_bus_free(bus);
+}
+
+decl_test(tcp)
+{
+	struct sockaddr_in sin = {.sin_family = AF_INET};
+	socklen_t len = sizeof(sin);
+	struct cctalk_host *host;
+	char path[64];
+	int fd;
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (-1 == (fd = socket(AF_INET, SOCK_STREAM, 0)) ||
+	    -1 == bind(fd, (struct sockaddr *)&sin, sizeof(sin)) ||
+	    -1 == listen(fd, 1))
+		skip_test();
+
+	getsockname(fd, (struct sockaddr *)&sin, &len);
+	snprintf(path, sizeof(path), "tcp:127.0.0.1:%i", ntohs(sin.sin_port));
+
+	assert(NULL != (host = cctalk_host_new(path)));
+	assert(&cctalk_transport_tcp == host->transport);
+
+	attach_sim(accept(fd, NULL, NULL));
+	close(fd);
+
+	check_transport(host);
+	stop_sim(host);
+}
+
+decl_test(loopback)
+{
+	struct cctalk_host *host;
+	int peer;
+
+	assert(NULL != (host = cctalk_host_new_loopback(&peer)));
+
+	attach_sim(peer);
+	check_transport(host);
+	stop_sim(host);
+}
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cutest.h"
+#include "cctalk.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/* Credit buffer with seq and the most recent coin values. */
+static void set_credits(struct cctalk_credit_info *info, uint8_t seq,
+                        const uint8_t *values, size_t count)
+{
+	size_t i;
+
+	memset(info, 0, sizeof(*info));
+	info->seq = seq;
+
+	for (i = 0; i < count; i++) {
+		info->coins[i].value = values[i];
+		info->coins[i].sorter = values[i] ? 1 : 0;
+		info->coins[i].error = values[i] ? 0 : 254;
+	}
+}
+
+decl_test(ring)
+{
+	struct cctalk_event_ring *ring = cctalk_event_ring_new(3);
+	struct cctalk_event ev = {0}, out[8];
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		ev.seq = i;
+		assert(0 == cctalk_event_ring_push(ring, &ev));
+	}
+
+	assert(-1 == cctalk_event_ring_push(ring, &ev));
+	assert(ENOBUFS == errno);
+
+	assert(3 == cctalk_event_ring_pop(ring, out, 3));
+	assert(0 == out[0].seq && 2 == out[2].seq);
+
+	for (i = 4; i < 7; i++) {
+		ev.seq = i;
+		assert(0 == cctalk_event_ring_push(ring, &ev));
+	}
+
+	assert(4 == cctalk_event_ring_pop(ring, out, 8));
+	assert(3 == out[0].seq && 6 == out[3].seq);
+	assert(0 == cctalk_event_ring_pop(ring, out, 8));
+
+	cctalk_event_ring_free(ring);
+}
+
+decl_test(credits)
+{
+	struct cctalk_event_ring *ring = cctalk_event_ring_new(16);
+	struct cctalk_device dev = {.id = 2};
+	struct cctalk_credit_info info;
+	struct cctalk_event out[16];
+	uint8_t coins[5] = {3, 0, 1, 4, 5};
+
+	/* The first buffer only sets the starting point. */
+	set_credits(&info, 253, coins, 5);
+	assert(0 == cctalk_device_credit_events(&dev, &info, ring));
+	assert(0 == cctalk_device_credit_events(&dev, &info, ring));
+
+	/* Wrapping from 255 to 1, oldest event first. */
+	set_credits(&info, 1, coins, 5);
+	assert(3 == cctalk_device_credit_events(&dev, &info, ring));
+	assert(3 == cctalk_event_ring_pop(ring, out, 16));
+	assert(254 == out[0].seq && CCTALK_EVENT_CREDIT == out[0].type);
+	assert(1 == out[0].value);
+	assert(255 == out[1].seq && CCTALK_EVENT_ERROR == out[1].type);
+	assert(254 == out[1].error);
+	assert(1 == out[2].seq && 3 == out[2].value);
+
+	/* Seven more events, only five are still buffered. */
+	set_credits(&info, 8, coins, 5);
+	assert(6 == cctalk_device_credit_events(&dev, &info, ring));
+	assert(6 == cctalk_event_ring_pop(ring, out, 16));
+	assert(CCTALK_EVENT_OVERFLOW == out[0].type && 2 == out[0].lost);
+	assert(4 == out[1].seq && 5 == out[1].value);
+	assert(8 == out[5].seq && 3 == out[5].value);
+
+	/* Power cycle. */
+	set_credits(&info, 0, NULL, 0);
+	assert(1 == cctalk_device_credit_events(&dev, &info, ring));
+	assert(1 == cctalk_event_ring_pop(ring, out, 16));
+	assert(CCTALK_EVENT_RESET == out[0].type);
+
+	cctalk_event_ring_free(ring);
+}
+
+decl_test(credits_full_ring)
+{
+	struct cctalk_event_ring *ring = cctalk_event_ring_new(2);
+	struct cctalk_device dev = {.id = 2};
+	struct cctalk_credit_info info;
+	struct cctalk_event out[4];
+	uint8_t coins[5] = {5, 4, 3, 2, 1};
+
+	set_credits(&info, 0, NULL, 0);
+	assert(0 == cctalk_device_credit_events(&dev, &info, ring));
+
+	/* Events that do not fit are reported later, exactly once. */
+	set_credits(&info, 3, coins + 2, 3);
+	assert(2 == cctalk_device_credit_events(&dev, &info, ring));
+	assert(2 == cctalk_event_ring_pop(ring, out, 4));
+	assert(1 == out[0].value && 2 == out[1].value);
+
+	set_credits(&info, 5, coins, 5);
+	assert(2 == cctalk_device_credit_events(&dev, &info, ring));
+	assert(2 == cctalk_event_ring_pop(ring, out, 4));
+	assert(3 == out[0].value && 4 == out[1].value);
+
+	assert(1 == cctalk_device_credit_events(&dev, &info, ring));
+	assert(1 == cctalk_event_ring_pop(ring, out, 4));
+	assert(5 == out[0].value && 5 == out[0].seq);
+
+	cctalk_event_ring_free(ring);
+}
+
+#define STRESS_EVENTS 200000
+
+static void *producer(void *arg)
+{
+	struct cctalk_event ev = {0};
+	unsigned i;
+
+	for (i = 0; i < STRESS_EVENTS; i++) {
+		ev.lost = i;
+
+		while (-1 == cctalk_event_ring_push(arg, &ev))
+			sched_yield();
+	}
+
+	return NULL;
+}
+
+decl_test(ring_threads)
+{
+	struct cctalk_event_ring *ring = cctalk_event_ring_new(64);
+	struct cctalk_event out[16];
+	unsigned next = 0;
+	pthread_t thread;
+	size_t i, n;
+
+	pthread_create(&thread, NULL, producer, ring);
+
+	while (next < STRESS_EVENTS) {
+		n = cctalk_event_ring_pop(ring, out, 16);
+
+		for (i = 0; i < n; i++)
+			assert(next++ == out[i].lost);
+	}
+
+	pthread_join(thread, NULL);
+	cctalk_event_ring_free(ring);
+}
@@ -0,0 +1,399 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cutest.h"
+#include "cctalk.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Master side of the pseudo-terminal the host talks over. */
+static int peer = -1;
+
+static struct cctalk_host *open_host(void)
+{
+	struct cctalk_host *host;
+
+	if (-1 == (peer = posix_openpt(O_RDWR | O_NOCTTY)))
+		skip_test();
+
+	if (-1 == grantpt(peer) || -1 == unlockpt(peer))
+		skip_test();
+
+	if (NULL == (host = cctalk_host_new(ptsname(peer))))
+		skip_test();
+
+	return host;
+}
+
+/* Append a simple checksum reply frame to the buffer. */
+static size_t put_reply(uint8_t *buf, uint8_t status,
+                        const uint8_t *data, uint8_t length)
+{
+	uint8_t sum = 0;
+	size_t i;
+
+	buf[0] = 1;
+	buf[1] = length;
+	buf[2] = 2;
+	buf[3] = status;
+	memcpy(buf + 4, data, length);
+
+	for (i = 0; i < 4u + length; i++)
+		sum += buf[i];
+
+	buf[4 + length] = -sum;
+	return 5 + length;
+}
+
+/* Read the request and answer it, echo included. */
+static void serve(const uint8_t *reply, size_t length)
+{
+	uint8_t buf[CCTALK_FRAME_MAX + 64];
+	ssize_t len;
+
+	assert(0 < (len = read(peer, buf, sizeof(buf))));
+	memcpy(buf + len, reply, length);
+	assert(len + length == (size_t)write(peer, buf, len + length));
+}
+
+static int replies, last_errno;
+static uint8_t last_status;
+static uint8_t last_data[8];
+
+static void on_reply(struct cctalk_host *host,
+                     const struct cctalk_message *reply, void *arg)
+{
+	replies++;
+	last_errno = reply ? 0 : errno;
+
+	if (NULL == reply)
+		return;
+
+	last_status = reply->header;
+	memcpy(last_data, reply->data, reply->length);
+}
+
+/* Run the host until the request completes. */
+static void run(struct cctalk_host *host)
+{
+	struct pollfd pfd = {host->fd, 0, 0};
+
+	while (CCTALK_HOST_IDLE != host->state) {
+		pfd.events = cctalk_host_events(host);
+		pfd.revents = 0;
+		poll(&pfd, 1, cctalk_host_next_timeout(host));
+		cctalk_host_dispatch(host, pfd.revents);
+	}
+}
+
+decl_test(async)
+{
+	struct cctalk_host *host = open_host();
+	uint8_t frame[16], data[3] = {1, 2, 3};
+	size_t len = put_reply(frame, 0, data, 3);
+
+	assert(0 == cctalk_host_submit(host, 2, 4, NULL, 0, on_reply, NULL));
+	assert(-1 == cctalk_host_submit(host, 2, 4, NULL, 0, on_reply, NULL));
+	assert(POLLOUT == cctalk_host_events(host));
+
+	cctalk_host_dispatch(host, POLLOUT);
+	assert(POLLIN == cctalk_host_events(host));
+
+	serve(frame, len);
+	run(host);
+
+	assert(1 == replies);
+	assert(0 == last_status);
+	assert(0 == memcmp(last_data, data, 3));
+
+	cctalk_host_free(host);
+}
+
+decl_test(async_timeout)
+{
+	struct cctalk_host *host = open_host();
+
+	host->timeout = 50;
+	assert(0 == cctalk_host_submit(host, 2, 254, NULL, 0, on_reply, NULL));
+	run(host);
+
+	assert(1 == replies);
+	assert(ETIMEDOUT == last_errno);
+
+	cctalk_host_free(host);
+}
+
+decl_test(resync)
+{
+	struct cctalk_host *host = open_host();
+	struct cctalk_message *msg;
+	uint8_t buf[64], data[2] = {7, 8};
+	size_t len = 0;
+
+	/* Noise, a corrupted frame and a bogus length byte. */
+	buf[len++] = 0x55;
+	len += put_reply(buf + len, 0, data, 2);
+	buf[len - 1] ^= 0xff;
+	buf[len++] = 1;
+	buf[len++] = 200;
+
+	len += put_reply(buf + len, 3, data, 2);
+	assert(len == (size_t)write(peer, buf, len));
+
+	assert(NULL != (msg = cctalk_recv(host)));
+	assert(3 == msg->header);
+	assert(2 == msg->length);
+	assert(0 == memcmp(msg->data, data, 2));
+
+	free(msg);
+	cctalk_host_free(host);
+}
+
+decl_test(partial)
+{
+	struct cctalk_host *host = open_host();
+	struct cctalk_stats stats;
+	struct cctalk_message *msg;
+	uint8_t buf[32], data[11] = {5, 1, 0, 2, 0, 0xfd, 0, 0, 0, 0, 0};
+	struct timespec ts = {0, 10000000};
+	size_t len = put_reply(buf, 0, data, 11);
+
+	/* Event buffer with a complete empty ACK frame inside of it
+	 * arrives first, the rest of the reply a bit later. */
+	assert(10 == write(peer, buf, 10));
+	nanosleep(&ts, NULL);
+	assert(len - 10 == (size_t)write(peer, buf + 10, len - 10));
+
+	assert(NULL != (msg = cctalk_recv(host)));
+	assert(11 == msg->length);
+	assert(0 == memcmp(msg->data, data, 11));
+
+	cctalk_host_stats(host, &stats, 0);
+	assert(0 == stats.checksum_errors);
+
+	free(msg);
+	cctalk_host_free(host);
+}
+
+decl_test(noise_before_reply)
+{
+	struct cctalk_host *host = open_host();
+	struct timespec ts = {0, 100000000};
+	struct cctalk_message *msg;
+	uint8_t buf[16] = {0x55}, data[1] = {9};
+	size_t len = 1 + put_reply(buf + 1, 0, data, 1);
+
+	/* A stray byte must not cut the wait for the reply short. */
+	assert(1 == write(peer, buf, 1));
+
+	if (0 == fork()) {
+		nanosleep(&ts, NULL);
+		_exit(len - 1 != (size_t)write(peer, buf + 1, len - 1));
+	}
+
+	assert(NULL != (msg = cctalk_recv(host)));
+	assert(1 == msg->length && 9 == msg->data[0]);
+	assert(0 == host->stats.truncated);
+
+	free(msg);
+	cctalk_host_free(host);
+}
+
+decl_test(blocking)
+{
+	struct cctalk_host *host = open_host();
+	const struct cctalk_message *msg;
+	uint8_t buf[32] = {2, 0, 1, 4, 249}, data[3] = {1, 2, 3};
+	size_t len = 5;
+
+	/* Echo and the reply can be queued up front. */
+	len += put_reply(buf + len, 0, data, 3);
+	assert(len == (size_t)write(peer, buf, len));
+
+	assert(0 == cctalk_send(host, 2, 4, NULL, 0));
+	assert(NULL != (msg = cctalk_recv_slot(host)));
+	assert(0 == msg->header);
+	assert(3 == msg->length);
+	assert(0 == memcmp(msg->data, data, 3));
+
+	cctalk_host_free(host);
+}
+
+decl_test(no_echo)
+{
+	struct cctalk_host *host = open_host();
+	const struct cctalk_message *msg;
+	uint8_t req[5] = {2, 0, 1, 254, 255}, buf[16], data[1] = {9};
+	size_t len = put_reply(buf, 0, data, 1);
+
+	/* The line does not loop our frames back. */
+	host->echo = 0;
+	host->timeout = 200;
+
+	assert(0 == cctalk_send(host, 2, 254, NULL, 0));
+	assert(5 == read(peer, buf + len, 5));
+	assert(0 == memcmp(buf + len, req, 5));
+	assert(len == (size_t)write(peer, buf, len));
+
+	assert(NULL != (msg = cctalk_recv_slot(host)));
+	assert(0 == msg->header && 1 == msg->length && 9 == msg->data[0]);
+
+	/* The same goes for the asynchronous engine. */
+	assert(0 == cctalk_host_submit(host, 2, 254, NULL, 0, on_reply, NULL));
+	cctalk_host_dispatch(host, POLLOUT);
+	assert(CCTALK_HOST_REPLY == host->state);
+
+	assert(5 == read(peer, buf + len, 5));
+	assert(len == (size_t)write(peer, buf, len));
+	run(host);
+
+	assert(1 == replies && 0 == last_errno && 9 == last_data[0]);
+	assert(0 == host->stats.echo_errors);
+
+	cctalk_host_free(host);
+}
+
+decl_test(adaptive_timeout)
+{
+	struct cctalk_host *host = open_host();
+	struct cctalk_stats stats;
+	uint8_t buf[32] = {2, 0, 1, 254, 255};
+	size_t len = 5;
+	struct timespec start, end;
+
+	len += put_reply(buf + len, 0, NULL, 0);
+	assert(len == (size_t)write(peer, buf, len));
+	assert(0 == cctalk_transact(host, 2, 254, NULL, 0, NULL, 0));
+
+	/* Quick device gets a short timeout, unknown ones the full one. */
+	assert(host->min_timeout == cctalk_host_reply_timeout(host, 2));
+	assert(host->timeout == cctalk_host_reply_timeout(host, 3));
+
+	/* Only the echo comes back, the request is repeated once. */
+	host->retries = 1;
+	assert(5 == write(peer, buf, 5));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(-1 == cctalk_transact(host, 2, 254, NULL, 0, NULL, 0));
+	assert(ETIMEDOUT == errno);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	assert(end.tv_sec - start.tv_sec < 1);
+	cctalk_host_stats(host, &stats, 0);
+	assert(1 == stats.retries);
+	assert(2 == stats.timeouts);
+
+	cctalk_host_free(host);
+}
+
+decl_test(truncated)
+{
+	struct cctalk_host *host = open_host();
+	uint8_t buf[32] = {2, 0, 1, 4, 249}, data[3] = {1, 2, 3};
+	struct timespec start, end;
+	struct cctalk_stats stats;
+	size_t len = 5;
+
+	/* Echo and just a part of the reply. */
+	len += put_reply(buf + len, 0, data, 3) - 3;
+	assert(len == (size_t)write(peer, buf, len));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	assert(0 == cctalk_send(host, 2, 4, NULL, 0));
+	assert(NULL == cctalk_recv_slot(host));
+	assert(EBADMSG == errno);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* Reported after the inter-byte gap, not the full timeout. */
+	assert((end.tv_sec - start.tv_sec) * 1000 +
+	       (end.tv_nsec - start.tv_nsec) / 1000000 < host->timeout / 2);
+
+	cctalk_host_stats(host, &stats, 0);
+	assert(1 == stats.truncated);
+	assert(0 == stats.timeouts);
+
+	cctalk_host_free(host);
+}
+
+/* Serial line that never takes a single byte. */
+static ssize_t stuck_write(struct cctalk_host *host, const void *buf,
+                           size_t len)
+{
+	return 0;
+}
+
+decl_test(stuck_line)
+{
+	struct cctalk_host *host = open_host();
+	const struct cctalk_transport *serial = host->transport;
+	struct cctalk_transport stuck = *serial;
+	struct cctalk_stats stats;
+	uint8_t buf[8];
+
+	stuck.write = stuck_write;
+	host->transport = &stuck;
+
+	/* Failed writes are retried like lost frames. */
+	assert(-1 == cctalk_transact(host, 2, 254, NULL, 0, buf, sizeof(buf)));
+	assert(EIO == errno);
+
+	cctalk_host_stats(host, &stats, 0);
+	assert(host->retries == (int)stats.retries);
+
+	host->transport = serial;
+	cctalk_host_free(host);
+}
+
+decl_test(capture)
+{
+	struct cctalk_host *host = open_host();
+	const struct cctalk_capture_record *rec;
+	uint8_t buf[32] = {2, 0, 1, 254, 255}, data[1] = {7};
+	char path[] = "/tmp/t-host-XXXXXX";
+	uint64_t offset;
+	int fd;
+
+	if (-1 == (fd = mkstemp(path)))
+		skip_test();
+
+	close(fd);
+	assert(NULL != (host->capture = cctalk_capture_open(path, 0x10000)));
+
+	put_reply(buf + 5, 0, data, 1);
+	assert(11 == write(peer, buf, 11));
+	assert(0 == cctalk_send(host, 2, 254, NULL, 0));
+	assert(NULL != cctalk_recv_slot(host));
+
+	offset = cctalk_capture_header(host->capture)->tail;
+
+	/* The request, but not its echo. */
+	assert(NULL != (rec = cctalk_capture_next(host->capture, &offset)));
+	assert(CCTALK_CAPTURE_TX == rec->type && 5 == rec->size);
+	assert(0 == memcmp(buf, rec->data, 5));
+
+	assert(NULL != (rec = cctalk_capture_next(host->capture, &offset)));
+	assert(CCTALK_CAPTURE_RX == rec->type && 0 == rec->flags);
+	assert(0 == memcmp(buf + 5, rec->data, 6));
+
+	assert(NULL == cctalk_capture_next(host->capture, &offset));
+
+	cctalk_capture_close(host->capture);
+	cctalk_host_free(host);
+	unlink(path);
+}
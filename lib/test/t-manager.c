@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cutest.h"
+#include "../../src/sim.h"
+
+#include <pthread.h>
+#include <time.h>
+
+/* Simulated bus that answers and one where nobody ever does. */
+static struct sim *live, *dead;
+static pthread_t sim_thread;
+static volatile int sim_stop;
+
+static struct cctalk_manager *mgr;
+static struct cctalk_bus *live_bus, *dead_bus;
+
+static void *sim_main(void *arg)
+{
+	sim_run(live, &sim_stop);
+	return NULL;
+}
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static struct cctalk_bus *open_bus(const char *path)
+{
+	struct cctalk_host *host;
+
+	if (NULL == (host = cctalk_host_new(path)))
+		skip_test();
+
+	host->timeout = 200;
+	return cctalk_bus_new(host);
+}
+
+/* Start manager with both buses on a single thread. */
+static void start_manager(void)
+{
+	char live_path[256], dead_path[256];
+
+	if (NULL == (live = sim_new(live_path, sizeof(live_path))) ||
+	    NULL == (dead = sim_new(dead_path, sizeof(dead_path))))
+		skip_test();
+
+	sim_add(live, SIM_ACCEPTOR, 2);
+	pthread_create(&sim_thread, NULL, sim_main, NULL);
+
+	live_bus = open_bus(live_path);
+	dead_bus = open_bus(dead_path);
+
+	/* Wait out the whole reply timeout, not just the missing echo. */
+	dead_bus->host->echo = 0;
+
+	assert(NULL != (mgr = cctalk_manager_new(1, 0)));
+	assert(0 == cctalk_manager_add(mgr, live_bus));
+	assert(0 == cctalk_manager_add(mgr, dead_bus));
+}
+
+static void stop_manager(void)
+{
+	cctalk_manager_free(mgr);
+	sim_stop = 1;
+	pthread_join(sim_thread, NULL);
+	sim_free(live);
+	sim_free(dead);
+}
+
+static void submit(struct cctalk_bus *bus, void *tag)
+{
+	assert(0 == cctalk_manager_submit(mgr, bus, 2,
+	                                  CCTALK_METHOD_SIMPLE_POLL,
+	                                  NULL, 0, tag));
+}
+
+decl_test(dead_bus)
+{
+	struct cctalk_completion c;
+	int64_t start, live_at = 0, dead_at = 0;
+	int polls = 0, cancelled = 0;
+	char live_tag, dead_tag;
+
+	start_manager();
+	assert(0 == cctalk_manager_watch(mgr, live_bus,
+	                                 cctalk_device_scan(live_bus->host, 2),
+	                                 CCTALK_METHOD_SIMPLE_POLL));
+	assert(0 == cctalk_manager_start(mgr));
+
+	start = now_ms();
+	submit(dead_bus, &dead_tag);
+	submit(live_bus, &live_tag);
+
+	while (0 == dead_at) {
+		assert(1 == cctalk_manager_wait(mgr, &c, 1000));
+
+		if (NULL != c.dev) {
+			assert(live_bus == c.bus && 0 == c.status);
+			polls++;
+		} else if (&live_tag == c.tag) {
+			assert(live_bus == c.bus && 0 == c.status);
+			live_at = now_ms();
+		} else {
+			assert(&dead_tag == c.tag && dead_bus == c.bus);
+			assert(-1 == c.status && ETIMEDOUT == c.error);
+			dead_at = now_ms();
+		}
+	}
+
+	/* The dead bus timing out does not hold the other one up. */
+	assert(0 != live_at && live_at - start < 100);
+	assert(dead_at - start >= 200);
+	assert(polls > 0);
+
+	/* Requests not carried out by the time the manager stops. */
+	submit(dead_bus, &dead_tag);
+	submit(dead_bus, &dead_tag);
+	submit(dead_bus, &dead_tag);
+	usleep(20000);
+	cctalk_manager_stop(mgr);
+
+	while (1 == cctalk_manager_wait(mgr, &c, 0)) {
+		if (&dead_tag != c.tag)
+			continue;
+
+		assert(-1 == c.status && ECANCELED == c.error);
+		cancelled++;
+	}
+
+	assert(3 == cancelled);
+	assert(-1 == cctalk_manager_start(mgr) && EBUSY == errno);
+	stop_manager();
+}
+
+decl_test(overflow)
+{
+	struct cctalk_completion c;
+	unsigned polls = 0;
+	char tag;
+	int i;
+
+	start_manager();
+	assert(0 == cctalk_manager_watch(mgr, live_bus,
+	                                 cctalk_device_scan(live_bus->host, 2),
+	                                 CCTALK_METHOD_SIMPLE_POLL));
+	live_bus->slots[0].interval = 1;
+	assert(0 == cctalk_manager_start(mgr));
+
+	/* Fall behind, then ask for something. */
+	usleep(1000000);
+	submit(live_bus, &tag);
+
+	assert(1 == cctalk_manager_wait(mgr, &c, 0));
+	assert(-1 == c.status && ENOBUFS == c.error && c.lost > 0);
+	assert(NULL == c.dev && NULL == c.tag);
+
+	for (i = 0; i < 10000; i++) {
+		assert(1 == cctalk_manager_wait(mgr, &c, 1000));
+
+		if (&tag == c.tag)
+			break;
+
+		if (NULL != c.dev)
+			polls++;
+	}
+
+	/* The result of the request never gets dropped. */
+	assert(&tag == c.tag && 0 == c.status);
+	assert(polls >= 256);
+	stop_manager();
+}
+
+static void *waiter(void *arg)
+{
+	struct cctalk_completion c;
+
+	*(int *)arg = cctalk_manager_wait(mgr, &c, 1000);
+	return NULL;
+}
+
+decl_test(waiters)
+{
+	pthread_t threads[4];
+	int got[4] = {0}, i;
+	char tag;
+
+	start_manager();
+	assert(0 == cctalk_manager_start(mgr));
+
+	for (i = 0; i < 4; i++)
+		pthread_create(&threads[i], NULL, waiter, &got[i]);
+
+	/* All the cancellations get queued at once. */
+	for (i = 0; i < 8; i++)
+		submit(dead_bus, &tag);
+
+	usleep(20000);
+	cctalk_manager_stop(mgr);
+
+	for (i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+		assert(1 == got[i]);
+	}
+
+	stop_manager();
+}
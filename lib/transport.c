@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+#include "util.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/serial.h>
+
+/* Supported line speeds. */
+static const struct {
+	int baudrate;
+	speed_t speed;
+} speeds[] = {
+	{1200, B1200}, {2400, B2400}, {4800, B4800}, {9600, B9600},
+	{19200, B19200}, {38400, B38400}, {57600, B57600},
+	{115200, B115200}, {230400, B230400}, {460800, B460800},
+	{921600, B921600},
+};
+
+static int baudrate_to_speed(int baudrate, speed_t *speed)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(speeds) / sizeof(*speeds); i++) {
+		if (speeds[i].baudrate == baudrate) {
+			*speed = speeds[i].speed;
+			return 0;
+		}
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static int speed_to_baudrate(speed_t speed)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(speeds) / sizeof(*speeds); i++)
+		if (speeds[i].speed == speed)
+			return speeds[i].baudrate;
+
+	return 0;
+}
+
+/* Path to the FTDI latency timer of the line, if it has one. */
+static int latency_timer_path(int fd, char *path, size_t size)
+{
+	const char *name = ttyname(fd);
+
+	if (NULL == name)
+		return -1;
+
+	if (NULL != strrchr(name, '/'))
+		name = strrchr(name, '/') + 1;
+
+	snprintf(path, size, "/sys/class/tty/%s/device/latency_timer", name);
+	return 0;
+}
+
+static int get_latency_timer(int fd)
+{
+	char path[PATH_MAX];
+	int value = 0;
+	FILE *fp;
+
+	if (-1 == latency_timer_path(fd, path, sizeof(path)))
+		return 0;
+
+	if (NULL == (fp = fopen(path, "r")))
+		return 0;
+
+	if (1 != fscanf(fp, "%i", &value))
+		value = 0;
+
+	fclose(fp);
+	return value;
+}
+
+static void set_latency_timer(int fd, int value)
+{
+	char path[PATH_MAX];
+	FILE *fp;
+
+	if (-1 == latency_timer_path(fd, path, sizeof(path)))
+		return;
+
+	/* Only present on FTDI adapters, and usually needs root. */
+	if (NULL == (fp = fopen(path, "w")))
+		return;
+
+	fprintf(fp, "%i\n", value);
+	fclose(fp);
+}
+
+static void set_low_latency(int fd)
+{
+	struct serial_struct ss;
+
+	/* Not supported by every driver, nothing we can do about it. */
+	if (-1 == ioctl(fd, TIOCGSERIAL, &ss))
+		return;
+
+	ss.flags |= ASYNC_LOW_LATENCY;
+	ioctl(fd, TIOCSSERIAL, &ss);
+}
+
+/* Put the serial line into raw mode with given settings. */
+static int setup_serial_line(int fd, const struct cctalk_line *line)
+{
+	struct termios tio = {0};
+	speed_t speed;
+
+	if (-1 == baudrate_to_speed(line->baudrate, &speed))
+		return -1;
+
+	cfmakeraw(&tio);
+	cfsetspeed(&tio, speed);
+
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cc[VMIN] = line->vmin;
+	tio.c_cc[VTIME] = line->vtime;
+
+	if (-1 == tcsetattr(fd, TCSANOW, &tio))
+		return -1;
+
+	/* Leave alone what the administrator might have set up. */
+	if (line->low_latency)
+		set_low_latency(fd);
+
+	if (line->latency_timer > 0)
+		set_latency_timer(fd, line->latency_timer);
+
+	return 0;
+}
+
+static int serial_setup_line(struct cctalk_host *host,
+                             const struct cctalk_line *line)
+{
+	return setup_serial_line(host->fd, line);
+}
+
+static int serial_line_info(const struct cctalk_host *host,
+                            struct cctalk_line *line)
+{
+	struct serial_struct ss;
+	struct termios tio;
+
+	if (-1 == tcgetattr(host->fd, &tio))
+		return -1;
+
+	line->baudrate = speed_to_baudrate(cfgetospeed(&tio));
+	line->vmin = tio.c_cc[VMIN];
+	line->vtime = tio.c_cc[VTIME];
+	line->low_latency = 0;
+
+	if (0 == ioctl(host->fd, TIOCGSERIAL, &ss))
+		line->low_latency = !!(ss.flags & ASYNC_LOW_LATENCY);
+
+	line->latency_timer = get_latency_timer(host->fd);
+	return 0;
+}
+
+static ssize_t fd_read(struct cctalk_host *host, void *buf, size_t len)
+{
+	return read(host->fd, buf, len);
+}
+
+static ssize_t fd_write(struct cctalk_host *host, const void *buf, size_t len)
+{
+	return write(host->fd, buf, len);
+}
+
+/* Sockets must not raise SIGPIPE when the other end goes away. */
+static ssize_t sock_write(struct cctalk_host *host, const void *buf,
+                          size_t len)
+{
+	return send(host->fd, buf, len, MSG_NOSIGNAL);
+}
+
+static void fd_close(struct cctalk_host *host)
+{
+	close(host->fd);
+}
+
+const struct cctalk_transport cctalk_transport_serial = {
+	.name = "serial",
+	.read = fd_read,
+	.write = fd_write,
+	.setup_line = serial_setup_line,
+	.line_info = serial_line_info,
+	.close = fd_close,
+};
+
+const struct cctalk_transport cctalk_transport_tcp = {
+	.name = "tcp",
+	.read = fd_read,
+	.write = sock_write,
+	.close = fd_close,
+};
+
+const struct cctalk_transport cctalk_transport_loopback = {
+	.name = "loopback",
+	.read = fd_read,
+	.write = sock_write,
+	.close = fd_close,
+};
+
+struct cctalk_host *cctalk_host_new_serial(const char *path)
+{
+	struct cctalk_host *host;
+	int fd;
+
+	if (-1 == (fd = open(path, O_RDWR | O_NOCTTY)))
+		return NULL;
+
+	/* Start with a clean line, but do not drop the data when
+	 * the line is reconfigured later on. */
+	if (-1 == setup_serial_line(fd, &CCTALK_LINE_DEFAULT) ||
+	    -1 == tcflush(fd, TCIOFLUSH) ||
+	    NULL == (host = cctalk_host_new_fd(&cctalk_transport_serial,
+	                                       fd, NULL))) {
+		close(fd);
+		return NULL;
+	}
+
+	return host;
+}
+
+struct cctalk_host *cctalk_host_new_tcp(const char *node,
+                                        const char *service)
+{
+	struct addrinfo hints = {0}, *res, *ai;
+	struct cctalk_host *host;
+	int fd = -1, one = 1, err;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (0 != (err = getaddrinfo(node, service, &hints, &res))) {
+		errno = EAI_SYSTEM == err ? errno : EHOSTUNREACH;
+		return NULL;
+	}
+
+	for (ai = res; NULL != ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+		            ai->ai_protocol);
+
+		if (-1 == fd)
+			continue;
+
+		if (0 == connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+
+		err = errno;
+		close(fd);
+		errno = err;
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (-1 == fd)
+		return NULL;
+
+	/* Frames are tiny and the reply waits for them, never let
+	 * them sit in the socket buffer. */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (NULL == (host = cctalk_host_new_fd(&cctalk_transport_tcp,
+	                                       fd, NULL)))
+		close(fd);
+
+	return host;
+}
+
+struct cctalk_host *cctalk_host_new_loopback(int *peer)
+{
+	struct cctalk_host *host;
+	int fds[2];
+
+	if (-1 == socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+		return NULL;
+
+	if (NULL == (host = cctalk_host_new_fd(&cctalk_transport_loopback,
+	                                       fds[0], NULL))) {
+		close(fds[0]);
+		close(fds[1]);
+		return NULL;
+	}
+
+	*peer = fds[1];
+	return host;
+}
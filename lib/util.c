@@ -16,7 +16,9 @@
 
 #include "util.h"
 
-#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 static const uint16_t ccitt_table[256] = {
@@ -64,44 +66,28 @@ static uint16_t ccitt(uint16_t crc, const uint8_t *data, size_t size)
 	return crc;
 }
 
-ssize_t xwrite(int fd, const void *buf, size_t count, int timeout)
+int64_t monotonic_ms(void)
 {
-	struct pollfd pfd = {fd, POLLOUT, 0};
-	size_t total = 0;
+	struct timespec ts;
 
-	while (total < count) {
-		if (1 != poll(&pfd, 1, timeout))
-			return -1;
-
-		ssize_t written = write(fd, buf + total, count - total);
-
-		if (written < 1)
-			return -1;
-
-		total += written;
-	}
-
-	return total;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-ssize_t xread(int fd, void *buf, size_t count, int timeout)
+int64_t monotonic_us(void)
 {
-	struct pollfd pfd = {fd, POLLIN, 0};
-	size_t total = 0;
-
-	while (total < count) {
-		if (1 != poll(&pfd, 1, timeout))
-			return -1;
-
-		ssize_t rread = read(fd, buf + total, count - total);
+	struct timespec ts;
 
-		if (rread < 1)
-			return -1;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-		total += rread;
-	}
+int64_t realtime_ms(void)
+{
+	struct timespec ts;
 
-	return total;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
 uint8_t crc_simple(struct cctalk_message *msg, const void *data)
@@ -134,3 +120,82 @@ uint8_t crc_16_ccitt(struct cctalk_message *msg, const void *data)
 
 	return checksum >> 8;
 }
+
+/* Build complete frame including the checksum, return its length. */
+size_t frame_encode(const struct cctalk_host *host, uint8_t *buf,
+                    uint8_t destination, enum cctalk_method method,
+                    const void *data, size_t length)
+{
+	struct cctalk_message *msg = (struct cctalk_message *)buf;
+
+	msg->destination = destination;
+	msg->length = length;
+	msg->source = host->id;
+	msg->header = method;
+
+	if (length > 0)
+		memcpy(msg->data, data, length);
+
+	if (CCTALK_CRC_CCITT == host->crc_mode)
+		msg->data[length] = crc_16_ccitt(msg, msg->data);
+	else
+		msg->data[length] = crc_simple(msg, msg->data);
+
+	return sizeof(*msg) + length + 1;
+}
+
+/* Verify checksum of a complete frame. */
+int frame_valid(const struct cctalk_host *host,
+                const struct cctalk_message *msg)
+{
+	struct cctalk_message header = *msg;
+	uint8_t checksum;
+
+	if (CCTALK_CRC_CCITT == host->crc_mode) {
+		checksum = crc_16_ccitt(&header, msg->data);
+		return checksum == msg->data[msg->length] &&
+		       header.source == msg->source;
+	}
+
+	checksum = crc_simple(&header, msg->data);
+	return checksum == msg->data[msg->length];
+}
+
+size_t frame_scan(struct cctalk_host *host, const uint8_t *buf,
+                  size_t len, size_t *skip)
+{
+	size_t pos, bad_end = 0;
+
+	for (pos = 0; pos < len; pos++) {
+		const struct cctalk_message *msg = (const void *)(buf + pos);
+		size_t flen;
+
+		/* Replies are always addressed to us. */
+		if (msg->destination != host->id)
+			continue;
+
+		/* Wait for the rest, the caller decides when to give up. */
+		if (pos + sizeof(*msg) >= len)
+			break;
+
+		if (pos + (flen = sizeof(*msg) + msg->length + 1) > len)
+			break;
+
+		if (frame_valid(host, msg)) {
+			*skip = pos;
+			return flen;
+		}
+
+		/* Corrupted, resynchronize on the next byte.  Count it
+		 * just once, not for every candidate inside of it. */
+		if (pos >= bad_end) {
+			host->stats.checksum_errors++;
+			host_capture(host, CCTALK_CAPTURE_RX,
+			             CCTALK_CAPTURE_BAD_CHECKSUM, msg, flen);
+			bad_end = pos + flen;
+		}
+	}
+
+	*skip = pos;
+	return 0;
+}
@@ -22,21 +22,14 @@
 #include <unistd.h>
 #include <stdint.h>
 
-/*
- * write(2) wrapper that attempts to write the whole buffer.
- * Returns either the original count or -1 to signal failure.
- * The timeout parameter specifies how long can the function
- * block until it is allowed to write next byte.
- */
-ssize_t xwrite(int fd, const void *buf, size_t count, int timeout);
+/* Milliseconds of CLOCK_MONOTONIC, for deadlines. */
+int64_t monotonic_ms(void);
 
-/*
- * read(2) wrapper that attempts to fill the whole buffer.
- * Returns either the original count or -1 to signal failure.
- * The timeout parameter specifies how long can the function
- * block until it is allowed to write next byte.
- */
-ssize_t xread(int fd, void *buf, size_t count, int timeout);
+/* Microseconds of CLOCK_MONOTONIC, for latency measurements. */
+int64_t monotonic_us(void);
+
+/* Milliseconds since the epoch, for other processes to see. */
+int64_t realtime_ms(void);
 
 /* Compute the "simple" ccTalk checksum.
  * Returns either the original count or -1 to signal failure. */
@@ -46,4 +39,39 @@ uint8_t crc_simple(struct cctalk_message *msg, const void *data);
  * field that will hold one half of the checksum.  Stupid ccTalk. */
 uint8_t crc_16_ccitt(struct cctalk_message *msg, const void *data);
 
+/* Build complete frame including the checksum, return its length.
+ * The buffer must be able to hold CCTALK_FRAME_MAX bytes. */
+size_t frame_encode(const struct cctalk_host *host, uint8_t *buf,
+                    uint8_t destination, enum cctalk_method method,
+                    const void *data, size_t length);
+
+/* Verify checksum of a complete frame. */
+int frame_valid(const struct cctalk_host *host,
+                const struct cctalk_message *msg);
+
+/*
+ * Look for the next valid frame addressed to the host in the buffer.
+ *
+ * Returns length of the frame found at the *skip offset or 0 if more
+ * data are needed, in which case *skip bytes of garbage can be dropped
+ * and whatever remains starts with our address.
+ * Corrupted frames are skipped and counted, resynchronizing on the next
+ * plausible frame start.  Incomplete frames are waited for, even when
+ * a valid frame seems to follow them.
+ */
+size_t frame_scan(struct cctalk_host *host, const uint8_t *buf,
+                  size_t len, size_t *skip);
+
+/*
+ * Read raw bytes that do not form frames, such as ADDRESS_POLL
+ * replies, through the host receive buffer.  Waits up to timeout
+ * milliseconds in total and returns number of bytes read.
+ */
+ssize_t host_recv_bytes(struct cctalk_host *host, uint8_t *buf, size_t len,
+                        int timeout);
+
+/* Record the frame into the host capture, if there is any. */
+void host_capture(struct cctalk_host *host, enum cctalk_capture_type type,
+                  int flags, const void *data, size_t size);
+
 #endif				/* !_UTIL_H */
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "cctalk.h"
+
+#include <error.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+static const struct option longopts[] = {
+	{"help",     0, 0, 'h'},
+	{"version",  0, 0, 'V'},
+
+	{0, 0, 0, 0},
+};
+
+static const char optstring[] = "hV";
+
+static int do_version(int argc, char **argv)
+{
+	printf("cctalk-dump %s\n", VERSION);
+	return 0;
+}
+
+static int do_help(int argc, char **argv)
+{
+	puts("cctalk-dump traffic.cap...");
+	puts("Decode traffic recorded by cctalk --capture.");
+	puts("");
+	puts("ACTIONS:");
+	puts("  --help, -h     Display this help.");
+	puts("  --version, -V  Display version information.");
+	puts("");
+	puts("Every frame is printed on a single line with its time, time");
+	puts("since the previous frame in milliseconds, direction, addresses,");
+	puts("method or reply status, data bytes and any problems noticed.");
+	puts("");
+	puts("Report bugs to Jan Dvorak <mordae@anilinux.org>.");
+	return 0;
+}
+
+/* Print the header fields of a complete enough frame. */
+static void print_frame(const struct cctalk_capture_record *rec)
+{
+	const struct cctalk_message *msg = (const void *)rec->data;
+	const char *name;
+	int i, len;
+
+	/* The source field holds a part of the CRC-16 checksum. */
+	if (rec->flags & CCTALK_CAPTURE_CCITT)
+		printf("   ? -> %-3i", msg->destination);
+	else
+		printf(" %3i -> %-3i", msg->source, msg->destination);
+
+	if (CCTALK_CAPTURE_TX == rec->type) {
+		if (NULL != (name = cctalk_method_name(msg->header)))
+			printf(" %s", name);
+		else
+			printf(" method-%i", msg->header);
+	} else if (0 == msg->header) {
+		printf(" ACK");
+	} else if (5 == msg->header) {
+		printf(" NAK");
+	} else if (6 == msg->header) {
+		printf(" BUSY");
+	} else {
+		printf(" status-%i", msg->header);
+	}
+
+	/* Truncated frames might not carry all the data they claim. */
+	len = rec->size - (int)sizeof(*msg);
+	len = msg->length < len ? msg->length : len;
+
+	for (i = 0; i < len; i++)
+		printf(" %02x", msg->data[i]);
+}
+
+static void print_record(const struct cctalk_capture_record *rec,
+                         int64_t prev)
+{
+	time_t sec = rec->time / 1000000;
+	char stamp[32];
+	struct tm tm;
+	int i;
+
+	localtime_r(&sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+	printf("%s.%06i %+9.3f %s", stamp, (int)(rec->time % 1000000),
+	       prev ? (rec->time - prev) / 1000.0 : 0.0,
+	       CCTALK_CAPTURE_TX == rec->type ? "tx" : "rx");
+
+	if (rec->size >= sizeof(struct cctalk_message)) {
+		print_frame(rec);
+	} else {
+		printf(" raw");
+
+		for (i = 0; i < rec->size; i++)
+			printf(" %02x", rec->data[i]);
+	}
+
+	if (rec->flags & CCTALK_CAPTURE_BAD_CHECKSUM)
+		printf(" (bad checksum)");
+
+	if (rec->flags & CCTALK_CAPTURE_TRUNCATED)
+		printf(" (truncated)");
+
+	printf("\n");
+}
+
+static int dump(const char *path)
+{
+	const struct cctalk_capture_header *hdr;
+	const struct cctalk_capture_record *rec;
+	struct cctalk_capture *cap;
+	uint64_t offset;
+	int64_t prev = 0;
+	int damaged;
+
+	if (NULL == (cap = cctalk_capture_map(path))) {
+		error(0, errno, "failed to open capture %s", path);
+		return 1;
+	}
+
+	hdr = cctalk_capture_header(cap);
+	offset = hdr->tail;
+
+	while (NULL != (rec = cctalk_capture_next(cap, &offset))) {
+		print_record(rec, prev);
+		prev = rec->time;
+	}
+
+	if ((damaged = offset < hdr->head))
+		error(0, 0, "%s: damaged record at offset %" PRIu64,
+		      path, offset);
+
+	if (hdr->dropped > 0)
+		error(0, 0, "%s: %" PRIu64 " records were dropped",
+		      path, hdr->dropped);
+
+	cctalk_capture_close(cap);
+	return damaged;
+}
+
+static int do_dump(int argc, char **argv)
+{
+	int i, result = 0;
+
+	if (argc < 1)
+		error(1, 0, "no capture file specified");
+
+	for (i = 0; i < argc; i++)
+		result |= dump(argv[i]);
+
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	int c, idx = 0;
+	int (*action)(int argc, char **argv) = do_dump;
+
+	while (-1 != (c = getopt_long(argc, argv, optstring, longopts, &idx)))
+		switch (c) {
+			case 'h':
+				action = do_help;
+				break;
+
+			case 'V':
+				action = do_version;
+				break;
+
+			case '?':
+				return 1;
+		}
+
+	return action(argc - optind, argv + optind);
+}
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "sim.h"
+
+#include <error.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+static const struct option longopts[] = {
+	{"help",       0, 0, 'h'},
+	{"version",    0, 0, 'V'},
+	{"link",       1, 0, 'l'},
+	{"ccitt",      0, 0, 'c'},
+	{"no-echo",    0, 0, 'E'},
+	{"acceptors",  1, 0, 'a'},
+	{"hoppers",    1, 0, 'p'},
+	{"validators", 1, 0, 'v'},
+	{"latency",    1, 0, 'L'},
+	{"jitter",     1, 0, 'j'},
+	{"corrupt",    1, 0, 'x'},
+	{"coin-rate",  1, 0, 'r'},
+	{"payout-rate", 1, 0, 'P'},
+	{"bill-rate",  1, 0, 'B'},
+	{"seed",       1, 0, 's'},
+	{"replay",     1, 0, 'R'},
+	{"speed",      1, 0, 'S'},
+	{"listen",     1, 0, 't'},
+
+	{0, 0, 0, 0},
+};
+
+static const char optstring[] = "hVl:cEa:p:v:L:j:x:r:P:B:s:R:S:t:";
+
+static volatile int stop = 0;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+/* Wait for a single TCP connection on given port. */
+static int accept_tcp(const char *port)
+{
+	struct addrinfo hints = {0}, *res;
+	int fd, conn, one = 1, err;
+
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (0 != (err = getaddrinfo(NULL, port, &hints, &res)))
+		error(1, 0, "invalid port %s: %s", port, gai_strerror(err));
+
+	if (-1 == (fd = socket(res->ai_family, res->ai_socktype, 0)))
+		error(1, errno, "failed to create socket");
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (-1 == bind(fd, res->ai_addr, res->ai_addrlen) ||
+	    -1 == listen(fd, 1))
+		error(1, errno, "failed to listen on port %s", port);
+
+	freeaddrinfo(res);
+	printf("tcp:localhost:%s\n", port);
+	fflush(stdout);
+
+	if (-1 == (conn = accept(fd, NULL, NULL)))
+		error(1, errno, "failed to accept connection");
+
+	close(fd);
+	return conn;
+}
+
+static int do_version(void)
+{
+	printf("cctalk-sim %s\n", VERSION);
+	return 0;
+}
+
+static int do_help(void)
+{
+	puts("cctalk-sim [--acceptors=1] [--hoppers=0] [--link=path]");
+	puts("Simulate ccTalk peripherals on a pseudo-terminal.");
+	puts("");
+	puts("ACTIONS:");
+	puts("  --help, -h     Display this help.");
+	puts("  --version, -V  Display version information.");
+	puts("");
+	puts("OPTIONS:");
+	puts("  --link, -l path");
+	puts("                 Create symlink to the terminal, too.");
+	puts("  --ccitt, -c    Use 16-bit checksums.");
+	puts("  --no-echo, -E  Do not loop the host frames back.");
+	puts("  --acceptors, -a 1");
+	puts("                 Coin acceptors, at address 2 and then 11 on.");
+	puts("  --hoppers, -p 0");
+	puts("                 Hoppers, at addresses 3 to 10 and then 100 on.");
+	puts("  --validators, -v 0");
+	puts("                 Bill validators, at address 40 and then 41 on.");
+	puts("  --latency, -L 0");
+	puts("                 Delay replies by given microseconds.");
+	puts("  --jitter, -j 0");
+	puts("                 Random extra delay before every reply byte.");
+	puts("  --corrupt, -x 0");
+	puts("                 Probability of a bit flip in every reply byte.");
+	puts("  --coin-rate, -r 0");
+	puts("                 Coins inserted into every acceptor per second.");
+	puts("  --payout-rate, -P 5");
+	puts("                 Coins paid out by every hopper per second.");
+	puts("  --bill-rate, -B 0");
+	puts("                 Bills inserted into every validator per second.");
+	puts("  --seed, -s 0   Seed the random number generator.");
+	puts("  --replay, -R traffic.cap");
+	puts("                 Serve replies recorded by cctalk --capture");
+	puts("                 instead and report how the session differs.");
+	puts("  --speed, -S 1  Replay the recorded delays that much faster.");
+	puts("  --listen, -t port");
+	puts("                 Act as a TCP serial bridge instead and serve");
+	puts("                 a single connection on given port.");
+	puts("");
+	puts("Report bugs to Jan Dvorak <mordae@anilinux.org>.");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c, idx = 0, acceptors = 1, hoppers = 0, validators = 0, i;
+	int (*action)(void) = NULL;
+	char path[256], *link = NULL, *replay = NULL, *port = NULL;
+	double speed = 1;
+	struct sim *sim;
+
+	if (NULL == (sim = sim_new(path, sizeof(path))))
+		error(1, errno, "failed to create pseudo-terminal");
+
+	while (-1 != (c = getopt_long(argc, argv, optstring, longopts, &idx)))
+		switch (c) {
+			case 'h':
+				action = do_help;
+				break;
+
+			case 'V':
+				action = do_version;
+				break;
+
+			case 'l':
+				link = optarg;
+				break;
+
+			case 'c':
+				sim->crc_mode = CCTALK_CRC_CCITT;
+				break;
+
+			case 'E':
+				sim->echo = 0;
+				break;
+
+			case 'a':
+				acceptors = atoi(optarg);
+				break;
+
+			case 'p':
+				hoppers = atoi(optarg);
+				break;
+
+			case 'v':
+				validators = atoi(optarg);
+				break;
+
+			case 'L':
+				sim->latency = atoi(optarg);
+				break;
+
+			case 'j':
+				sim->jitter = atoi(optarg);
+				break;
+
+			case 'x':
+				sim->corrupt = atof(optarg);
+				break;
+
+			case 'r':
+				sim->coin_rate = atof(optarg);
+				break;
+
+			case 'P':
+				sim->payout_rate = atof(optarg);
+				break;
+
+			case 'B':
+				sim->bill_rate = atof(optarg);
+				break;
+
+			case 's':
+				sim->seed[1] = atoi(optarg);
+				sim->seed[2] = atoi(optarg) >> 16;
+				break;
+
+			case 'R':
+				replay = optarg;
+				break;
+
+			case 'S':
+				speed = atof(optarg);
+				break;
+
+			case 't':
+				port = optarg;
+				break;
+
+			case '?':
+				return 1;
+		}
+
+	if (NULL != action) {
+		sim_free(sim);
+		return action();
+	}
+
+	if (NULL != replay && -1 == sim_replay(sim, replay, speed))
+		error(1, errno, "failed to load capture %s", replay);
+
+	for (i = 0; i < acceptors; i++)
+		sim_add(sim, SIM_ACCEPTOR, i ? 10 + i : 2);
+
+	for (i = 0; i < hoppers; i++)
+		sim_add(sim, SIM_HOPPER, i < 8 ? 3 + i : 92 + i);
+
+	for (i = 0; i < validators; i++)
+		sim_add(sim, SIM_VALIDATOR, 40 + i);
+
+	if (NULL != link) {
+		unlink(link);
+
+		if (-1 == symlink(path, link))
+			error(1, errno, "failed to create link %s", link);
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	if (NULL != port) {
+		signal(SIGPIPE, SIG_IGN);
+		sim_attach(sim, accept_tcp(port));
+	} else {
+		printf("%s\n", path);
+		fflush(stdout);
+	}
+
+	sim_run(sim, &stop);
+
+	fprintf(stderr, "frames=%llu replies=%llu dropped=%llu\n",
+	        (unsigned long long)sim->frames,
+	        (unsigned long long)sim->replies,
+	        (unsigned long long)sim->dropped);
+
+	sim_replay_report(sim, stderr);
+
+	if (NULL != link)
+		unlink(link);
+
+	sim_free(sim);
+	return 0;
+}
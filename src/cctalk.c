@@ -18,9 +18,19 @@
 
 #include <error.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <signal.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Batch requests queued on the bus at once when pipelining. */
+#define BATCH_DEPTH 16
 
 static const struct option longopts[] = {
 	{"help",     0, 0, 'h'},
@@ -30,16 +40,113 @@ static const struct option longopts[] = {
 	{"ccitt",    0, 0, 'c'},
 	{"host-id",  1, 0, 'i'},
 	{"timeout",  1, 0, 't'},
+	{"baud",     1, 0, 'b'},
+	{"low-latency", 0, 0, 'L'},
+	{"latency-timer", 1, 0, 'T'},
+	{"line",     0, 0, 'l'},
+	{"stats",    0, 0, 'S'},
+	{"capture",  1, 0, 'C'},
+	{"batch",    0, 0, 'B'},
+	{"pipeline", 0, 0, 'p'},
+	{"monitor",  0, 0, 'm'},
+	{"method",   1, 0, 'M'},
+	{"interval", 1, 0, 'I'},
 
 	{0, 0, 0, 0},
 };
 
-static const char optstring[] = "hVscd:i:t:";
+static const char optstring[] = "hVscd:i:t:b:LT:lSC:BpmM:I:";
 
 static char *device = NULL;
 static enum cctalk_crc_mode crc_mode = CCTALK_CRC_SIMPLE;
 static uint8_t host_id = 1;
 static int timeout = 1000;
+static struct cctalk_line line = CCTALK_LINE_DEFAULT;
+static int stats = 0;
+static char *capture_path = NULL;
+static struct cctalk_capture *capture = NULL;
+static int pipeline = 0;
+static int monitor_method = CCTALK_METHOD_READ_BUFFERED_CREDIT_OR_ERROR_CODES;
+static int monitor_interval = 0;
+
+/* Batch input, read straight from the descriptor so that it can be
+ * waited for together with the serial line. */
+struct input {
+	int fd;
+	int eof;
+	unsigned lineno;
+	char buf[4096];
+	size_t len;
+};
+
+/* Open the host and apply all the options. */
+static struct cctalk_host *open_host(void)
+{
+	struct cctalk_host *host;
+
+	if (NULL == (host = cctalk_host_new(device)))
+		error(1, errno, "failed to open device %s", device);
+
+	/* Bridges have their line configured on their own. */
+	if (NULL != host->transport->setup_line &&
+	    -1 == cctalk_host_setup_line(host, &line))
+		error(1, errno, "failed to configure device %s", device);
+
+	host->crc_mode = crc_mode;
+	host->id = host_id;
+	host->timeout = timeout;
+
+	if (NULL != capture_path) {
+		capture = cctalk_capture_open(capture_path,
+		                              CCTALK_CAPTURE_DEFAULT_SIZE);
+
+		if (NULL == capture)
+			error(1, errno, "failed to open capture %s", capture_path);
+
+		host->capture = capture;
+	}
+
+	return host;
+}
+
+/* Print communication statistics of the host. */
+static void print_stats(struct cctalk_host *host)
+{
+	struct cctalk_stats st;
+	int addr, i;
+
+	cctalk_host_stats(host, &st, 0);
+
+	printf("sent: frames=%llu bytes=%llu\n",
+	       (unsigned long long)st.frames_sent,
+	       (unsigned long long)st.bytes_sent);
+	printf("received: frames=%llu bytes=%llu\n",
+	       (unsigned long long)st.frames_received,
+	       (unsigned long long)st.bytes_received);
+	printf("errors: echo=%llu checksum=%llu timeouts=%llu truncated=%llu "
+	       "retries=%llu\n",
+	       (unsigned long long)st.echo_errors,
+	       (unsigned long long)st.checksum_errors,
+	       (unsigned long long)st.timeouts,
+	       (unsigned long long)st.truncated,
+	       (unsigned long long)st.retries);
+
+	for (addr = 0; addr < 256; addr++) {
+		if (-1 == cctalk_stats_rtt_percentile(&st, addr, 50))
+			continue;
+
+		printf("rtt %i: p50<%lli p99<%lli us, histogram:", addr,
+		       (long long)cctalk_stats_rtt_percentile(&st, addr, 50),
+		       (long long)cctalk_stats_rtt_percentile(&st, addr, 99));
+
+		for (i = 0; i < CCTALK_RTT_BUCKETS; i++)
+			if (st.rtt[addr][i])
+				printf(" <%lli:%u", (long long)2 << i,
+				       st.rtt[addr][i]);
+
+		printf("\n");
+	}
+}
 
 static int do_version(int argc, char **argv)
 {
@@ -55,21 +162,77 @@ static int do_help(int argc, char **argv)
 	puts("ACTIONS:");
 	puts("  --help, -h     Display this help.");
 	puts("  --version, -V  Display version information.");
+	puts("  --line, -l     Display effective serial line settings.");
+	puts("  --batch, -B [script...]");
+	puts("                 Send \"peer method args...\" lines read from");
+	puts("                 the scripts or stdin, methods can go by name.");
+	puts("  --monitor, -m peer...");
+	puts("                 Keep polling the devices, print their events");
+	puts("                 and the achieved rates every second.");
 	puts("");
 	puts("OPTIONS:");
 	puts("  --simple, -s   Use the default 8-bit checksums.");
 	puts("  --ccitt, -c    Use 16-bit checksums.");
+	puts("  --stats, -S    Print communication statistics when done.");
+	puts("  --pipeline, -p Queue batch requests ahead, do not wait for");
+	puts("                 every reply before reading the next line.");
+	puts("  --method, -M 229");
+	puts("                 Poll monitored devices with given method.");
+	puts("  --interval, -I 0");
+	puts("                 Poll interval in milliseconds, 0 to use the");
+	puts("                 one recommended by the devices.");
+	puts("  --capture, -C traffic.cap");
+	puts("                 Record the traffic, see cctalk-dump.");
 	puts("  --timeout, -t 1000");
 	puts("                 Set communication timeout in milliseconds.");
+	puts("  --baud, -b 9600");
+	puts("                 Set serial line speed.");
+	puts("  --low-latency, -L");
+	puts("                 Ask the serial driver for low latency mode.");
+	puts("  --latency-timer, -T 1");
+	puts("                 Set FTDI adapter latency timer in milliseconds.");
 	puts("  --host-id, -i 1");
 	puts("                 Change address used by the host.");
 	puts("  --device, -d /dev/ttyUSB0");
-	puts("                 Select serial line device to communicate on.");
+	puts("                 Select serial line device to communicate on,");
+	puts("                 or tcp:node:port of a TCP serial bridge.");
 	puts("");
 	puts("Report bugs to Jan Dvorak <mordae@anilinux.org>.");
 	return 0;
 }
 
+static int do_line(int argc, char **argv)
+{
+	struct cctalk_host *host = open_host();
+	struct cctalk_line info;
+
+	if (-1 == cctalk_host_line_info(host, &info))
+		error(1, errno, "failed to query device %s", device);
+
+	printf("baud=%i vmin=%i vtime=%i low-latency=%i latency-timer=%i\n",
+	       info.baudrate, info.vmin, info.vtime, info.low_latency,
+	       info.latency_timer);
+
+	cctalk_host_free(host);
+	return 0;
+}
+
+/* Print the reply, sep goes in front of the data. */
+static void print_reply(const struct cctalk_message *msg, const char *sep)
+{
+	int i;
+
+	printf("%s: status=%i, source=%i, destination=%i%sdata:",
+	       (msg->header ? "error" : "success"), msg->header,
+	       (crc_mode == CCTALK_CRC_SIMPLE ? msg->source : 1),
+	       msg->destination, sep);
+
+	for (i = 0; i < msg->length; i++)
+		printf(" %i", msg->data[i]);
+
+	printf("\n");
+}
+
 static int do_talk(int argc, char **argv)
 {
 	struct cctalk_message *msg;
@@ -83,11 +246,7 @@ static int do_talk(int argc, char **argv)
 	for (i = 0; i < argc && i < 257; i++)
 		fields[i] = atoi(argv[i]);
 
-	if (NULL == (host = cctalk_host_new(device)))
-		error(1, errno, "failed to open device %s", device);
-
-	host->crc_mode = crc_mode;
-	host->id = host_id;
+	host = open_host();
 
 	if (-1 == cctalk_send(host, fields[0], fields[1], fields + 2, argc - 2))
 		error(1, errno, "message could not be sent");
@@ -95,18 +254,459 @@ static int do_talk(int argc, char **argv)
 	if (NULL == (msg = cctalk_recv(host)))
 		error(1, errno, "no message received");
 
-	printf("%s: status=%i, source=%i, destination=%i\ndata:",
-	       (msg->header ? "error" : "success"), msg->header,
-	       (crc_mode == CCTALK_CRC_SIMPLE ? msg->source : 1),
-	       msg->destination);
+	print_reply(msg, "\n");
 
-	for (i = 0; i < msg->length; i++)
-		printf(" %i", msg->data[i]);
+	if (stats)
+		print_stats(host);
+
+	free(msg);
+	cctalk_host_free(host);
+	cctalk_capture_close(capture);
+
+	return 0;
+}
+
+/* Read more input, noting its end. */
+static int fill(struct input *in)
+{
+	ssize_t rread = read(in->fd, in->buf + in->len,
+	                     sizeof(in->buf) - in->len);
+
+	if (0 == rread)
+		in->eof = 1;
+
+	if (-1 == rread && EINTR != errno && EAGAIN != errno)
+		return -1;
+
+	if (rread > 0)
+		in->len += rread;
+
+	return 0;
+}
+
+/* Take the next complete line out of the input buffer.
+ * The line buffer must fit the whole input buffer. */
+static int next_line(struct input *in, char *line)
+{
+	char *nl = memchr(in->buf, '\n', in->len);
+	size_t len = nl ? (size_t)(nl - in->buf) + 1 : in->len;
+
+	/* Wait for the rest, unless it is never coming. */
+	if (NULL == nl && !in->eof && in->len < sizeof(in->buf))
+		return 0;
+
+	if (0 == len)
+		return 0;
+
+	memcpy(line, in->buf, len);
+	line[len] = 0;
+	in->len -= len;
+	memmove(in->buf, in->buf + len, in->len);
+	in->lineno++;
+
+	return 1;
+}
+
+static int method_by_name(const char *name)
+{
+	const char *known;
+	int i;
+
+	for (i = 0; i < 256; i++)
+		if (NULL != (known = cctalk_method_name(i)) &&
+		    0 == strcasecmp(known, name))
+			return i;
+
+	return -1;
+}
+
+/*
+ * Parse "peer method args..." line into bytes, # starts a comment.
+ * Returns number of bytes, 0 for empty lines and -1 for invalid ones.
+ */
+static int parse_line(char *line, uint8_t *fields)
+{
+	char *token, *saveptr, *end;
+	long value;
+	int count = 0;
+
+	if (NULL != (end = strchr(line, '#')))
+		*end = 0;
+
+	for (token = strtok_r(line, " \t\r\n", &saveptr); NULL != token;
+	     token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+		if (257 == count)
+			return -1;
+
+		value = strtol(token, &end, 0);
+
+		if (*end)
+			value = 1 == count ? method_by_name(token) : -1;
+
+		if (value < 0 || value > 255)
+			return -1;
+
+		fields[count++] = value;
+	}
+
+	return 1 == count ? -1 : count;
+}
+
+static void print_result(unsigned lineno, const struct cctalk_message *msg,
+                         int err)
+{
+	printf("%u: ", lineno);
+
+	if (NULL != msg)
+		print_reply(msg, ", ");
+	else
+		printf("failed: %s\n", strerror(err));
+
+	fflush(stdout);
+}
+
+static void print_invalid(unsigned lineno)
+{
+	printf("%u: invalid request\n", lineno);
+	fflush(stdout);
+}
+
+/* Run batch requests one by one. */
+static int batch_serial(struct cctalk_host *host, struct input *in)
+{
+	char line[sizeof(in->buf) + 1];
+	const struct cctalk_message *msg;
+	uint8_t fields[257];
+	int count, failed = 0;
+
+	while (1) {
+		while (!next_line(in, line)) {
+			if (in->eof)
+				return failed;
+
+			if (-1 == fill(in))
+				error(1, errno, "failed to read batch");
+		}
+
+		if (0 == (count = parse_line(line, fields)))
+			continue;
+
+		if (-1 == count) {
+			print_invalid(in->lineno);
+			failed = 1;
+			continue;
+		}
+
+		msg = NULL;
+
+		if (-1 != cctalk_send(host, fields[0], fields[1], fields + 2,
+		                      count - 2))
+			msg = cctalk_recv_slot(host);
+
+		if (NULL == msg)
+			failed = 1;
+
+		print_result(in->lineno, msg, errno);
+	}
+}
+
+static int batch_inflight, batch_failed;
+
+static void on_batch_reply(struct cctalk_host *host,
+                           const struct cctalk_message *reply, void *arg)
+{
+	if (NULL == reply)
+		batch_failed = 1;
+
+	print_result((uintptr_t)arg, reply, errno);
+	batch_inflight--;
+}
+
+/*
+ * Run batch requests through the bus, reading ahead while they are
+ * on the line.  The line still carries one request at a time, but
+ * the next one leaves as soon as the previous reply arrives.
+ */
+static int batch_pipeline(struct cctalk_host *host, struct input *in)
+{
+	struct cctalk_bus *bus = cctalk_bus_new(host);
+	char line[sizeof(in->buf) + 1];
+	uint8_t fields[257];
+	int count;
+
+	batch_inflight = batch_failed = 0;
+
+	while (1) {
+		struct pollfd pfd[2] = {
+			{host->fd, 0, 0},
+			{in->fd, 0, 0},
+		};
+
+		while (batch_inflight < BATCH_DEPTH && next_line(in, line)) {
+			if (0 == (count = parse_line(line, fields)))
+				continue;
+
+			if (-1 == count) {
+				print_invalid(in->lineno);
+				batch_failed = 1;
+				continue;
+			}
+
+			if (-1 == cctalk_bus_submit(bus, fields[0], fields[1],
+			                            fields + 2, count - 2,
+			                            on_batch_reply,
+			                            (void *)(uintptr_t)in->lineno)) {
+				print_result(in->lineno, NULL, errno);
+				batch_failed = 1;
+				continue;
+			}
+
+			batch_inflight++;
+		}
+
+		if (in->eof && 0 == in->len && 0 == batch_inflight)
+			break;
+
+		/* Read on only when there is room for more requests. */
+		if (!in->eof && batch_inflight < BATCH_DEPTH)
+			pfd[1].events = POLLIN;
+
+		pfd[0].events = cctalk_bus_events(bus);
+
+		if (-1 == poll(pfd, 2, cctalk_bus_next_timeout(bus)) &&
+		    EINTR != errno)
+			error(1, errno, "poll failed");
+
+		if (pfd[1].revents && -1 == fill(in))
+			error(1, errno, "failed to read batch");
+
+		cctalk_bus_dispatch(bus, pfd[0].revents);
+	}
+
+	cctalk_bus_free(bus);
+	return batch_failed;
+}
+
+static int do_batch(int argc, char **argv)
+{
+	struct cctalk_host *host = open_host();
+	struct input in;
+	int i = 0, failed = 0;
+
+	do {
+		const char *path = i < argc ? argv[i] : "-";
+
+		memset(&in, 0, sizeof(in));
+
+		if (0 == strcmp(path, "-"))
+			in.fd = STDIN_FILENO;
+		else if (-1 == (in.fd = open(path, O_RDONLY)))
+			error(1, errno, "failed to open %s", path);
+
+		if (pipeline)
+			failed |= batch_pipeline(host, &in);
+		else
+			failed |= batch_serial(host, &in);
+
+		if (STDIN_FILENO != in.fd)
+			close(in.fd);
+	} while (++i < argc);
+
+	if (stats)
+		print_stats(host);
+
+	cctalk_host_free(host);
+	cctalk_capture_close(capture);
+
+	return failed;
+}
+
+static volatile int monitor_stop = 0;
+static struct cctalk_event_ring *monitor_ring;
+
+/* Counters as of the last monitor report. */
+static struct cctalk_stats monitor_prev;
+
+static void on_monitor_signal(int sig)
+{
+	monitor_stop = 1;
+}
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void print_event(const struct cctalk_event *ev)
+{
+	printf("%i: ", ev->dev->id);
+
+	switch (ev->type) {
+		case CCTALK_EVENT_CREDIT:
+			printf("credit coin=%i sorter=%i", ev->value, ev->sorter);
+			break;
+
+		case CCTALK_EVENT_ERROR:
+			printf("error code=%i", ev->error);
+			break;
+
+		case CCTALK_EVENT_OVERFLOW:
+			printf("overflow lost=%u", ev->lost);
+			break;
+
+		case CCTALK_EVENT_RESET:
+			printf("reset");
+			break;
+
+		case CCTALK_EVENT_BILL_CREDIT:
+			printf("bill credit type=%i", ev->value);
+			break;
+
+		case CCTALK_EVENT_BILL_ESCROW:
+			printf("bill escrow type=%i", ev->value);
+			break;
+
+		case CCTALK_EVENT_BILL_STATUS:
+			printf("bill status=%i", ev->status);
+			break;
+	}
+
+	printf(" seq=%i\n", ev->seq);
+}
+
+static void on_monitor_poll(struct cctalk_device *dev,
+                            const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_credit_info credits;
+	struct cctalk_bill_info bills;
+	struct cctalk_event ev;
+
+	if (NULL == reply)
+		return;
+
+	if (CCTALK_METHOD_READ_BUFFERED_CREDIT_OR_ERROR_CODES == monitor_method &&
+	    0 == cctalk_parse_credits(reply, &credits))
+		cctalk_device_credit_events(dev, &credits, monitor_ring);
+	else if (CCTALK_METHOD_READ_BUFFERED_BILL_EVENTS == monitor_method &&
+	         0 == cctalk_parse_bill_events(reply, &bills))
+		cctalk_device_bill_events(dev, &bills, monitor_ring);
+	else if (0 != reply->header)
+		printf("%i: status=%i\n", dev->id, reply->header);
+
+	while (1 == cctalk_event_ring_pop(monitor_ring, &ev, 1))
+		print_event(&ev);
+}
+
+/* Print rates and latencies since the last report. */
+static void print_rates(struct cctalk_host *host, struct cctalk_bus *bus,
+                        double seconds)
+{
+	static struct cctalk_stats cur, delta;
+	struct cctalk_bus_load load;
+	size_t i;
+	int b;
+
+	cctalk_bus_load(bus, &load, 1);
+	cctalk_host_stats(host, &cur, 0);
+
+	printf("polls/s=%.1f errors=%llu timeouts=%llu late=%llu "
+	       "busy=%.0f%% demand=%.0f%%",
+	       load.polls / seconds, (unsigned long long)load.errors,
+	       (unsigned long long)(cur.timeouts - monitor_prev.timeouts),
+	       (unsigned long long)load.late,
+	       100 * load.utilization, 100 * load.demand);
+
+	for (i = 0; i < bus->nslots; i++) {
+		uint8_t id = bus->slots[i].dev->id;
+
+		for (b = 0; b < CCTALK_RTT_BUCKETS; b++)
+			delta.rtt[id][b] = cur.rtt[id][b] - monitor_prev.rtt[id][b];
+
+		if (-1 == cctalk_stats_rtt_percentile(&delta, id, 50))
+			continue;
+
+		printf(" %i:p50<%lli,p99<%lli", id,
+		       (long long)cctalk_stats_rtt_percentile(&delta, id, 50),
+		       (long long)cctalk_stats_rtt_percentile(&delta, id, 99));
+	}
 
 	printf("\n");
+	monitor_prev = cur;
+}
 
-	free(msg);
+static int do_monitor(int argc, char **argv)
+{
+	struct cctalk_bus_load load;
+	struct cctalk_host *host;
+	struct cctalk_device *dev;
+	struct cctalk_bus *bus;
+	int64_t report, last;
+	int i;
+
+	if (argc < 1)
+		error(1, 0, "no devices to monitor specified");
+
+	host = open_host();
+	bus = cctalk_bus_new(host);
+	monitor_ring = cctalk_event_ring_new(64);
+
+	for (i = 0; i < argc; i++) {
+		if (NULL == (dev = cctalk_device_scan(host, atoi(argv[i]))))
+			error(1, errno, "device %s not found", argv[i]);
+
+		if (-1 == cctalk_bus_add(bus, dev, monitor_method,
+		                         on_monitor_poll, NULL))
+			error(1, errno, "failed to poll device %s", argv[i]);
+
+		if (monitor_interval > 0)
+			bus->slots[bus->nslots - 1].interval = monitor_interval;
+	}
+
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	signal(SIGINT, on_monitor_signal);
+	signal(SIGTERM, on_monitor_signal);
+
+	/* Leave out the scanning. */
+	cctalk_host_stats(host, &monitor_prev, 0);
+	cctalk_bus_load(bus, &load, 1);
+	last = now_ms();
+	report = last + 1000;
+
+	while (!monitor_stop) {
+		struct pollfd pfd = {host->fd, cctalk_bus_events(bus), 0};
+		int wait = cctalk_bus_next_timeout(bus);
+		int64_t now = now_ms();
+
+		if (now >= report) {
+			print_rates(host, bus, (now - last) / 1000.0);
+			last = now;
+			report += 1000;
+			continue;
+		}
+
+		if (-1 == wait || wait > report - now)
+			wait = report - now;
+
+		if (-1 == poll(&pfd, 1, wait)) {
+			if (EINTR == errno)
+				continue;
+
+			error(1, errno, "poll failed");
+		}
+
+		cctalk_bus_dispatch(bus, pfd.revents);
+	}
+
+	if (stats)
+		print_stats(host);
+
+	cctalk_bus_free(bus);
+	cctalk_event_ring_free(monitor_ring);
 	cctalk_host_free(host);
+	cctalk_capture_close(capture);
 
 	return 0;
 }
@@ -126,6 +726,53 @@ int main(int argc, char **argv)
 				action = do_version;
 				break;
 
+			case 'l':
+				action = do_line;
+				break;
+
+			case 'b':
+				line.baudrate = atoi(optarg);
+				break;
+
+			case 'S':
+				stats = 1;
+				break;
+
+			case 'B':
+				action = do_batch;
+				break;
+
+			case 'p':
+				action = do_batch;
+				pipeline = 1;
+				break;
+
+			case 'm':
+				action = do_monitor;
+				break;
+
+			case 'M':
+				if (-1 == (monitor_method = method_by_name(optarg)))
+					monitor_method = atoi(optarg);
+				break;
+
+			case 'I':
+				monitor_interval = atoi(optarg);
+				break;
+
+			case 'C':
+				free(capture_path);
+				capture_path = strdup(optarg);
+				break;
+
+			case 'L':
+				line.low_latency = 1;
+				break;
+
+			case 'T':
+				line.latency_timer = atoi(optarg);
+				break;
+
 			case 'd':
 				free(device);
 				device = strdup(optarg);
@@ -156,6 +803,7 @@ int main(int argc, char **argv)
 
 	result = action(argc - optind, argv + optind);
 
+	free(capture_path);
 	free(device);
 	return result;
 }
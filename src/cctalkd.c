@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "server.h"
+
+#include <error.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static const struct option longopts[] = {
+	{"help",     0, 0, 'h'},
+	{"version",  0, 0, 'V'},
+	{"socket",   1, 0, 's'},
+	{"device",   1, 0, 'd'},
+	{"coins",    1, 0, 'a'},
+	{"bills",    1, 0, 'b'},
+	{"board",    1, 0, 'S'},
+	{"ccitt",    0, 0, 'c'},
+	{"timeout",  1, 0, 't'},
+
+	{0, 0, 0, 0},
+};
+
+static const char optstring[] = "hVs:d:a:b:S:ct:";
+
+static struct server *server;
+static volatile int stop = 0;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static int do_version(void)
+{
+	printf("cctalkd %s\n", VERSION);
+	return 0;
+}
+
+static int do_help(void)
+{
+	puts("cctalkd [--socket=" CCTALKD_SOCKET "] --device=/dev/ttyUSB0...");
+	puts("Share ccTalk serial lines with other processes.");
+	puts("");
+	puts("ACTIONS:");
+	puts("  --help, -h     Display this help.");
+	puts("  --version, -V  Display version information.");
+	puts("");
+	puts("OPTIONS:");
+	puts("  --socket, -s " CCTALKD_SOCKET);
+	puts("                 Where to listen for the clients.");
+	puts("  --device, -d /dev/ttyUSB0");
+	puts("                 Own another serial line, or tcp:node:port of");
+	puts("                 a TCP serial bridge.  Lines are numbered from 0");
+	puts("                 in the order given.");
+	puts("  --coins, -a 2  Poll the coin acceptor on the last line");
+	puts("                 for events, can be repeated.");
+	puts("  --bills, -b 40 Poll the bill validator on the last line");
+	puts("                 for events, can be repeated.");
+	puts("  --board, -S /run/cctalkd-0.board");
+	puts("                 Publish states of the devices polled on the");
+	puts("                 last line, see cctalk_board_map().");
+	puts("  --ccitt, -c    Use 16-bit checksums.");
+	puts("  --timeout, -t 1000");
+	puts("                 Set communication timeout in milliseconds.");
+	puts("");
+	puts("Report bugs to Jan Dvorak <mordae@anilinux.org>.");
+	return 0;
+}
+
+/* Remember address of a device to poll on the last line. */
+static void add_device(int bills, const char *arg)
+{
+	struct server_line *line;
+	uint8_t *addrs;
+	int *count;
+
+	if (0 == server->nlines)
+		error(1, 0, "specify --device before the devices on it");
+
+	line = &server->lines[server->nlines - 1];
+	addrs = bills ? line->bills : line->coins;
+	count = bills ? &line->nbills : &line->ncoins;
+
+	if (16 == *count)
+		error(1, 0, "too many devices to poll");
+
+	addrs[(*count)++] = atoi(arg);
+}
+
+int main(int argc, char **argv)
+{
+	const char *socket_path = CCTALKD_SOCKET;
+	int (*action)(void) = NULL;
+	int c, idx = 0;
+
+	server = server_new();
+
+	while (-1 != (c = getopt_long(argc, argv, optstring, longopts, &idx)))
+		switch (c) {
+			case 'h':
+				action = do_help;
+				break;
+
+			case 'V':
+				action = do_version;
+				break;
+
+			case 's':
+				socket_path = optarg;
+				break;
+
+			case 'd':
+				if (NULL == server_add_line(server, optarg))
+					error(1, 0, "too many lines");
+				break;
+
+			case 'a':
+				add_device(0, optarg);
+				break;
+
+			case 'b':
+				add_device(1, optarg);
+				break;
+
+			case 'S':
+				if (0 == server->nlines)
+					error(1, 0, "specify --device before its board");
+
+				server->lines[server->nlines - 1].board_path = optarg;
+				break;
+
+			case 'c':
+				server->crc_mode = CCTALK_CRC_CCITT;
+				break;
+
+			case 't':
+				server->timeout = atoi(optarg);
+				break;
+
+			case '?':
+				return 1;
+		}
+
+	if (NULL != action)
+		return action();
+
+	if (0 == server->nlines)
+		error(1, 0, "no --device specified");
+
+	server_open(server);
+	server_listen(server, socket_path);
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGPIPE, SIG_IGN);
+
+	server_run(server, &stop);
+
+	fprintf(stderr, "transactions=%llu coalesced=%llu events=%llu\n",
+	        (unsigned long long)server->transactions,
+	        (unsigned long long)server->coalesced,
+	        (unsigned long long)server->events);
+
+	server_free(server);
+	return 0;
+}
@@ -1,7 +1,10 @@
 #!/usr/bin/make -f
 
-bin += cctalk
+bin += cctalk cctalkd cctalk-sim cctalk-dump
 
 cctalk = ../lib/libcctalk.so cctalk.c
+cctalkd = ../lib/libcctalk.so cctalkd.c server.c server.h
+cctalk-sim = ../lib/libcctalk.so cctalk-sim.c sim.c sim.h
+cctalk-dump = ../lib/libcctalk.so cctalk-dump.c
 
 # EOF
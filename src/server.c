@@ -0,0 +1,650 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "server.h"
+
+#include <error.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Clients that fall this many bytes behind are dropped. */
+#define MAX_BACKLOG (256 * 1024)
+
+/* Largest message. */
+#define MESSAGE_MAX (sizeof(struct cctalkd_header) + 255)
+
+/* Client connected to the socket. */
+struct client {
+	struct client *next;
+	int fd;
+
+	/* Received bytes not forming a whole message yet. */
+	uint8_t in[4 * MESSAGE_MAX];
+	size_t inlen;
+
+	/* Bytes waiting for the client to read them. */
+	uint8_t *out;
+	size_t outlen, outsize;
+
+	/* Subscribed devices, one bit per address on every line.
+	 * Address 0 stands for all of them. */
+	uint8_t subscribed[SERVER_MAX_LINES][32];
+
+	/* Disconnected, to be freed. */
+	int dead;
+};
+
+/* Client waiting for the reply to a request. */
+struct waiter {
+	struct waiter *next;
+	struct client *client;
+	uint16_t tag;
+};
+
+/* Request queued on the bus, possibly for several clients. */
+struct pending {
+	struct pending *next;
+	struct server *server;
+	uint8_t line, address, method, length;
+	uint8_t data[255];
+
+	/* Reading request that identical ones can join. */
+	int shared;
+
+	struct waiter *waiters;
+};
+
+struct server *server_new(void)
+{
+	struct server *server = calloc(1, sizeof(*server));
+
+	server->sock = -1;
+	server->crc_mode = CCTALK_CRC_SIMPLE;
+	server->timeout = 1000;
+
+	return server;
+}
+
+struct server_line *server_add_line(struct server *server, const char *path)
+{
+	struct server_line *line;
+
+	if (SERVER_MAX_LINES == server->nlines) {
+		errno = ENOSPC;
+		return NULL;
+	}
+
+	line = &server->lines[server->nlines++];
+	line->server = server;
+	line->path = path;
+	return line;
+}
+
+/* Try to write out everything queued for the client. */
+static void flush_client(struct client *client)
+{
+	ssize_t written;
+
+	while (client->outlen > 0 && !client->dead) {
+		written = write(client->fd, client->out, client->outlen);
+
+		if (-1 == written) {
+			if (EAGAIN != errno && EINTR != errno)
+				client->dead = 1;
+
+			if (EINTR != errno)
+				return;
+
+			continue;
+		}
+
+		client->outlen -= written;
+		memmove(client->out, client->out + written, client->outlen);
+	}
+}
+
+static void send_message(struct client *client,
+                         const struct cctalkd_header *hdr, const void *data)
+{
+	size_t len = sizeof(*hdr) + hdr->length;
+
+	if (client->dead)
+		return;
+
+	/* Do not let a stuck client eat all the memory. */
+	if (client->outlen + len > MAX_BACKLOG) {
+		client->dead = 1;
+		return;
+	}
+
+	if (client->outlen + len > client->outsize) {
+		size_t outsize = 2 * (client->outlen + len);
+		uint8_t *out = realloc(client->out, outsize);
+
+		if (NULL == out) {
+			client->dead = 1;
+			return;
+		}
+
+		client->out = out;
+		client->outsize = outsize;
+	}
+
+	memcpy(client->out + client->outlen, hdr, sizeof(*hdr));
+	memcpy(client->out + client->outlen + sizeof(*hdr), data, hdr->length);
+	client->outlen += len;
+
+	flush_client(client);
+}
+
+/* Answer the client message with just an error code. */
+static void send_status(struct client *client,
+                        const struct cctalkd_header *req, int err)
+{
+	struct cctalkd_header hdr = {
+		.type = CCTALKD_REPLY,
+		.line = req->line,
+		.tag = req->tag,
+		.address = req->address,
+		.error = err,
+	};
+
+	send_message(client, &hdr, NULL);
+}
+
+/* Only requests that merely read something can be shared. */
+static int is_reading(uint8_t method)
+{
+	const char *name = cctalk_method_name(method);
+
+	if (NULL == name)
+		return 0;
+
+	return CCTALK_METHOD_SIMPLE_POLL == method ||
+	       0 == strncmp(name, "REQUEST_", 8) ||
+	       0 == strncmp(name, "READ_", 5);
+}
+
+static void unlink_pending(struct pending *pending)
+{
+	struct pending **p;
+
+	for (p = &pending->server->pendings; *p != pending; p = &(*p)->next);
+	*p = pending->next;
+}
+
+static void free_pending(struct pending *pending)
+{
+	struct waiter *waiter;
+
+	while (NULL != (waiter = pending->waiters)) {
+		pending->waiters = waiter->next;
+		free(waiter);
+	}
+
+	free(pending);
+}
+
+static void on_reply(struct cctalk_host *host,
+                     const struct cctalk_message *reply, void *arg)
+{
+	struct pending *pending = arg;
+	struct waiter *waiter;
+	int err = errno;
+	struct cctalkd_header hdr = {
+		.type = CCTALKD_REPLY,
+		.line = pending->line,
+		.address = pending->address,
+	};
+
+	if (NULL != reply) {
+		hdr.header = reply->header;
+		hdr.length = reply->length;
+	} else {
+		hdr.error = err;
+	}
+
+	for (waiter = pending->waiters; NULL != waiter; waiter = waiter->next) {
+		if (NULL == waiter->client)
+			continue;
+
+		hdr.tag = waiter->tag;
+		send_message(waiter->client, &hdr, reply ? reply->data : NULL);
+	}
+
+	unlink_pending(pending);
+	free_pending(pending);
+}
+
+static void add_waiter(struct pending *pending, struct client *client,
+                       uint16_t tag)
+{
+	struct waiter *waiter = calloc(1, sizeof(*waiter));
+
+	waiter->client = client;
+	waiter->tag = tag;
+	waiter->next = pending->waiters;
+	pending->waiters = waiter;
+}
+
+static void handle_request(struct server *server, struct client *client,
+                           const struct cctalkd_header *hdr,
+                           const uint8_t *data)
+{
+	struct pending *pending;
+	struct server_line *line;
+
+	line = &server->lines[hdr->line];
+
+	if (is_reading(hdr->header)) {
+		for (pending = server->pendings; NULL != pending;
+		     pending = pending->next) {
+			if (pending->shared && pending->line == hdr->line &&
+			    pending->address == hdr->address &&
+			    pending->method == hdr->header &&
+			    pending->length == hdr->length &&
+			    0 == memcmp(pending->data, data, hdr->length)) {
+				add_waiter(pending, client, hdr->tag);
+				server->coalesced++;
+				return;
+			}
+		}
+	}
+
+	pending = calloc(1, sizeof(*pending));
+	pending->server = server;
+	pending->line = hdr->line;
+	pending->address = hdr->address;
+	pending->method = hdr->header;
+	pending->length = hdr->length;
+	pending->shared = is_reading(hdr->header);
+	memcpy(pending->data, data, hdr->length);
+	add_waiter(pending, client, hdr->tag);
+
+	if (-1 == cctalk_bus_submit(line->bus, hdr->address, hdr->header, data,
+	                            hdr->length, on_reply, pending)) {
+		send_status(client, hdr, errno);
+		free_pending(pending);
+		return;
+	}
+
+	pending->next = server->pendings;
+	server->pendings = pending;
+	server->transactions++;
+}
+
+static void handle_message(struct server *server, struct client *client,
+                           const struct cctalkd_header *hdr,
+                           const uint8_t *data)
+{
+	uint8_t *subscribed;
+
+	if (hdr->line >= server->nlines) {
+		send_status(client, hdr, ENODEV);
+		return;
+	}
+
+	subscribed = client->subscribed[hdr->line];
+
+	switch (hdr->type) {
+		case CCTALKD_REQUEST:
+			handle_request(server, client, hdr, data);
+			break;
+
+		case CCTALKD_SUBSCRIBE:
+			subscribed[hdr->address / 8] |= 1 << (hdr->address % 8);
+			send_status(client, hdr, 0);
+			break;
+
+		case CCTALKD_UNSUBSCRIBE:
+			if (0 == hdr->address)
+				memset(subscribed, 0, sizeof(client->subscribed[0]));
+			else
+				subscribed[hdr->address / 8] &=
+					~(1 << (hdr->address % 8));
+
+			send_status(client, hdr, 0);
+			break;
+
+		default:
+			send_status(client, hdr, EINVAL);
+			break;
+	}
+}
+
+/* Read from the client and handle all complete messages. */
+static void read_client(struct server *server, struct client *client)
+{
+	struct cctalkd_header hdr;
+	size_t off = 0, len;
+	ssize_t rread;
+
+	rread = read(client->fd, client->in + client->inlen,
+	             sizeof(client->in) - client->inlen);
+
+	if (0 == rread || (-1 == rread && EAGAIN != errno && EINTR != errno)) {
+		client->dead = 1;
+		return;
+	}
+
+	if (rread < 0)
+		return;
+
+	client->inlen += rread;
+
+	/* Messages are packed, copy the headers out to align them. */
+	while (client->inlen - off >= sizeof(hdr)) {
+		memcpy(&hdr, client->in + off, sizeof(hdr));
+		len = sizeof(hdr) + hdr.length;
+
+		if (client->inlen - off < len)
+			break;
+
+		handle_message(server, client, &hdr,
+		               client->in + off + sizeof(hdr));
+		off += len;
+	}
+
+	client->inlen -= off;
+	memmove(client->in, client->in + off, client->inlen);
+}
+
+/* Hand the new events of the line over to its subscribers. */
+static void broadcast_events(struct server_line *line)
+{
+	struct server *server = line->server;
+	struct cctalkd_header hdr = {.type = CCTALKD_EVENT};
+	struct cctalkd_event data;
+	struct cctalk_event ev;
+	struct client *client;
+
+	hdr.line = line - server->lines;
+	hdr.length = sizeof(data);
+
+	while (1 == cctalk_event_ring_pop(line->ring, &ev, 1)) {
+		hdr.address = ev.dev->id;
+		hdr.header = ev.type;
+
+		data = (struct cctalkd_event){
+			.seq = ev.seq,
+			.value = ev.value,
+			.sorter = ev.sorter,
+			.error = ev.error,
+			.status = ev.status,
+			.lost = ev.lost < UINT16_MAX ? ev.lost : UINT16_MAX,
+		};
+
+		server->events++;
+
+		for (client = server->clients; NULL != client; client = client->next) {
+			const uint8_t *subscribed = client->subscribed[hdr.line];
+
+			if ((subscribed[0] & 1) ||
+			    (subscribed[hdr.address / 8] & (1 << (hdr.address % 8))))
+				send_message(client, &hdr, &data);
+		}
+	}
+}
+
+static void on_coins(struct cctalk_device *dev,
+                     const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_credit_info info;
+	struct server_line *line = arg;
+
+	if (NULL != reply && 0 == cctalk_parse_credits(reply, &info)) {
+		cctalk_device_credit_events(dev, &info, line->ring);
+		broadcast_events(line);
+	}
+}
+
+static void on_bills(struct cctalk_device *dev,
+                     const struct cctalk_message *reply, void *arg)
+{
+	struct cctalk_bill_info info;
+	struct server_line *line = arg;
+
+	if (NULL != reply && 0 == cctalk_parse_bill_events(reply, &info)) {
+		cctalk_device_bill_events(dev, &info, line->ring);
+		broadcast_events(line);
+	}
+}
+
+/* Scan the device and start polling it for events. */
+static void poll_device(struct server_line *line, uint8_t address,
+                        enum cctalk_method method, cctalk_poll_cb callback)
+{
+	struct cctalk_device *dev;
+
+	if (NULL == (dev = cctalk_device_scan(line->host, address)))
+		error(1, errno, "%s: device %i not found", line->path, address);
+
+	if (-1 == cctalk_bus_add(line->bus, dev, method, callback, line))
+		error(1, errno, "%s: failed to poll device %i", line->path,
+		      address);
+}
+
+static void open_line(struct server_line *line)
+{
+	int i;
+
+	if (NULL == (line->host = cctalk_host_new(line->path)))
+		error(1, errno, "failed to open device %s", line->path);
+
+	line->host->crc_mode = line->server->crc_mode;
+	line->host->timeout = line->server->timeout;
+	line->bus = cctalk_bus_new(line->host);
+	line->ring = cctalk_event_ring_new(64);
+
+	if (NULL != line->board_path &&
+	    NULL == (line->bus->board = cctalk_board_open(line->board_path)))
+		error(1, errno, "failed to open board %s", line->board_path);
+
+	for (i = 0; i < line->ncoins; i++)
+		poll_device(line, line->coins[i],
+		            CCTALK_METHOD_READ_BUFFERED_CREDIT_OR_ERROR_CODES,
+		            on_coins);
+
+	for (i = 0; i < line->nbills; i++)
+		poll_device(line, line->bills[i],
+		            CCTALK_METHOD_READ_BUFFERED_BILL_EVENTS, on_bills);
+}
+
+void server_open(struct server *server)
+{
+	int i;
+
+	for (i = 0; i < server->nlines; i++)
+		open_line(&server->lines[i]);
+}
+
+void server_listen(struct server *server, const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		error(1, 0, "socket path %s too long", path);
+
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+	if (-1 == fd)
+		error(1, errno, "failed to create socket");
+
+	unlink(path);
+
+	if (-1 == bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    -1 == listen(fd, 16))
+		error(1, errno, "failed to listen on %s", path);
+
+	server->sock = fd;
+	server->path = path;
+}
+
+static void accept_client(struct server *server)
+{
+	struct client *client;
+	int fd;
+
+	fd = accept4(server->sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+	if (-1 == fd)
+		return;
+
+	client = calloc(1, sizeof(*client));
+	client->fd = fd;
+	client->next = server->clients;
+	server->clients = client;
+}
+
+/* Free disconnected clients, forgetting their requests. */
+static void reap_clients(struct server *server)
+{
+	struct client **p = &server->clients, *client;
+	struct pending *pending;
+	struct waiter *waiter;
+
+	while (NULL != (client = *p)) {
+		if (!client->dead) {
+			p = &client->next;
+			continue;
+		}
+
+		for (pending = server->pendings; NULL != pending;
+		     pending = pending->next)
+			for (waiter = pending->waiters; waiter; waiter = waiter->next)
+				if (waiter->client == client)
+					waiter->client = NULL;
+
+		*p = client->next;
+		close(client->fd);
+		free(client->out);
+		free(client);
+	}
+}
+
+void server_run(struct server *server, volatile int *stop)
+{
+	struct server_line *lines = server->lines;
+	int i, wait, nlines = server->nlines;
+	struct client *client;
+	size_t nclients, n;
+
+	while (!*stop) {
+		for (nclients = 0, client = server->clients; client;
+		     client = client->next)
+			nclients++;
+
+		struct pollfd pfd[1 + nlines + nclients];
+
+		pfd[0] = (struct pollfd){server->sock, POLLIN, 0};
+		wait = -1;
+
+		for (i = 0; i < nlines; i++) {
+			int left = cctalk_bus_next_timeout(lines[i].bus);
+
+			pfd[1 + i] = (struct pollfd){
+				lines[i].host->fd, cctalk_bus_events(lines[i].bus), 0,
+			};
+
+			if (left >= 0 && (wait < 0 || left < wait))
+				wait = left;
+		}
+
+		/* Look at the stop flag every now and then. */
+		if (wait < 0 || wait > 100)
+			wait = 100;
+
+		for (n = 1 + nlines, client = server->clients; client;
+		     client = client->next)
+			pfd[n++] = (struct pollfd){
+				client->fd, POLLIN | (client->outlen ? POLLOUT : 0), 0,
+			};
+
+		if (-1 == poll(pfd, n, wait)) {
+			if (EINTR == errno)
+				continue;
+
+			error(1, errno, "poll failed");
+		}
+
+		for (i = 0; i < nlines; i++)
+			cctalk_bus_dispatch(lines[i].bus, pfd[1 + i].revents);
+
+		for (n = 1 + nlines, client = server->clients; client;
+		     client = client->next) {
+			short revents = pfd[n++].revents;
+
+			if (revents & POLLOUT)
+				flush_client(client);
+
+			if (revents & (POLLIN | POLLHUP | POLLERR))
+				read_client(server, client);
+		}
+
+		reap_clients(server);
+
+		if (pfd[0].revents & POLLIN)
+			accept_client(server);
+	}
+}
+
+void server_free(struct server *server)
+{
+	struct server_line *line;
+	int i;
+
+	if (NULL == server)
+		return;
+
+	for (; NULL != server->clients; reap_clients(server))
+		server->clients->dead = 1;
+
+	for (i = 0; i < server->nlines; i++) {
+		line = &server->lines[i];
+
+		if (NULL == line->bus)
+			continue;
+
+		cctalk_board_close(line->bus->board);
+		cctalk_bus_free(line->bus);
+		cctalk_event_ring_free(line->ring);
+		cctalk_host_free(line->host);
+	}
+
+	/* Requests the buses never got to. */
+	while (NULL != server->pendings) {
+		struct pending *pending = server->pendings;
+
+		server->pendings = pending->next;
+		free_pending(pending);
+	}
+
+	if (-1 != server->sock) {
+		close(server->sock);
+		unlink(server->path);
+	}
+
+	free(server);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SERVER_H
+#define _SERVER_H 1
+
+#include "cctalk.h"
+
+#include <stdint.h>
+
+/* Serial lines a single daemon can own. */
+#define SERVER_MAX_LINES 8
+
+/* Serial line owned by the daemon. */
+struct server_line {
+	struct server *server;
+
+	const char *path;
+	struct cctalk_host *host;
+	struct cctalk_bus *bus;
+	struct cctalk_event_ring *ring;
+
+	/* Devices to poll for coin and bill events. */
+	uint8_t coins[16], bills[16];
+	int ncoins, nbills;
+
+	/* Where to publish states of the polled devices. */
+	const char *board_path;
+};
+
+/* Daemon sharing the lines with clients on a Unix domain socket. */
+struct server {
+	/* Listening socket and its path, see server_listen(). */
+	int sock;
+	const char *path;
+
+	struct server_line lines[SERVER_MAX_LINES];
+	int nlines;
+
+	/* Settings of all the lines. */
+	enum cctalk_crc_mode crc_mode;
+	int timeout;
+
+	/* Connected clients and requests on the buses. */
+	struct client *clients;
+	struct pending *pendings;
+
+	/* Transactions carried out, requests that joined them
+	 * and events delivered. */
+	uint64_t transactions, coalesced, events;
+};
+
+/* Create the daemon without any lines. */
+struct server *server_new(void);
+
+/* Disconnect the clients, close the lines and free the daemon. */
+void server_free(struct server *server);
+
+/* Add another line, returns NULL when there are too many. */
+struct server_line *server_add_line(struct server *server, const char *path);
+
+/* Open all the lines and scan their polled devices.
+ * Reports the problem and exits on failure. */
+void server_open(struct server *server);
+
+/* Start listening on given socket path.  Exits on failure. */
+void server_listen(struct server *server, const char *path);
+
+/* Serve the clients until stop gets set. */
+void server_run(struct server *server, volatile int *stop);
+
+
+#endif				/* !_SERVER_H */
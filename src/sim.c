@@ -0,0 +1,942 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "sim.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Status of negative acknowledgement. */
+#define NAK 5
+
+/* How long validators hold bills in escrow, in microseconds. */
+#define ESCROW_HOLD 5000000
+
+/* How many recorded requests can the host skip at once
+ * and still be considered to follow the trace. */
+#define REPLAY_WINDOW 64
+
+static int64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Bitwise CRC-16-CCITT, independent from the library one on purpose. */
+static uint16_t ccitt(uint16_t crc, const uint8_t *data, size_t len)
+{
+	size_t i;
+	int bit;
+
+	for (i = 0; i < len; i++) {
+		crc ^= data[i] << 8;
+
+		for (bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+/* Compute checksum of the frame in the buffer and store it there. */
+static void seal(const struct sim *sim, uint8_t *frame)
+{
+	size_t len = 4 + frame[1];
+	uint8_t sum = 0;
+	uint16_t crc;
+	size_t i;
+
+	if (CCTALK_CRC_CCITT == sim->crc_mode) {
+		crc = ccitt(0, frame, 2);
+		crc = ccitt(crc, frame + 3, len - 3);
+		frame[2] = crc & 0xff;
+		frame[len] = crc >> 8;
+		return;
+	}
+
+	for (i = 0; i < len; i++)
+		sum += frame[i];
+
+	frame[len] = -sum;
+}
+
+static int intact(const struct sim *sim, const uint8_t *frame)
+{
+	uint8_t copy[5 + 255];
+
+	memcpy(copy, frame, 5 + frame[1]);
+	seal(sim, copy);
+
+	return 0 == memcmp(copy, frame, 5 + frame[1]);
+}
+
+struct sim *sim_new(char *path, size_t size)
+{
+	struct sim *sim;
+	int fd;
+
+	if (-1 == (fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK)))
+		return NULL;
+
+	if (-1 == grantpt(fd) || -1 == unlockpt(fd) ||
+	    0 != ptsname_r(fd, path, size)) {
+		close(fd);
+		return NULL;
+	}
+
+	sim = calloc(1, sizeof(*sim));
+	sim->fd = fd;
+	sim->echo = 1;
+	sim->payout_rate = 5;
+	sim->seed[0] = 0x330e;
+	sim->now = now_us();
+
+	return sim;
+}
+
+void sim_attach(struct sim *sim, int fd)
+{
+	close(sim->fd);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	sim->fd = fd;
+}
+
+static void replay_free(struct sim_replay *rp)
+{
+	if (NULL == rp)
+		return;
+
+	free(rp->pool);
+	free(rp->chunks);
+	free(rp->exchanges);
+	free(rp);
+}
+
+void sim_free(struct sim *sim)
+{
+	if (NULL == sim)
+		return;
+
+	close(sim->fd);
+	free(sim->devices);
+	replay_free(sim->replay);
+	free(sim);
+}
+
+struct sim_device *sim_add(struct sim *sim, enum sim_kind kind,
+                           uint8_t address)
+{
+	struct sim_device *devs, *dev;
+
+	devs = realloc(sim->devices, (sim->ndevices + 1) * sizeof(*devs));
+
+	if (NULL == devs)
+		return NULL;
+
+	sim->devices = devs;
+	dev = &devs[sim->ndevices++];
+
+	*dev = (struct sim_device){
+		.kind = kind,
+		.address = address,
+		.serial = 0x100000 + address,
+		.poll_units = 2,
+		.poll_value = 10,
+		.master_enable = 1,
+		.inhibit_mask = 0xffff,
+		.stock = 1000,
+	};
+
+	return dev;
+}
+
+static struct sim_device *find_device(struct sim *sim, uint8_t address)
+{
+	size_t i;
+
+	for (i = 0; i < sim->ndevices; i++)
+		if (sim->devices[i].address == address)
+			return &sim->devices[i];
+
+	return NULL;
+}
+
+/* Queue bytes to be written after given delay.  The jitter is
+ * added before every single byte. */
+static void queue(struct sim *sim, const uint8_t *data, size_t len,
+                  int64_t delay, int jitter)
+{
+	int64_t due = now_us() + delay;
+	size_t i;
+
+	if (sim->txhead > 0 && sim->txlen + len > sizeof(sim->txbuf) /
+	                                          sizeof(*sim->txbuf)) {
+		sim->txlen -= sim->txhead;
+		memmove(sim->txbuf, sim->txbuf + sim->txhead,
+		        sim->txlen * sizeof(*sim->txbuf));
+		sim->txhead = 0;
+	}
+
+	/* Keep the order of the bytes. */
+	if (sim->txlen > sim->txhead && sim->txbuf[sim->txlen - 1].due > due)
+		due = sim->txbuf[sim->txlen - 1].due;
+
+	for (i = 0; i < len; i++) {
+		if (sim->txlen == sizeof(sim->txbuf) / sizeof(*sim->txbuf))
+			return;
+
+		if (jitter > 0)
+			due += erand48(sim->seed) * jitter;
+
+		sim->txbuf[sim->txlen].due = due;
+		sim->txbuf[sim->txlen].value = data[i];
+		sim->txlen++;
+	}
+}
+
+/* Answer the request. */
+static void reply(struct sim *sim, const struct sim_device *dev,
+                  const uint8_t *req, uint8_t status,
+                  const void *data, uint8_t len)
+{
+	uint8_t frame[5 + 255];
+	size_t i;
+
+	frame[0] = CCTALK_CRC_CCITT == sim->crc_mode ? 1 : req[2];
+	frame[1] = len;
+	frame[2] = dev->address;
+	frame[3] = status;
+	memcpy(frame + 4, data, len);
+	seal(sim, frame);
+
+	for (i = 0; i < 5u + len; i++)
+		if (sim->corrupt > 0 && erand48(sim->seed) < sim->corrupt)
+			frame[i] ^= 1 << (int)(erand48(sim->seed) * 8);
+
+	queue(sim, frame, 5 + len, sim->latency, sim->jitter);
+	sim->replies++;
+}
+
+static void ack(struct sim *sim, const struct sim_device *dev,
+                const uint8_t *req)
+{
+	reply(sim, dev, req, 0, NULL, 0);
+}
+
+static void reply_string(struct sim *sim, const struct sim_device *dev,
+                         const uint8_t *req, const char *str)
+{
+	reply(sim, dev, req, 0, str, strlen(str));
+}
+
+/* Record single event into the device buffer. */
+static void push_event(struct sim_device *dev, uint8_t a, uint8_t b)
+{
+	memmove(dev->events[1], dev->events[0], 4 * sizeof(dev->events[0]));
+	dev->events[0][0] = a;
+	dev->events[0][1] = b;
+	dev->counter = 255 == dev->counter ? 1 : dev->counter + 1;
+}
+
+static void insert_coin(struct sim *sim, struct sim_device *dev)
+{
+	int coin = 1 + erand48(sim->seed) * 16;
+
+	if (dev->inhibit_mask & (1 << (coin - 1)))
+		push_event(dev, coin, 1);
+	else
+		push_event(dev, 0, CCTALK_AE_INHIBITED_COIN);
+}
+
+/* Bills wait in escrow, others are refused until it is free. */
+static void insert_bill(struct sim *sim, struct sim_device *dev)
+{
+	int bill = 1 + erand48(sim->seed) * 16;
+
+	if (dev->escrow)
+		return;
+
+	if (!(dev->inhibit_mask & (1 << (bill - 1)))) {
+		push_event(dev, 0, CCTALK_BS_INHIBITED_BILL_SERIAL);
+		return;
+	}
+
+	dev->escrow = bill;
+	dev->escrow_until = sim->now + ESCROW_HOLD;
+	push_event(dev, bill, 1);
+}
+
+/* Let the time pass for all the devices. */
+static void advance(struct sim *sim)
+{
+	int64_t now = now_us();
+	double dt = (now - sim->now) / 1e6;
+	size_t i;
+
+	sim->now = now;
+
+	for (i = 0; i < sim->ndevices; i++) {
+		struct sim_device *dev = &sim->devices[i];
+
+		if (SIM_ACCEPTOR == dev->kind && dev->master_enable) {
+			dev->pending_coins += sim->coin_rate * dt;
+
+			for (; dev->pending_coins >= 1; dev->pending_coins--)
+				insert_coin(sim, dev);
+		}
+
+		if (SIM_VALIDATOR == dev->kind && dev->master_enable) {
+			dev->pending_bills += sim->bill_rate * dt;
+
+			for (; dev->pending_bills >= 1; dev->pending_bills--)
+				insert_bill(sim, dev);
+		}
+
+		/* Nobody decided in time, give the bill back. */
+		if (dev->escrow && dev->escrow_until <= now) {
+			dev->escrow = 0;
+			push_event(dev, 0, CCTALK_BS_RETURNED_FROM_ESCROW);
+		}
+
+		if (SIM_HOPPER == dev->kind && dev->remaining > 0) {
+			dev->pending_payout += sim->payout_rate * dt;
+
+			for (; dev->pending_payout >= 1 && dev->remaining;
+			     dev->pending_payout--) {
+				if (0 == dev->stock) {
+					dev->unpaid += dev->remaining;
+					dev->remaining = 0;
+					break;
+				}
+
+				dev->stock--;
+				dev->paid++;
+				dev->remaining--;
+			}
+
+			if (0 == dev->remaining)
+				dev->pending_payout = 0;
+		}
+	}
+}
+
+static void handle_common(struct sim *sim, struct sim_device *dev,
+                          const uint8_t *req)
+{
+	static const uint8_t comms_revision[3] = {1, 4, 6};
+	uint8_t data[3];
+
+	switch (req[3]) {
+		case CCTALK_METHOD_SIMPLE_POLL:
+			ack(sim, dev, req);
+			break;
+
+		case CCTALK_METHOD_REQUEST_COMMS_REVISION:
+			reply(sim, dev, req, 0, comms_revision, 3);
+			break;
+
+		case CCTALK_METHOD_REQUEST_MANUFACTURER_ID:
+			reply_string(sim, dev, req, "SIM");
+			break;
+
+		case CCTALK_METHOD_REQUEST_PRODUCT_CODE:
+			reply_string(sim, dev, req, "Simulator");
+			break;
+
+		case CCTALK_METHOD_REQUEST_SOFTWARE_REVISION:
+			reply_string(sim, dev, req, VERSION);
+			break;
+
+		case CCTALK_METHOD_REQUEST_SERIAL_NUMBER:
+			data[0] = dev->serial;
+			data[1] = dev->serial >> 8;
+			data[2] = dev->serial >> 16;
+			reply(sim, dev, req, 0, data, 3);
+			break;
+
+		case CCTALK_METHOD_REQUEST_EQUIPMENT_CATEGORY_ID:
+			if (SIM_HOPPER == dev->kind)
+				reply_string(sim, dev, req, "Payout");
+			else if (SIM_VALIDATOR == dev->kind)
+				reply_string(sim, dev, req, "Bill Validator");
+			else
+				reply_string(sim, dev, req, "Coin Acceptor");
+			break;
+
+		case CCTALK_METHOD_REQUEST_POLLING_PRIORITY:
+			data[0] = dev->poll_units;
+			data[1] = dev->poll_value;
+			reply(sim, dev, req, 0, data, 2);
+			break;
+
+		default:
+			/* Real devices ignore what they do not understand. */
+			break;
+	}
+}
+
+static void handle_acceptor(struct sim *sim, struct sim_device *dev,
+                            const uint8_t *req)
+{
+	const uint8_t *args = req + 4;
+	uint8_t data[11];
+	int i;
+
+	switch (req[3]) {
+		case CCTALK_METHOD_RESET_DEVICE:
+			dev->counter = 0;
+			memset(dev->events, 0, sizeof(dev->events));
+			ack(sim, dev, req);
+			break;
+
+		case CCTALK_METHOD_REQUEST_MASTER_INHIBIT_STATUS:
+			reply(sim, dev, req, 0, &dev->master_enable, 1);
+			break;
+
+		case CCTALK_METHOD_MODIFY_MASTER_INHIBIT_STATUS:
+			if (req[1] < 1)
+				break;
+
+			dev->master_enable = args[0] & 1;
+			ack(sim, dev, req);
+			break;
+
+		case CCTALK_METHOD_REQUEST_INHIBIT_STATUS:
+			data[0] = dev->inhibit_mask;
+			data[1] = dev->inhibit_mask >> 8;
+			reply(sim, dev, req, 0, data, 2);
+			break;
+
+		case CCTALK_METHOD_MODIFY_INHIBIT_STATUS:
+			if (req[1] < 2)
+				break;
+
+			dev->inhibit_mask = args[0] | (args[1] << 8);
+			ack(sim, dev, req);
+			break;
+
+		case CCTALK_METHOD_READ_BUFFERED_CREDIT_OR_ERROR_CODES:
+			data[0] = dev->counter;
+
+			for (i = 0; i < 5; i++) {
+				data[1 + 2 * i] = dev->events[i][0];
+				data[2 + 2 * i] = dev->events[i][1];
+			}
+
+			reply(sim, dev, req, 0, data, 11);
+			break;
+
+		default:
+			handle_common(sim, dev, req);
+			break;
+	}
+}
+
+static void handle_hopper(struct sim *sim, struct sim_device *dev,
+                          const uint8_t *req)
+{
+	const uint8_t *args = req + 4;
+	uint8_t data[4];
+
+	switch (req[3]) {
+		case CCTALK_METHOD_ENABLE_HOPPER:
+			if (req[1] < 1)
+				break;
+
+			dev->enabled = 165 == args[0];
+			ack(sim, dev, req);
+			break;
+
+		case CCTALK_METHOD_TEST_HOPPER:
+			data[0] = dev->stock ? 0 : 1;
+			reply(sim, dev, req, 0, data, 1);
+			break;
+
+		case CCTALK_METHOD_REQUEST_HOPPER_STATUS:
+			data[0] = dev->hopper_counter;
+			data[1] = dev->remaining;
+			data[2] = dev->paid;
+			data[3] = dev->unpaid;
+			reply(sim, dev, req, 0, data, 4);
+			break;
+
+		case CCTALK_METHOD_DISPENSE_HOPPER_COINS:
+			if (req[1] < 1 || !dev->enabled || dev->remaining) {
+				reply(sim, dev, req, NAK, NULL, 0);
+				break;
+			}
+
+			/* Count follows the optional security bytes. */
+			dev->hopper_counter = 255 == dev->hopper_counter ?
+			                      1 : dev->hopper_counter + 1;
+			dev->remaining = args[req[1] - 1];
+			dev->paid = dev->unpaid = 0;
+			dev->pending_payout = 0;
+			reply(sim, dev, req, 0, &dev->hopper_counter, 1);
+			break;
+
+		case CCTALK_METHOD_EMERGENCY_STOP:
+			data[0] = dev->remaining;
+			dev->unpaid += dev->remaining;
+			dev->remaining = 0;
+			dev->enabled = 0;
+			reply(sim, dev, req, 0, data, 1);
+			break;
+
+		default:
+			handle_common(sim, dev, req);
+			break;
+	}
+}
+
+static void handle_validator(struct sim *sim, struct sim_device *dev,
+                             const uint8_t *req)
+{
+	const uint8_t *args = req + 4;
+	uint8_t data[11];
+	char id[8];
+	int i;
+
+	switch (req[3]) {
+		case CCTALK_METHOD_READ_BUFFERED_BILL_EVENTS:
+			data[0] = dev->counter;
+
+			for (i = 0; i < 5; i++) {
+				data[1 + 2 * i] = dev->events[i][0];
+				data[2 + 2 * i] = dev->events[i][1];
+			}
+
+			reply(sim, dev, req, 0, data, 11);
+			break;
+
+		case CCTALK_METHOD_ROUTE_BILL:
+			if (req[1] < 1)
+				break;
+
+			if (!dev->escrow) {
+				data[0] = 254;
+				reply(sim, dev, req, 0, data, 1);
+				break;
+			}
+
+			if (CCTALK_BILL_STACK == args[0]) {
+				push_event(dev, dev->escrow, 0);
+				dev->escrow = 0;
+			} else if (CCTALK_BILL_RETURN == args[0]) {
+				push_event(dev, 0, CCTALK_BS_RETURNED_FROM_ESCROW);
+				dev->escrow = 0;
+			} else {
+				dev->escrow_until = sim->now + ESCROW_HOLD;
+			}
+
+			ack(sim, dev, req);
+			break;
+
+		case CCTALK_METHOD_REQUEST_BILL_ID:
+			if (req[1] < 1 || args[0] < 1 || args[0] > 16)
+				break;
+
+			snprintf(id, sizeof(id), "EU%04iA", 5 * args[0]);
+			reply_string(sim, dev, req, id);
+			break;
+
+		case CCTALK_METHOD_READ_BUFFERED_CREDIT_OR_ERROR_CODES:
+			/* Coins only. */
+			break;
+
+		default:
+			handle_acceptor(sim, dev, req);
+			break;
+	}
+}
+
+/* Every device answers with its address after 4 ms per address. */
+static void address_poll(struct sim *sim)
+{
+	size_t i;
+
+	for (i = 0; i < sim->ndevices; i++)
+		queue(sim, &sim->devices[i].address, 1,
+		      sim->devices[i].address * 4000, 0);
+}
+
+int sim_replay(struct sim *sim, const char *path, double speed)
+{
+	const struct cctalk_capture_record *rec;
+	struct sim_exchange *ex = NULL;
+	struct cctalk_capture *cap;
+	size_t nchunks = 0, nbytes = 0, nexchanges = 0, off = 0, chunk = 0;
+	struct sim_replay *rp;
+	int64_t start = 0;
+	uint64_t pos;
+
+	if (NULL == (cap = cctalk_capture_map(path)))
+		return -1;
+
+	/* Size everything up first, the trace can be long. */
+	pos = cctalk_capture_header(cap)->tail;
+
+	while (NULL != (rec = cctalk_capture_next(cap, &pos))) {
+		if (CCTALK_CAPTURE_TX == rec->type)
+			nexchanges++;
+		else
+			nchunks++;
+
+		nbytes += rec->size;
+	}
+
+	rp = calloc(1, sizeof(*rp));
+	rp->speed = speed > 0 ? speed : 1;
+	rp->pool = malloc(nbytes + 1);
+	rp->chunks = calloc(nchunks + 1, sizeof(*rp->chunks));
+	rp->exchanges = calloc(nexchanges + 1, sizeof(*rp->exchanges));
+
+	pos = cctalk_capture_header(cap)->tail;
+
+	while (NULL != (rec = cctalk_capture_next(cap, &pos))) {
+		int64_t time;
+
+		/* Replies to requests that were overwritten. */
+		if (NULL == ex && CCTALK_CAPTURE_TX != rec->type)
+			continue;
+
+		if (NULL == ex) {
+			start = rec->time;
+			sim->crc_mode = (rec->flags & CCTALK_CAPTURE_CCITT) ?
+			                CCTALK_CRC_CCITT : CCTALK_CRC_SIMPLE;
+		}
+
+		time = rec->time - start;
+		memcpy(rp->pool + off, rec->data, rec->size);
+
+		if (CCTALK_CAPTURE_TX == rec->type) {
+			ex = &rp->exchanges[rp->nexchanges++];
+			ex->time = time;
+			ex->off = off;
+			ex->len = rec->size;
+			ex->chunk = chunk;
+		} else {
+			ex->nchunks++;
+			rp->chunks[chunk++] = (struct sim_chunk){
+				.delay = time > ex->time ? time - ex->time : 0,
+				.off = off,
+				.len = rec->size,
+			};
+		}
+
+		off += rec->size;
+	}
+
+	cctalk_capture_close(cap);
+
+	replay_free(sim->replay);
+	sim->replay = rp;
+	return 0;
+}
+
+int sim_replay_done(const struct sim *sim)
+{
+	return NULL != sim->replay &&
+	       sim->replay->next == sim->replay->nexchanges;
+}
+
+static int same_request(const struct sim_replay *rp,
+                        const struct sim_exchange *ex,
+                        const uint8_t *req, size_t len)
+{
+	return ex->len == len && 0 == memcmp(rp->pool + ex->off, req, len);
+}
+
+/* Delay of the last reply chunk to the request. */
+static int64_t reply_delay(const struct sim_replay *rp,
+                           const struct sim_exchange *ex)
+{
+	return ex->nchunks ? rp->chunks[ex->chunk + ex->nchunks - 1].delay : 0;
+}
+
+/* Write out the recorded replies with their recorded delays. */
+static void serve(struct sim *sim, const struct sim_exchange *ex)
+{
+	struct sim_replay *rp = sim->replay;
+	size_t i;
+
+	for (i = 0; i < ex->nchunks; i++) {
+		const struct sim_chunk *chunk = &rp->chunks[ex->chunk + i];
+
+		queue(sim, rp->pool + chunk->off, chunk->len,
+		      chunk->delay / rp->speed, 0);
+	}
+
+	if (ex->nchunks > 0)
+		sim->replies++;
+}
+
+static void replay_request(struct sim *sim, const uint8_t *req)
+{
+	struct sim_replay *rp = sim->replay;
+	size_t len = 5 + req[1], end = rp->next + REPLAY_WINDOW, i;
+	const struct sim_exchange *ex;
+	int64_t now = now_us();
+
+	if (end > rp->nexchanges)
+		end = rp->nexchanges;
+
+	for (i = rp->next; i < end; i++)
+		if (same_request(rp, &rp->exchanges[i], req, len))
+			break;
+
+	if (i == end) {
+		rp->extra++;
+		rp->extra_methods[req[3]]++;
+
+		/* Answer the way the device did the last time. */
+		for (i = rp->next; i-- > 0;) {
+			if (same_request(rp, &rp->exchanges[i], req, len)) {
+				rp->substituted++;
+				serve(sim, &rp->exchanges[i]);
+				break;
+			}
+		}
+
+		return;
+	}
+
+	for (; rp->next < i; rp->next++) {
+		rp->skipped++;
+		rp->skipped_methods[rp->pool[rp->exchanges[rp->next].off + 3]]++;
+	}
+
+	ex = &rp->exchanges[rp->next++];
+	rp->matched++;
+
+	if (NULL != rp->last) {
+		rp->orig_interval += ex->time - rp->last->time;
+		rp->interval += now - rp->last_at;
+		rp->intervals++;
+
+		if (rp->last->nchunks > 0) {
+			rp->orig_turnaround += ex->time - rp->last->time -
+			                       reply_delay(rp, rp->last);
+			rp->turnaround += now - rp->last_done;
+			rp->turnarounds++;
+		}
+	}
+
+	rp->last = ex;
+	rp->last_at = now;
+	rp->last_done = now + reply_delay(rp, ex) / rp->speed;
+
+	serve(sim, ex);
+}
+
+/* Print mean of the recorded and the replayed durations. */
+static void report_mean(FILE *out, const char *what, double speed,
+                        int64_t orig, int64_t replayed, uint64_t count)
+{
+	if (0 == count)
+		return;
+
+	fprintf(out, "%s: recorded=%.3f replayed=%.3f ms\n", what,
+	        orig / speed / count / 1000.0, (double)replayed / count / 1000.0);
+}
+
+static void report_methods(FILE *out, const char *what,
+                           const uint64_t *counts)
+{
+	const char *name;
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		if (0 == counts[i])
+			continue;
+
+		if (NULL != (name = cctalk_method_name(i)))
+			fprintf(out, "%s %s: %llu\n", what, name,
+			        (unsigned long long)counts[i]);
+		else
+			fprintf(out, "%s method-%i: %llu\n", what, i,
+			        (unsigned long long)counts[i]);
+	}
+}
+
+void sim_replay_report(const struct sim *sim, FILE *out)
+{
+	const struct sim_replay *rp = sim->replay;
+
+	if (NULL == rp)
+		return;
+
+	fprintf(out, "replay: matched=%llu skipped=%llu extra=%llu "
+	        "substituted=%llu left=%zu\n",
+	        (unsigned long long)rp->matched,
+	        (unsigned long long)rp->skipped,
+	        (unsigned long long)rp->extra,
+	        (unsigned long long)rp->substituted,
+	        rp->nexchanges - rp->next);
+
+	report_mean(out, "interval", rp->speed, rp->orig_interval,
+	            rp->interval, rp->intervals);
+	report_mean(out, "turnaround", rp->speed, rp->orig_turnaround,
+	            rp->turnaround, rp->turnarounds);
+	report_methods(out, "skipped", rp->skipped_methods);
+	report_methods(out, "extra", rp->extra_methods);
+}
+
+static void handle(struct sim *sim, const uint8_t *req)
+{
+	struct sim_device *dev;
+
+	sim->frames++;
+
+	if (NULL != sim->replay) {
+		replay_request(sim, req);
+		return;
+	}
+
+	if (0 == req[0] && CCTALK_METHOD_ADDRESS_POLL == req[3]) {
+		address_poll(sim);
+		return;
+	}
+
+	if (NULL == (dev = find_device(sim, req[0])))
+		return;
+
+	advance(sim);
+
+	if (SIM_HOPPER == dev->kind)
+		handle_hopper(sim, dev, req);
+	else if (SIM_VALIDATOR == dev->kind)
+		handle_validator(sim, dev, req);
+	else
+		handle_acceptor(sim, dev, req);
+}
+
+/* Pick complete frames from the receive buffer. */
+static void parse(struct sim *sim)
+{
+	size_t off = 0;
+
+	while (sim->rxlen - off >= 5) {
+		const uint8_t *frame = sim->rxbuf + off;
+		size_t len = 5 + frame[1];
+
+		if (sim->rxlen - off < len)
+			break;
+
+		if (!intact(sim, frame)) {
+			sim->dropped++;
+			off++;
+			continue;
+		}
+
+		handle(sim, frame);
+		off += len;
+	}
+
+	sim->rxlen -= off;
+	memmove(sim->rxbuf, sim->rxbuf + off, sim->rxlen);
+}
+
+/* Write out all the bytes that are due. */
+static void flush(struct sim *sim)
+{
+	uint8_t buf[sizeof(sim->txbuf) / sizeof(*sim->txbuf)];
+	int64_t now = now_us();
+	size_t len = 0;
+	ssize_t written;
+
+	while (sim->txhead + len < sim->txlen &&
+	       sim->txbuf[sim->txhead + len].due <= now) {
+		buf[len] = sim->txbuf[sim->txhead + len].value;
+		len++;
+	}
+
+	if (0 == len)
+		return;
+
+	if ((written = write(sim->fd, buf, len)) <= 0)
+		return;
+
+	sim->txhead += written;
+
+	if (sim->txhead == sim->txlen)
+		sim->txhead = sim->txlen = 0;
+}
+
+int sim_step(struct sim *sim, int timeout)
+{
+	struct pollfd pfd = {sim->fd, POLLIN, 0};
+	int64_t wait = (int64_t)timeout * 1000;
+	struct timespec ts;
+	ssize_t rread;
+
+	if (sim->txhead < sim->txlen) {
+		int64_t left = sim->txbuf[sim->txhead].due - now_us();
+
+		if (left < wait)
+			wait = left > 0 ? left : 0;
+	}
+
+	ts.tv_sec = wait / 1000000;
+	ts.tv_nsec = (wait % 1000000) * 1000;
+
+	if (-1 == ppoll(&pfd, 1, &ts, NULL))
+		return EINTR == errno ? 0 : -1;
+
+	if (pfd.revents & POLLIN) {
+		rread = read(sim->fd, sim->rxbuf + sim->rxlen,
+		             sizeof(sim->rxbuf) - sim->rxlen);
+
+		/* The other end of a socket went away. */
+		if (0 == rread) {
+			errno = EPIPE;
+			return -1;
+		}
+
+		if (rread > 0) {
+			if (sim->echo)
+				queue(sim, sim->rxbuf + sim->rxlen, rread, 0, 0);
+
+			sim->rxlen += rread;
+			parse(sim);
+
+			/* Nothing but noise, start over. */
+			if (sim->rxlen == sizeof(sim->rxbuf))
+				sim->rxlen = 0;
+		}
+	} else if (pfd.revents & POLLHUP) {
+		/* Nobody has the slave side open, do not spin. */
+		ts = (struct timespec){0, 10000000};
+		nanosleep(&ts, NULL);
+	}
+
+	flush(sim);
+	return 0;
+}
+
+void sim_run(struct sim *sim, volatile int *stop)
+{
+	while (!*stop)
+		if (-1 == sim_step(sim, 100))
+			break;
+}
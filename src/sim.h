@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2013  Jan Dvorak <mordae@anilinux.org>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SIM_H
+#define _SIM_H 1
+
+#include "cctalk.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Kinds of simulated peripherals. */
+enum sim_kind {
+	SIM_ACCEPTOR = 0,
+	SIM_HOPPER = 1,
+	SIM_VALIDATOR = 2,
+};
+
+/* Single simulated peripheral. */
+struct sim_device {
+	enum sim_kind kind;
+	uint8_t address;
+	uint32_t serial;
+
+	/* Recommended polling interval, in REQUEST_POLLING_PRIORITY
+	 * units and their count. */
+	uint8_t poll_units, poll_value;
+
+	/* Coin acceptor state, bill validators share the event buffer. */
+	uint8_t master_enable;
+	uint16_t inhibit_mask;
+	uint8_t counter;
+	uint8_t events[5][2];
+	double pending_coins;
+
+	/* Hopper state. */
+	uint8_t enabled;
+	uint8_t hopper_counter;
+	unsigned stock;
+	uint8_t remaining, paid, unpaid;
+	double pending_payout;
+
+	/* Bill validator state, bill type held in escrow and until when. */
+	uint8_t escrow;
+	int64_t escrow_until;
+	double pending_bills;
+};
+
+/* Recorded reply bytes, delayed since the request in microseconds. */
+struct sim_chunk {
+	int64_t delay;
+	size_t off, len;
+};
+
+/* Recorded request and the replies that followed it. */
+struct sim_exchange {
+	/* Microseconds since the start of the trace. */
+	int64_t time;
+
+	/* Request bytes in the pool and the reply chunks. */
+	size_t off, len;
+	size_t chunk, nchunks;
+};
+
+/* Captured session served instead of the simulated devices. */
+struct sim_replay {
+	/* Timing scale, 2 replays twice as fast. */
+	double speed;
+
+	/* Recorded bytes and what they were. */
+	uint8_t *pool;
+	struct sim_chunk *chunks;
+	struct sim_exchange *exchanges;
+	size_t nexchanges;
+
+	/* Next exchange expected. */
+	size_t next;
+
+	/* Last exchange matched, when its request arrived and when
+	 * its reply was due to be written out. */
+	const struct sim_exchange *last;
+	int64_t last_at, last_done;
+
+	/* Requests that matched the trace, recorded requests the host
+	 * did not repeat and requests that were not recorded at all.
+	 * The latter are answered by a recorded reply to an identical
+	 * request if there is one. */
+	uint64_t matched, skipped, extra, substituted;
+	uint64_t skipped_methods[256], extra_methods[256];
+
+	/* Sums of the intervals between consecutive matched requests
+	 * and of the host turnarounds from the reply to the next
+	 * request, both original and replayed, in microseconds. */
+	int64_t orig_interval, interval, orig_turnaround, turnaround;
+	uint64_t intervals, turnarounds;
+};
+
+/* Byte waiting to be written to the line. */
+struct sim_byte {
+	int64_t due;
+	uint8_t value;
+};
+
+/* Bus full of simulated peripherals on the master side of a pty. */
+struct sim {
+	/* Master side of the pseudo-terminal, see sim_attach(). */
+	int fd;
+
+	/* Checksum mode shared by the whole bus. */
+	enum cctalk_crc_mode crc_mode;
+
+	/* Loop every received byte back, like the real bus does. */
+	int echo;
+
+	/* Reply latency and extra random delay before every reply
+	 * byte, in microseconds. */
+	int latency, jitter;
+
+	/* Probability of a bit flip in every reply byte. */
+	double corrupt;
+
+	/* Coins inserted into every enabled acceptor per second. */
+	double coin_rate;
+
+	/* Coins paid out by every hopper per second. */
+	double payout_rate;
+
+	/* Bills inserted into every enabled validator per second. */
+	double bill_rate;
+
+	/* Captured session to replay, see sim_replay(). */
+	struct sim_replay *replay;
+
+	/* Simulated devices. */
+	struct sim_device *devices;
+	size_t ndevices;
+
+	/* Random number generator state. */
+	unsigned short seed[3];
+
+	/* Bytes received, waiting to form a frame. */
+	uint8_t rxbuf[1024];
+	size_t rxlen;
+
+	/* Bytes to be written, ordered by their due time. */
+	struct sim_byte txbuf[4096];
+	size_t txhead, txlen;
+
+	/* Last time the devices were advanced. */
+	int64_t now;
+
+	/* Frames received, answered and dropped as corrupted. */
+	uint64_t frames, replies, dropped;
+};
+
+/* Create simulator on a new pseudo-terminal.  Stores path of the
+ * slave side, to be opened by the host. */
+struct sim *sim_new(char *path, size_t size);
+
+/* Serve the bus on given connected descriptor, such as a socket,
+ * instead of the pseudo-terminal.  The simulator takes it over. */
+void sim_attach(struct sim *sim, int fd);
+
+/* Close the pseudo-terminal and free the simulator. */
+void sim_free(struct sim *sim);
+
+/* Add simulated device. */
+struct sim_device *sim_add(struct sim *sim, enum sim_kind kind,
+                           uint8_t address);
+
+/*
+ * Serve replies from a session recorded with cctalk_capture_open()
+ * instead of simulating devices.  Every request is matched against
+ * the recorded ones and the replies that followed are written back
+ * with their original delays divided by speed.
+ */
+int sim_replay(struct sim *sim, const char *path, double speed);
+
+/* The whole trace was served. */
+int sim_replay_done(const struct sim *sim);
+
+/* Describe how the replayed session differed from the recording. */
+void sim_replay_report(const struct sim *sim, FILE *out);
+
+/* Process line traffic for up to timeout milliseconds. */
+int sim_step(struct sim *sim, int timeout);
+
+/* Run until the stop flag gets set. */
+void sim_run(struct sim *sim, volatile int *stop);
+
+#endif				/* !_SIM_H */